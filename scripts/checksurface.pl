@@ -5,8 +5,9 @@ use strict;
 my $chain    = defined($::chain)?$::chain:'A';
 my $minMatch = defined($::min)?$::min:3;
 my $probe    = defined($::probe)?$::probe:1.4;
+my $radius   = defined($::radius)?$::radius:15;
 
-UsageDie($chain, $minMatch) if((scalar(@ARGV) < 2) || defined($::h));
+UsageDie($chain, $minMatch, $probe, $radius) if((scalar(@ARGV) < 2) || defined($::h));
 
 my $templatePdbFile = shift(@ARGV);
 
@@ -14,115 +15,75 @@ my $tmpDir  = "/var/tmp/checksurface_" . $$ . time();
 `mkdir $tmpDir`;
 die "Can't create $tmpDir directory" if(! -d $tmpDir);
 
-# Get a list of surface residues from the template PDB file
-my @templateSurfaceResidues =
-    GetSurfaceResidues($tmpDir, $templatePdbFile, $probe);
-
-foreach my $targetPDBFile (@ARGV)
+# Write a patch around the CA of each surface residue of the template in
+# the chain of interest. As when pdbsolv was used, surface residues are
+# those with a relative accessibility above 10%
+my $minAccess = 10.0;
+my $patchFile = "$tmpDir/patches.surf";
+`pdbhetstrip $templatePdbFile | matchpatchsurface -e sasa -p $probe -t $minAccess -P $radius -c $chain > $patchFile`;
+
+# Extract the surface descriptor for each target PDB file and list them
+my %targetPDBFiles = ();
+my $listFile       = "$tmpDir/targets.lis";
+if(open(my $list, '>', $listFile))
 {
-    # Extract the surface descriptor for this PDB file
-    `matchpatchsurface $targetPDBFile > $tmpDir/targetPDBFile.surf`;
-
-    foreach my $templateSurfaceResidue (@templateSurfaceResidues)
+    my $nTarget = 0;
+    foreach my $targetPDBFile (@ARGV)
     {
-        # If the residue is in the chain of interest
-        if($templateSurfaceResidue =~ /^$chain/)
-        {
-            # Build a patch around that residue
-            `pdbmakepatch -r 15 $templateSurfaceResidue CA $tmpDir/access.pdb >$tmpDir/patch.pdb`;
-            ExtractPatch($tmpDir, "patch.pdb", "patchonly.pdb");
-            
-            # Create the surface descriptor for the patch
-            if(! -f "$tmpDir/patch_${templateSurfaceResidue}.surf")
-            {
-                `matchpatchsurface -s $tmpDir/patchonly.pdb > $tmpDir/patch_${templateSurfaceResidue}.surf`;
-            }
-
-            # Match this patch against the surface of the PDB file
-            `matchpatch $tmpDir/patch_${templateSurfaceResidue}.surf $tmpDir/targetPDBFile.surf >$tmpDir/results.txt`;
-
-
-            my $lines = `wc -l $tmpDir/results.txt`;
-            if($lines >= $minMatch)
-            {
-                print "\nTemplate patch around $templateSurfaceResidue matches $targetPDBFile:\n";
-                system("cat $tmpDir/results.txt");
-            }
-        }
+        my $targetSurfFile = "$tmpDir/target_" . $nTarget++ . ".surf";
+        `matchpatchsurface $targetPDBFile > $targetSurfFile`;
+        $targetPDBFiles{$targetSurfFile} = $targetPDBFile;
+        print $list "$targetSurfFile\n";
     }
+    close($list);
 }
 
-
-
-unlink $tmpDir;
-
-
-
-sub ExtractPatch
+# Match every patch against every target surface in a single run. 
+# Targets that can't match $minMatch residues are dropped early
+if(open(my $results, '-|', "matchpatch -m $minMatch -p -l $patchFile $listFile"))
 {
-    my($tmpDir, $inPDB, $outPDB) = @_;
-
-    if(open(my $in, '<', "$tmpDir/$inPDB"))
+    my $print = 0;
+    while(<$results>)
     {
-        if(open(my $out, '>', "$tmpDir/$outPDB"))
+        if(/^Query: (\S+) Structure: (\S+) Matches: (\d+)/)
         {
-            while(<$in>)
+            $print = ($3 >= $minMatch);
+            if($print)
             {
-                if(substr($_, 62, 4) eq "1.00")
-                {
-                    print $out "$_";
-                }
+                print "\nTemplate patch around $1 matches $targetPDBFiles{$2}:\n";
             }
-            close($out);
         }
-        close($in);
-    }
-}
-
-
-
-sub GetSurfaceResidues
-{
-    my($tmpDir, $templatePdbFile, $probe) = @_;
-    
-    `pdbhetstrip $templatePdbFile | pdbsolv -p $probe -x -r $tmpDir/resSolv.dat > $tmpDir/access.pdb`;
-    my @templateSurfaceResidues = ();
-    if(open(my $fp, '<', "$tmpDir/resSolv.dat"))
-    {
-        while(<$fp>)
+        elsif($print)
         {
-            if(/^RESACC/)
-            {
-                my(@fields) = split;
-                if($fields[7] > 10.0)
-                {
-                    my $resid = $fields[1] . $fields[2];
-                    push @templateSurfaceResidues, $resid;
-                }
-            }
+            print;
         }
     }
-
-    return(@templateSurfaceResidues);
+    close($results);
 }
 
+`rm -rf $tmpDir`;
+
+
 
 sub UsageDie
 {
-    my($chain, $minMatch) = @_;
+    my($chain, $minMatch, $probe, $radius) = @_;
     
     print <<__EOF;
 
-checksurface V1.0 (c) 2021 UCL, Prof Andrew C.R. Martin
+checksurface V1.1 (c) 2021 UCL, Prof Andrew C.R. Martin
 
-Usage: checksurface [-chain=c][-min=n] template.pdb target.pdb [target.pdb ...]
+Usage: checksurface [-chain=c][-min=n][-probe=p][-radius=r] template.pdb target.pdb [target.pdb ...]
           -chain  Specify the chain of interest in the template [$chain]
           -min    Minimum number of residues to match in a pattern [$minMatch]
-
-Takes a template PDB file and identifies the surface residues. Each of these is used as
-the centre of a 15A radius surface patch. For each of these patches, a matchpatch 
-surface descriptor is created scanned against the surface of each target PDB file in 
-turn.
+          -probe  Probe radius for the template accessibility [$probe]
+          -radius Radius of each surface patch [$radius]
+
+Takes a template PDB file and identifies the surface residues (those with a relative
+accessibility above 10%). The CA of each of these is used as the centre of a ${radius}A 
+radius surface patch. All the patches are written by one run
+of matchpatchsurface and matched against the surface of each target PDB file by one 
+run of matchpatch.
 
 Note that `matchpatch`, `matchpatchsurface` and BiopTools must be installed and in your
 path.
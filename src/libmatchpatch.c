@@ -0,0 +1,390 @@
+/*************************************************************************
+
+   Program:    libmatchpatch
+   File:       libmatchpatch.c
+
+   Version:    V1.5
+   Date:       17.10.26
+   Function:   Library interface to the matching done by matchpatch
+
+   Copyright:  (c) SciTech Software / abYinformatics 1993-2026
+   Author:     Prof. Andrew C. R. Martin
+   EMail:      andrew@bioinf.org.uk
+
+**************************************************************************
+
+   This program is not in the public domain, but it may be freely copied
+   and distributed for no charge providing this header is included.
+   The code may be modified as required, but any modifications must be
+   documented so that the person responsible can be identified. If someone
+   else breaks this code, I don't want to be blamed for code that does not
+   work! The code may not be sold commercially without print permission
+   from the author, although it may be given away free with commercial
+   products, providing it is made clear that this program is free and
+   that the source code is provided with the program.
+
+**************************************************************************
+
+   Description:
+   ============
+   Wraps the SURFACE and ATOM arrays used by mpcore.c in handles for
+   patterns and structures. See libmatchpatch.h. matchpatch also 
+   prepares all its patterns and structures through mpReadPattern() and
+   mpReadStructure() and matches them with mpiMatch(), which takes its
+   minmatch and verbose from the caller rather than the settings.
+
+**************************************************************************
+
+   Usage:
+   ======
+
+**************************************************************************
+
+   Notes:
+   ======
+   mpMatch() works on copies of the atom arrays since mpiDoLesk() changes
+   them, so the handles are never changed once they have been made.
+
+**************************************************************************
+
+   Revision History:
+   =================
+   V1.0  17.10.26 Original By: agent
+   V1.1  17.10.26 Added minmatch setting By: agent
+   V1.2  17.10.26 mpGetSettings() and mpSetSettings() moved to mpcore.c
+                  By: agent
+   V1.3  17.10.26 mpMatch() reports its progress with the verbose 
+                  setting By: agent
+   V1.4  17.10.26 Tables of residues with invalid properties are 
+                  rejected By: agent
+   V1.5  17.10.26 The handles are defined in mpcore.h. Added mpiMatch()
+                  for matchpatch By: agent
+
+*************************************************************************/
+/* Includes
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bioplib/MathType.h"
+#include "bioplib/SysDefs.h"
+#include "bioplib/macros.h"
+
+#include "mpcore.h"
+
+/************************************************************************/
+/* Prototypes
+*/
+static MPPATTERN *PreparePattern(SURFACE *surf, BOOL invert);
+static MPSTRUCTURE *PrepareStructure(SURFACE *surf);
+static BOOL ValidResidues(MPRESIDUE *res, int nres);
+
+/************************************************************************/
+/*>MPPATTERN *mpReadPattern(FILE *fp, BOOL invert)
+   -----------------------------------------------
+   Reads a pattern from fp (text or binary output of matchpatchsurface)
+   inverting its properties if required. Reading stops at the end of the
+   file or a line starting with >. Returns NULL if there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+MPPATTERN *mpReadPattern(FILE *fp, BOOL invert)
+{
+   return(PreparePattern(mpiReadDataAndCreateMatrix(fp), invert));
+}
+
+
+/************************************************************************/
+/*>MPPATTERN *mpCreatePattern(MPRESIDUE *res, int nres, BOOL invert)
+   -----------------------------------------------------------------
+   Makes a pattern from a table of residues, which is copied. Returns
+   NULL if there is no memory or the table is not valid (see
+   ValidResidues()).
+
+   17.10.26 Original   By: agent
+   17.10.26 Checks the residues By: agent
+*/
+MPPATTERN *mpCreatePattern(MPRESIDUE *res, int nres, BOOL invert)
+{
+   if(!ValidResidues(res, nres))
+      return(NULL);
+   return(PreparePattern(mpiCreateSurface(res, nres), invert));
+}
+
+
+/************************************************************************/
+/*>void mpFreePattern(MPPATTERN *pat)
+   ----------------------------------
+   Frees a pattern. NULL is ignored.
+
+   17.10.26 Original   By: agent
+*/
+void mpFreePattern(MPPATTERN *pat)
+{
+   if(pat != NULL)
+   {
+      FREE(pat->atoms);
+      mpiFreeSurface(pat->surf);
+      free(pat);
+   }
+}
+
+
+/************************************************************************/
+/*>MPSTRUCTURE *mpReadStructure(FILE *fp)
+   --------------------------------------
+   Reads a structure from fp as mpReadPattern() does. Returns NULL if
+   there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+MPSTRUCTURE *mpReadStructure(FILE *fp)
+{
+   return(PrepareStructure(mpiReadDataAndCreateMatrix(fp)));
+}
+
+
+/************************************************************************/
+/*>MPSTRUCTURE *mpCreateStructure(MPRESIDUE *res, int nres)
+   --------------------------------------------------------
+   Makes a structure from a table of residues, which is copied. Returns
+   NULL if there is no memory or the table is not valid (see
+   ValidResidues()).
+
+   17.10.26 Original   By: agent
+   17.10.26 Checks the residues By: agent
+*/
+MPSTRUCTURE *mpCreateStructure(MPRESIDUE *res, int nres)
+{
+   if(!ValidResidues(res, nres))
+      return(NULL);
+   return(PrepareStructure(mpiCreateSurface(res, nres)));
+}
+
+
+/************************************************************************/
+/*>void mpFreeStructure(MPSTRUCTURE *struc)
+   ----------------------------------------
+   Frees a structure. NULL is ignored.
+
+   17.10.26 Original   By: agent
+*/
+void mpFreeStructure(MPSTRUCTURE *struc)
+{
+   if(struc != NULL)
+   {
+      FREE(struc->atoms);
+      mpiFreeSurface(struc->surf);
+      free(struc);
+   }
+}
+
+
+/************************************************************************/
+/*>BOOL mpMatch(MPPATTERN *pat, MPSTRUCTURE *struc, BOOL window,
+                MPRESULT *result)
+   -------------------------------------------------------------
+   Matches a pattern against a structure, against a window around each
+   structure residue if window is set (as matchpatch -w). The matches
+   are placed in result, which must be freed with mpFreeResult().
+   There are no matches if there would be fewer than the minmatch 
+   setting. With the verbose setting, the number of distances and the
+   progress of the matching are reported on stderr as by matchpatch -v.
+   Returns FALSE (with result empty) if there is no memory or the 
+   matching fails.
+
+   17.10.26 Original   By: agent
+   17.10.26 Uses the minmatch setting By: agent
+   17.10.26 Gets minmatch with mpGetSettings() By: agent
+   17.10.26 Added verbose By: agent
+   17.10.26 Matching moved into mpiMatch() By: agent
+*/
+BOOL mpMatch(MPPATTERN *pat, MPSTRUCTURE *struc, BOOL window,
+             MPRESULT *result)
+{
+   MPSETTINGS settings;
+
+   mpGetSettings(&settings);
+
+   if(settings.verbose)
+   {
+      fprintf(stderr, "%ld distances calculated from %d pattern atoms; \
+%ld distances calculated from %d structure atoms\n",
+              pat->surf->npair, pat->surf->nres, 
+              struc->surf->npair, struc->surf->nres);
+   }
+
+   return(mpiMatch(pat, struc, window, settings.minmatch, 
+                   settings.verbose, result));
+}
+
+
+/************************************************************************/
+/*>BOOL mpiMatch(MPPATTERN *pat, MPSTRUCTURE *struc, BOOL window,
+                 int minmatch, BOOL verbose, MPRESULT *result)
+   -------------------------------------------------------------
+   Does the work of mpMatch() but with minmatch and verbose given, so
+   matchpatch can raise minmatch for -k and give each list its own
+   progress reports. Prints a message if there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+BOOL mpiMatch(MPPATTERN *pat, MPSTRUCTURE *struc, BOOL window,
+              int minmatch, BOOL verbose, MPRESULT *result)
+{
+   ATOM      *PatAtom   = NULL,
+             *StrucAtom = NULL;
+   MATCHPAIR *match     = NULL;
+   int       nmatch     = (-1),
+             centre     = (-1),
+             i;
+
+   result->match  = NULL;
+   result->nmatch = 0;
+   result->centre = NULL;
+
+   PatAtom   = (ATOM *)malloc(MAX(pat->surf->nres, 1) * sizeof(ATOM));
+   StrucAtom = (ATOM *)malloc(MAX(struc->surf->nres, 1) * sizeof(ATOM));
+   match     = (MATCHPAIR *)malloc(MAX(pat->surf->nres, 1) *
+                                   sizeof(MATCHPAIR));
+   if((PatAtom != NULL) && (StrucAtom != NULL) && (match != NULL))
+   {
+      memcpy(PatAtom, pat->atoms, pat->surf->nres * sizeof(ATOM));
+      memcpy(StrucAtom, struc->atoms, struc->surf->nres * sizeof(ATOM));
+      if(window)
+         nmatch = mpiDoWindowedLesk(pat->surf, PatAtom, struc->surf,
+                                    StrucAtom, match, &centre, 
+                                    minmatch, verbose);
+      else
+         nmatch = mpiDoLesk(pat->surf, PatAtom, struc->surf, StrucAtom,
+                            match, minmatch, verbose);
+   }
+   else
+   {
+      fprintf(stderr,"No memory for matches\n");
+   }
+
+   if(nmatch >= 0)
+   {
+      if((result->match = (MPMATCH *)malloc(MAX(nmatch, 1) *
+                                            sizeof(MPMATCH))) == NULL)
+      {
+         fprintf(stderr,"No memory for matches\n");
+      }
+      else
+      {
+         for(i=0; i<nmatch; i++)
+         {
+            result->match[i].pat   = &(pat->surf->res[match[i].pat]);
+            result->match[i].struc = 
+               &(struc->surf->res[match[i].struc]);
+            result->match[i].score = match[i].score;
+         }
+         result->nmatch = nmatch;
+         if(centre != (-1))
+            result->centre = &(struc->surf->res[centre]);
+      }
+   }
+
+   FREE(PatAtom);
+   FREE(StrucAtom);
+   FREE(match);
+   return(result->match != NULL);
+}
+
+
+/************************************************************************/
+/*>void mpFreeResult(MPRESULT *result)
+   -----------------------------------
+   Frees the matches in a result from mpMatch()
+
+   17.10.26 Original   By: agent
+*/
+void mpFreeResult(MPRESULT *result)
+{
+   FREE(result->match);
+   result->nmatch = 0;
+   result->centre = NULL;
+}
+
+
+/************************************************************************/
+/*>static MPPATTERN *PreparePattern(SURFACE *surf, BOOL invert)
+   ------------------------------------------------------------
+   Makes a pattern from a SURFACE, which it takes over. Returns NULL if
+   surf is NULL or there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+static MPPATTERN *PreparePattern(SURFACE *surf, BOOL invert)
+{
+   MPPATTERN *pat;
+
+   if(surf == NULL)
+      return(NULL);
+
+   if(((pat = (MPPATTERN *)malloc(sizeof(MPPATTERN))) == NULL) ||
+      ((pat->atoms = mpiCreateAtomArray(surf, invert)) == NULL))
+   {
+      FREE(pat);
+      mpiFreeSurface(surf);
+      return(NULL);
+   }
+   pat->surf = surf;
+   return(pat);
+}
+
+
+/************************************************************************/
+/*>static MPSTRUCTURE *PrepareStructure(SURFACE *surf)
+   ---------------------------------------------------
+   Makes a structure from a SURFACE, which it takes over, building its
+   signature. Returns NULL if surf is NULL or there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+static MPSTRUCTURE *PrepareStructure(SURFACE *surf)
+{
+   MPSTRUCTURE *struc;
+
+   if(surf == NULL)
+      return(NULL);
+
+   if(((struc = (MPSTRUCTURE *)malloc(sizeof(MPSTRUCTURE))) == NULL) ||
+      !mpiCreateSignature(surf) ||
+      ((struc->atoms = mpiCreateAtomArray(surf, FALSE)) == NULL))
+   {
+      FREE(struc);
+      mpiFreeSurface(surf);
+      return(NULL);
+   }
+   struc->surf = surf;
+   return(struc);
+}
+
+
+/************************************************************************/
+/*>static BOOL ValidResidues(MPRESIDUE *res, int nres)
+   ---------------------------------------------------
+   Checks a table of residues given to the library. nres must not be
+   negative and each residue's properties may only have the MPPROP_ 
+   bits set, since they are used to index the signature and property
+   set arrays.
+
+   17.10.26 Original   By: agent
+*/
+static BOOL ValidResidues(MPRESIDUE *res, int nres)
+{
+   int i;
+
+   if((nres < 0) || ((nres > 0) && (res == NULL)))
+      return(FALSE);
+
+   for(i=0; i<nres; i++)
+   {
+      if(!VALIDPROPERTIES(res[i].properties))
+         return(FALSE);
+   }
+   return(TRUE);
+}
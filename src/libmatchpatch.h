@@ -0,0 +1,164 @@
+/*************************************************************************
+
+   Program:    libmatchpatch
+   File:       libmatchpatch.h
+
+   Version:    V1.4
+   Date:       17.10.26
+   Function:   Public interface to the matching done by matchpatch
+
+   Copyright:  (c) SciTech Software / abYinformatics 1993-2026
+   Author:     Prof. Andrew C. R. Martin
+   EMail:      andrew@bioinf.org.uk
+
+**************************************************************************
+
+   This program is not in the public domain, but it may be freely copied
+   and distributed for no charge providing this header is included.
+   The code may be modified as required, but any modifications must be
+   documented so that the person responsible can be identified. If someone
+   else breaks this code, I don't want to be blamed for code that does not
+   work! The code may not be sold commercially without print permission
+   from the author, although it may be given away free with commercial
+   products, providing it is made clear that this program is free and
+   that the source code is provided with the program.
+
+**************************************************************************
+
+   Description:
+   ============
+   A pattern or structure is prepared once from the output of
+   matchpatchsurface (text or binary) or from a table of residues and
+   may then be matched any number of times. Preparing a structure
+   calculates its distances, signature and atom array; preparing a
+   pattern calculates its distances and atom array. Matching does not
+   change either so the same pattern and structure may be matched in
+   several threads at once.
+
+   The settings are shared by the whole program and must be set before
+   any patterns or structures are prepared since the distances depend on
+   them. Get the current settings with mpGetSettings() and change those
+   required so that any others keep their defaults.
+
+   Finding the surface residues of a PDB file is not part of the
+   library; it is still done by the matchpatchsurface program.
+
+   A table of residues gives each one's properties as bits, with bit
+   (1 << MPPROP_xxx) set for each property it has. These are the same
+   bits as matchpatchsurface writes. mpCreatePattern() and 
+   mpCreateStructure() return NULL if any residue has other bits set
+   (including a negative value) or nres is negative, as well as if 
+   there is no memory.
+
+   Results give the pattern and structure residue of each match. These
+   point into the pattern and structure so must not be used once they
+   have been freed.
+
+**************************************************************************
+
+   Usage:
+   ======
+   mpGetSettings(&settings);
+   settings.binsize = 2.0;
+   mpSetSettings(&settings);
+   pat   = mpReadPattern(fp_pat, FALSE);
+   struc = mpReadStructure(fp_struc);
+   if(mpMatch(pat, struc, FALSE, &result))
+   {
+      for(i=0; i<result.nmatch; i++)
+         ... result.match[i].pat->resid, result.match[i].struc->resid
+      mpFreeResult(&result);
+   }
+   mpFreePattern(pat);
+   mpFreeStructure(struc);
+
+   Link with -lmatchpatch -lbiop -lgen -lm -lxml2 -lpthread
+
+**************************************************************************
+
+   Revision History:
+   =================
+   V1.0  17.10.26 Original By: agent
+   V1.1  17.10.26 Added minmatch to MPSETTINGS By: agent
+   V1.2  17.10.26 Added the MPPROP_ property bits By: agent
+   V1.3  17.10.26 Added verbose to MPSETTINGS By: agent
+   V1.4  17.10.26 mpCreatePattern() and mpCreateStructure() reject
+                  invalid properties By: agent
+
+*************************************************************************/
+#ifndef _LIBMATCHPATCH_H
+#define _LIBMATCHPATCH_H
+
+#include <stdio.h>
+#include "bioplib/MathType.h"
+#include "bioplib/SysDefs.h"
+
+#define MPMAXLABEL     8
+#define MPMAXRESID    16
+
+/* Property bits of MPRESIDUE.properties                                */
+#define MPPROP_POSITIVE     0
+#define MPPROP_NEGATIVE     1
+#define MPPROP_AROMATIC     2
+#define MPPROP_HYDROPHOBIC  3
+#define MPPROP_HYDROPHILIC  4
+#define MPMAXPROPERTIES     5
+
+/* A residue of a pattern or structure as written by matchpatchsurface */
+typedef struct
+{
+   REAL x, y, z;
+   char resnam[MPMAXLABEL],
+        resid[MPMAXRESID];
+   int  properties;              /* Bit MPPROP_xxx set for each property*/
+}  MPRESIDUE;
+
+/* Prepared patterns and structures                                     */
+typedef struct mppattern   MPPATTERN;
+typedef struct mpstructure MPSTRUCTURE;
+
+/* A pattern residue and the structure residue it matches              */
+typedef struct
+{
+   MPRESIDUE *pat,
+             *struc;
+   REAL      score;              /* % of distance bins in common        */
+}  MPMATCH;
+
+/* The matches in order of pattern residue. centre is the residue at
+   the centre of the window matched or NULL if the whole structure was
+   matched
+*/
+typedef struct
+{
+   MPMATCH   *match;
+   int       nmatch;
+   MPRESIDUE *centre;
+}  MPRESULT;
+
+/* The settings given by the matchpatch -d, -a, -c, -C, -m and -v 
+   options
+*/
+typedef struct
+{
+   REAL binsize,                 /* Distance bin size                   */
+        accuracy,                /* % of bins a match must share        */
+        cutoff;                  /* Max distance of a pair (0: no limit)*/
+   long clique;                  /* Clique search steps (0: no search)  */
+   int  minmatch;                /* Fewest matches reported (0: any)    */
+   BOOL verbose;                 /* Report matching progress on stderr  */
+}  MPSETTINGS;
+
+void        mpGetSettings(MPSETTINGS *settings);
+void        mpSetSettings(MPSETTINGS *settings);
+MPPATTERN   *mpReadPattern(FILE *fp, BOOL invert);
+MPPATTERN   *mpCreatePattern(MPRESIDUE *res, int nres, BOOL invert);
+void        mpFreePattern(MPPATTERN *pat);
+MPSTRUCTURE *mpReadStructure(FILE *fp);
+MPSTRUCTURE *mpCreateStructure(MPRESIDUE *res, int nres);
+void        mpFreeStructure(MPSTRUCTURE *struc);
+BOOL        mpMatch(MPPATTERN *pat, MPSTRUCTURE *struc, BOOL window,
+                    MPRESULT *result);
+void        mpFreeResult(MPRESULT *result);
+
+#endif
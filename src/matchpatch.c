@@ -3,8 +3,8 @@
    Program:    match
    File:       match.c
    
-   Version:    V2.0
-   Date:       16.04.21
+   Version:    V3.14
+   Date:       17.10.26
    Function:   Match 2 distance matrices as created by matchpatchsurface
    
    Copyright:  (c) SciTech Software / abYinformatics 1993-2021
@@ -49,98 +49,355 @@
    V1.3  16.04.21 Now uses our standard way of parsing the command line
    V2.0  16.04.21 Now reads coordinates and features from input files
                   instead of distance matrix which is calculated here
+   V2.1  17.10.26 Distance flags are now packed into a machine word and
+                  compared using AND and popcount By: agent
+   V2.2  17.10.26 The atom arrays are built once and updated incrementally
+                  as atoms are killed. Fixed use of all distance pairs
+                  (only the first natoms pairs were being used) By: agent
+   V2.3  17.10.26 Residues are stored once in a table and the distances
+                  as a triangular matrix of bins. Properties are held as
+                  bit flags By: agent
+   V2.4  17.10.26 Added -c to ignore pairs of residues further apart than
+                  a cutoff. Neighbour lists are then built using a cell
+                  list instead of the distance matrix By: agent
+   V2.5  17.10.26 Added -l to match one pattern against a list or 
+                  directory of structure files. The pattern atoms are 
+                  built once and reused for each structure By: agent
+   V2.6  17.10.26 Added -p to match a list of patterns against one
+                  structure. The structure atoms are built once and 
+                  copied for each pattern. Lists may also be files of
+                  records each starting with a >name line By: agent
+   V2.7  17.10.26 -l and -p may be given together to match every pattern
+                  against every structure. Added -j to share the matches
+                  between threads which steal work from each other. 
+                  Output stays in the same order By: agent
+   V2.8  17.10.26 Reads binary surface files from matchpatchsurface -b.
+                  These are mapped into memory and stored distance bins
+                  are used directly if the bin size matches By: agent
+   V2.9  17.10.26 Surfaces are read in a single pass so they may come 
+                  from a pipe. A pattern, structure or list file of -
+                  is read from stdin By: agent
+   V3.0  17.10.26 Added -X to build an inverted index of a list of 
+                  structures and -x to screen them with it before 
+                  matching By: agent
+   V3.1  17.10.26 Each structure has a signature of the property pairs
+                  found at each distance. Structures whose signature 
+                  shows that they can't match a pattern are not matched
+                  By: agent
+   V3.2  17.10.26 Added -w to match the pattern against a window around
+                  each structure residue and report the best window By: agent
+   V3.3  17.10.26 Added -C to report the largest geometrically consistent
+                  set of matches found by a clique search of the atoms
+                  which survive the Lesk refinement By: agent
+   V3.4  17.10.26 The matching core is moved to mpcore.c and built into
+                  libmatchpatch with the interface in libmatchpatch.c.
+                  Results are returned by the core and printed here By: agent
+   V3.5  17.10.26 Added -S to serve pattern queries against a list of
+                  structures held in memory over a Unix domain socket 
+                  and -q to send a query to it By: agent
+   V3.6  17.10.26 Added -k to rank the structures matched by each 
+                  pattern and report only the best By: agent
+   V3.7  17.10.26 Added -m to give no matches for structures which can't
+                  match a minimum number of pattern atoms By: agent
+   V3.8  17.10.26 The -d, -a, -c, -C and -m settings are passed to the
+                  core with mpSetSettings() By: agent
+   V3.9  17.10.26 A single pattern and structure are matched with the
+                  library interface By: agent
+   V3.10 17.10.26 -S answers one query per connection and drops clients
+                  which stall. A pattern with no residues is an error
+                  By: agent
+   V3.11 17.10.26 -S gives each client an overall deadline to send its
+                  query and another to take the reply By: agent
+   V3.12 17.10.26 -q limits the size of the reply it accepts By: agent
+   V3.13 17.10.26 Completed the -m help text By: agent
+   V3.14 17.10.26 Lists, indexes and -S prepare and match their 
+                  patterns and structures through the library By: agent
 
 *************************************************************************/
 /* Includes
 */
+#define _POSIX_C_SOURCE 200809L  /* For open_memstream()               */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 
 #include "bioplib/MathType.h"
 #include "bioplib/SysDefs.h"
 #include "bioplib/fsscanf.h"
 #include "bioplib/macros.h"
 
-#include "properties.h"
+#include "mpcore.h"
 
 /************************************************************************/
 /* Defines
 */
-#define MAXITER       100
-#define MAXDIST        32
-#define MAXBUFF       160
-#define MAXLABEL        8
-#define MAXRESID       16
-
-#define DEFBIN        1.0     /* Default distance bin size              */
-#define DEFACC       50.0     /* Default string match accuracy          */
+#define SURFEXT     ".surf"   /* Extension of structure files in a dir  */
+#define SURFBINEXT  ".surfb"  /* Extension of binary surface files      */
+#define STDINFILE   "-"       /* File name for stdin                    */
+#define DEFSCREEN    20.0     /* Default % of pattern pairs for -x      */
+#define INDEXMAGIC   "MPINDEX"
+#define INDEXVERSION 1
+#define INDEXENDIAN  0x01020304
+
+/* The index key of a pair of residues with properties p1 and p2 (each
+   a set of PROP_xxx bits) whose distance falls in bin
+*/
+#define NINDEXKEY     (NPROPSETS * NPROPSETS * MAXDIST)
+#define PAIRKEY(p1, p2, bin) \
+   ((((p1) < (p2)) ? ((p1) * NPROPSETS + (p2)) \
+                   : ((p2) * NPROPSETS + (p1))) * MAXDIST + (bin))
+#define MAXTHREADS     64     /* Max threads for -j                     */
+#define MAXREQUEST  (16L * 1024L * 1024L) /* Max pattern size for -S    */
+#define MAXREPLY    (64L * MAXREQUEST)    /* Max reply size for -q      */
+#define SERVEBACKLOG   16     /* Connections waiting to be accepted     */
+#define SERVETIMEOUT   10     /* Seconds a -S client has to send its 
+                                 query and again to take the reply      */
 
 /************************************************************************/
 /* Structure and type definitions
 */
+/* A surface in a list of surfaces. The surface starts at offset in 
+   file and is reported as label
+*/
+typedef struct
+{
+   char *file,
+        *label;
+   long offset;
+}  SURFFILE;
+
+/* An index of a list of structures. For each key (see PAIRKEY()), 
+   post[start[key]] to post[start[key+1]-1] give the structures with
+   pairs of residues having that key and the number of such pairs, in
+   order of structure. The header is written at the start of the file.
+*/
+typedef struct
+{
+   int struc,
+       count;
+}  POSTING;
+
+typedef struct
+{
+   char   magic[8];
+   int    version,
+          endian,
+          nstruc,
+          nkey,
+          npost,
+          maxdist;
+   double binsize,
+          cutoff;
+}  INDEXHEADER;
+
+typedef struct
+{
+   SURFFILE *StrucList;
+   POSTING  *post;
+   int      *start,
+            nstruc,
+            npost;
+}  SURFINDEX;
+
+/* A structure from a list. It is read when it is first needed and 
+   freed when all the patterns have been matched against it (nused 
+   counts these). handle is NULL if it can't be read
+*/
 typedef struct
 {
-   char resnam[2][MAXLABEL],
-        resid[2][MAXRESID],
-        properties[2][MAXPROPERTIES+1];
-   int  dist;
-   BOOL dead;
-}  DATA;
+   MPSTRUCTURE     *handle;
+   int             nused;
+   BOOL            loaded;
+   pthread_mutex_t lock;
+}  LISTSURF;
 
-typedef struct _indata
+/* The output of a match. text is NULL if it has been written directly */
+typedef struct
+{
+   char   *text;
+   size_t len;
+   BOOL   done;
+}  MATCHRESULT;
+
+/* A structure matched by a pattern with -k: its number of matches, 
+   their mean score and the output for it
+*/
+typedef struct
+{
+   char   *text;
+   size_t len;
+   REAL   score;
+   int    struc,
+          nmatch;
+}  RANKED;
+
+/* The best structures for a pattern with -k, kept as a heap with the
+   worst at the top so it can be replaced
+*/
+typedef struct
 {
-   REAL x, y, z;
-   char resnam[MAXLABEL],
-        resid[MAXRESID],
-        properties[MAXPROPERTIES+1];
-   struct _indata *next;
-}  INDATA;
+   RANKED *best;
+   int    nbest;
+}  RANKING;
 
+/* Each thread owns a range of matches, next to end-1. It takes its own
+   matches from the start of the range; when it runs out, it steals the
+   second half of another thread's range
+*/
+typedef struct
+{
+   int             next,
+                   end;
+   pthread_t       thread;
+   BOOL            started;
+   pthread_mutex_t lock;
+}  MATCHQUEUE;
+
+/* Matching every pattern against every structure. Match m is of 
+   pattern (m % npat) against structure (m / npat). Results are written
+   in order of m; nwritten is the next to be written. With -k, rank 
+   holds the best ntop structures for each pattern instead and these
+   are written at the end
+*/
+typedef struct
+{
+   FILE            *out;
+   SURFFILE        *PatList,
+                   *StrucList;
+   MPPATTERN       **pat;
+   LISTSURF        *struc;
+   MATCHRESULT     *result;
+   MATCHQUEUE      *queue;
+   RANKING         *rank;
+   RANKED          *ranked;
+   int             npat,
+                   nstruc,
+                   nmatch,
+                   nqueue,
+                   nwritten,
+                   ntop;
+   BOOL            PatLabel,
+                   StrucLabel,
+                   window,
+                   verbose;
+   pthread_mutex_t lock;
+}  MATCHRUN;
+
+/* A server for -S. Each of gNThreads threads accepts connections on
+   listenfd and answers the queries on them by matching against the 
+   structures in struc, which are all held in memory
+*/
+typedef struct
+{
+   SURFFILE *StrucList;
+   LISTSURF *struc;
+   int      nstruc,
+            listenfd;
+   BOOL     verbose;
+}  SERVER;
+
+/* A thread's argument: its number and the run                         */
 typedef struct
 {
-   char resnam[MAXLABEL],
-        resid[MAXRESID],
-        dist[MAXDIST],
-        properties[MAXPROPERTIES+1];
-}  ATOM;
+   MATCHRUN *run;
+   int      id;
+}  MATCHTHREAD;
 
 /************************************************************************/
 /* Globals
 */
-REAL gBin      = DEFBIN,    /* Bin size for distance matrix             */
-     gAccuracy = DEFACC;    /* Percentage accuracy for string comparison*/
+REAL gScreen   = DEFSCREEN; /* Min % of pattern pairs in index for -x   */
+int  gNThreads = 1;         /* Number of threads for list matching      */
+int  gTopK     = 0;         /* Structures reported per pattern (0: all) */
+MPSETTINGS gSettings;       /* Settings from -d, -a, -c, -C and -m      */
 
 /************************************************************************/
 /* Prototypes
 */
 int  main(int argc, char **argv);
 BOOL ParseCmdLine(int argc, char **argv, char *PatFile, char *StrucFile,
-                  char *outfile, BOOL *invert, BOOL *verbose);
+                  char *outfile, BOOL *invert, BOOL *verbose, 
+                  BOOL *list, BOOL *patlist, char *IndexFile,
+                  BOOL *build, BOOL *window, char *SocketFile,
+                  BOOL *serve);
 void Usage(void);
 void MatchFiles(FILE *out, FILE *fp_pat, FILE *fp_struc, BOOL invert,
+                BOOL window);
+int  MatchSurfaces(FILE *out, MPPATTERN *pat, MPSTRUCTURE *struc, 
+                   char *label, BOOL window, int minmatch, REAL *score,
+                   BOOL verbose);
+void PrintMatches(FILE *out, char *label, MPMATCH *match, int nmatch,
+                  REAL *score);
+void MatchSurfaceLists(FILE *out, SURFFILE *PatList, MPPATTERN **pat,
+                       int npat, SURFFILE *StrucList, int nstruc, 
+                       BOOL PatLabel, BOOL StrucLabel, BOOL window,
+                       BOOL verbose);
+MPPATTERN **ReadPatterns(SURFFILE *PatList, int npat, BOOL invert, 
+                         BOOL verbose);
+void FreePatterns(MPPATTERN **pat, int npat);
+void *MatchThread(void *arg);
+BOOL TakeMatch(MATCHRUN *run, int id, int *match);
+void RunMatch(MATCHRUN *run, int match);
+MPSTRUCTURE *GetStructure(MATCHRUN *run, int s);
+void ReleaseStructure(MATCHRUN *run, int s);
+void WriteMatchResult(MATCHRUN *run, int match, char *text, size_t len);
+int  RankThreshold(MATCHRUN *run, int p);
+void RankMatch(MATCHRUN *run, int p, int s, int nmatch, REAL score,
+               char *text, size_t len);
+int  CompareRanked(const void *a, const void *b);
+void WriteRankings(MATCHRUN *run);
+SURFFILE *ReadSurfaceList(char *ListFile, int *nsurf);
+SURFFILE *SingleSurfaceList(char *file, int *nsurf);
+BOOL AddSurfFile(SURFFILE **list, int *nsurf, int *maxsurf, char *dir,
+                 char *file, char *label, long offset);
+MPPATTERN *ReadPatternFile(SURFFILE *sf, BOOL invert);
+MPSTRUCTURE *ReadStructureFile(SURFFILE *sf);
+FILE *SeekSurfFile(SURFFILE *sf);
+FILE *OpenSurfaceFile(char *file);
+int  CompareSurfFiles(const void *a, const void *b);
+void FreeSurfaceList(SURFFILE *list, int nsurf);
+BOOL BuildIndex(char *IndexFile, SURFFILE *StrucList, int nstruc, 
+                BOOL verbose);
+int  CountPairKeys(MPPATTERN *pat, int *count, int *keys);
+BOOL WriteIndex(char *IndexFile, SURFFILE *StrucList, int nstruc,
+                int *start, POSTING *post, int npost);
+SURFINDEX *ReadIndex(char *IndexFile);
+void FreeIndex(SURFINDEX *index);
+BOOL Serve(char *SocketFile, SURFFILE *StrucList, int nstruc, 
+           BOOL verbose);
+void *ServeThread(void *arg);
+void ServeClient(SERVER *server, int fd);
+char *MatchQuery(SERVER *server, char *query, size_t len, BOOL invert,
+                 BOOL window, size_t *outlen);
+BOOL SendQuery(char *SocketFile, FILE *fp_pat, FILE *out, BOOL invert,
+               BOOL window);
+int  ConnectSocket(char *SocketFile, BOOL listening);
+BOOL ReadFrame(int fd, char *type, char *flags, char **data, 
+               size_t *len, size_t maxlen, time_t deadline);
+BOOL WriteFrame(int fd, char *type, char *flags, char *data, 
+                size_t len, time_t deadline);
+BOOL ReadBytes(int fd, char *buffer, size_t len, time_t deadline);
+BOOL WriteBytes(int fd, char *buffer, size_t len, time_t deadline);
+time_t Deadline(int seconds);
+BOOL WaitForSocket(int fd, short events, time_t deadline);
+void MatchIndex(FILE *out, SURFINDEX *index, SURFFILE *PatList, 
+                int npat, BOOL PatLabel, BOOL invert, BOOL window,
                 BOOL verbose);
-DATA *ReadDataAndCreateMatrix(FILE *fp, int *outndists, int *outnatoms);
-ATOM *CreateAtomArray(DATA *data, int ndata, int *outnatom,
-                      BOOL SwapProp);
-int  ConvertDistanceToBin(REAL dist);
-int  GotAtom(ATOM *outdata, int natom, char *resid);
-void FillAtom(ATOM *outdata, int natom, int pos, char *resid,
-              char *resnam, char *properties,
-              int DistRange, BOOL SwapProp);
-void DoLesk(FILE *out, int npat, DATA *pat, int nstruc, DATA *struc,
-            BOOL invert, BOOL verbose);
-void KillAtom(char *resid, DATA *data, 
-              int ndata);
-void TrimBitStrings(int npat, ATOM *pat, int nstruc, ATOM *struc);
-void PrintResults(FILE *out, int NPatAtom,   ATOM *PatAtom, 
-                  int NStrucAtom, ATOM *StrucAtom);
-void PrintBestMatch(FILE *out,
-                    ATOM *PatAtom,   int PatIndex, 
-                    ATOM *StrucAtom, int NStrucAtom);
-BOOL Compare(char *str1, char *str2, int len);
-REAL CalcScore(char *str1, char *str2, int len);
+SURFFILE *ScreenIndex(SURFINDEX *index, MPPATTERN *pat, int *ncand);
 
 /************************************************************************/
 /*>int main(int argc, char **argv)
@@ -148,27 +405,102 @@ REAL CalcScore(char *str1, char *str2, int len);
    Main program for matching output files from matchpatchsurface.
 
    18.11.93 Original   By: ACRM
+   17.10.26 Added list of structures By: agent
+   17.10.26 Added list of patterns By: agent
+   17.10.26 Lists are matched by MatchSurfaceLists() By: agent
+   17.10.26 Files may be stdin By: agent
+   17.10.26 Added building and screening with an index By: agent
+   17.10.26 Added windows By: agent
+   17.10.26 Added serving and sending queries By: agent
+   17.10.26 Passes the settings to mpSetSettings() By: agent
 */
 int main(int argc, char **argv)
 {
    char PatFile[MAXBUFF],
         StrucFile[MAXBUFF],
-        outfile[MAXBUFF];
-   FILE *fp_pat   = NULL,
-        *fp_struc = NULL,
-        *out      = stdout;
-   BOOL invert    = FALSE,
-        verbose   = FALSE;
-
+        outfile[MAXBUFF],
+        IndexFile[MAXBUFF],
+        SocketFile[MAXBUFF];
+   FILE     *fp_pat    = NULL,
+            *fp_struc  = NULL,
+            *out       = stdout;
+   SURFFILE *PatList   = NULL,
+            *StrucList = NULL;
+   MPPATTERN **pat     = NULL;
+   SURFINDEX *index    = NULL;
+   int      npat       = 0,
+            nstruc     = 0;
+   BOOL     invert     = FALSE,
+            verbose    = FALSE,
+            list       = FALSE,
+            patlist    = FALSE,
+            build      = FALSE,
+            window     = FALSE,
+            serve      = FALSE;
+
+   mpGetSettings(&gSettings);
+   
    if(ParseCmdLine(argc, argv, PatFile, StrucFile, outfile, &invert,
-                   &verbose))
+                   &verbose, &list, &patlist, IndexFile, &build, 
+                   &window, SocketFile, &serve))
    {
-      if((fp_pat = fopen(PatFile,"r"))==NULL)
+      gSettings.verbose = verbose;
+      mpSetSettings(&gSettings);
+
+      if(serve)
+      {
+         if(((StrucList = ReadSurfaceList(StrucFile, &nstruc)) == NULL) ||
+            !Serve(SocketFile, StrucList, nstruc, verbose))
+            exit(1);
+         return(0);
+      }
+
+      if(build)
+      {
+         if(((StrucList = ReadSurfaceList(StrucFile, &nstruc)) == NULL) ||
+            !BuildIndex(IndexFile, StrucList, nstruc, verbose))
+            exit(1);
+         FreeSurfaceList(StrucList, nstruc);
+         return(0);
+      }
+      
+
+      if(!strcmp(PatFile, STDINFILE) && !strcmp(StrucFile, STDINFILE))
+      {
+         fprintf(stderr,"Only one input may be read from stdin\n");
+         exit(1);
+      }
+
+      if(SocketFile[0])
+      {
+         if((fp_pat = OpenSurfaceFile(PatFile))==NULL)
+         {
+            fprintf(stderr,"Unable to open pattern file: %s\n",PatFile);
+            exit(1);
+         }
+      }
+      else if(IndexFile[0])
+      {
+         PatList   = patlist ? ReadSurfaceList(PatFile, &npat)
+                             : SingleSurfaceList(PatFile, &npat);
+         if((PatList == NULL) || ((index = ReadIndex(IndexFile)) == NULL))
+            exit(1);
+      }
+      else if(list || patlist)
+      {
+         PatList   = patlist ? ReadSurfaceList(PatFile, &npat)
+                             : SingleSurfaceList(PatFile, &npat);
+         StrucList = list    ? ReadSurfaceList(StrucFile, &nstruc)
+                             : SingleSurfaceList(StrucFile, &nstruc);
+         if((PatList == NULL) || (StrucList == NULL))
+            exit(1);
+      }
+      else if((fp_pat = OpenSurfaceFile(PatFile))==NULL)
       {
          fprintf(stderr,"Unable to open pattern file: %s\n",PatFile);
          exit(1);
       }
-      if((fp_struc = fopen(StrucFile,"r"))==NULL)
+      else if((fp_struc = OpenSurfaceFile(StrucFile))==NULL)
       {
          fprintf(stderr,"Unable to open pattern file: %s\n",StrucFile);
          exit(1);
@@ -179,9 +511,39 @@ int main(int argc, char **argv)
          exit(1);
       }
 
-      MatchFiles(out, fp_pat, fp_struc, invert, verbose);
-      fclose(fp_pat);
-      fclose(fp_struc);
+      if(SocketFile[0])
+      {
+         if(!SendQuery(SocketFile, fp_pat, out, invert, window))
+            exit(1);
+         if(fp_pat != stdin)
+            fclose(fp_pat);
+      }
+      else if(index != NULL)
+      {
+         MatchIndex(out, index, PatList, npat, patlist, invert, window,
+                    verbose);
+         FreeIndex(index);
+         FreeSurfaceList(PatList, npat);
+      }
+      else if(list || patlist)
+      {
+         if((pat = ReadPatterns(PatList, npat, invert, verbose)) != NULL)
+         {
+            MatchSurfaceLists(out, PatList, pat, npat, StrucList, nstruc,
+                              patlist, list, window, verbose);
+            FreePatterns(pat, npat);
+         }
+         FreeSurfaceList(PatList, npat);
+         FreeSurfaceList(StrucList, nstruc);
+      }
+      else
+      {
+         MatchFiles(out, fp_pat, fp_struc, invert, window);
+         if(fp_pat != stdin)
+            fclose(fp_pat);
+         if(fp_struc != stdin)
+            fclose(fp_struc);
+      }
    }
    else
    {
@@ -194,7 +556,9 @@ int main(int argc, char **argv)
 /************************************************************************/
 /*>BOOL ParseCmdLine(int argc, char **argv, char *PatFile, 
                      char *StrucFile, char *outfile, BOOL *invert,
-                     BOOL *verbose)
+                     BOOL *verbose, BOOL *list, BOOL *patlist,
+                     char *IndexFile, BOOL *build, BOOL *window,
+                     char *SocketFile, BOOL *serve)
    ---------------------------------------------------------------
    Read the command line
 
@@ -203,31 +567,56 @@ int main(int argc, char **argv)
    16.04.21 Added -i flag
    16.04.21 Rewritten
    19.04.21 Added -v
+   17.10.26 Added -c By: agent
+   17.10.26 Added -l By: agent
+   17.10.26 Added -p By: agent
+   17.10.26 Added -j. -l and -p may be used together By: agent
+   17.10.26 Allows - as a file name By: agent
+   17.10.26 Added -x, -X and -t By: agent
+   17.10.26 Added -w By: agent
+   17.10.26 Added -C By: agent
+   17.10.26 Added -S and -q By: agent
+   17.10.26 Added -k By: agent
+   17.10.26 Added -m By: agent
+    17.10.26 The settings go in gSettings By: agent
 */
 BOOL ParseCmdLine(int argc, char **argv, char *PatFile, char *StrucFile,
-                  char *outfile, BOOL *invert, BOOL *verbose)
+                  char *outfile, BOOL *invert, BOOL *verbose, 
+                  BOOL *list, BOOL *patlist, char *IndexFile, 
+                  BOOL *build, BOOL *window, char *SocketFile,
+                  BOOL *serve)
 {
    argc--;
    argv++;
    
-   PatFile[0] = StrucFile[0] = outfile[0] = '\0';
+   PatFile[0] = StrucFile[0] = outfile[0] = IndexFile[0] = '\0';
+   SocketFile[0] = '\0';
    *invert    = FALSE;
+   *build     = FALSE;
+   *window    = FALSE;
+   *serve     = FALSE;
    
    while(argc)
    {
-      if(argv[0][0] == '-')
+      /* - on its own is a file name meaning stdin                      */
+      if((argv[0][0] == '-') && (argv[0][1] != '\0'))
       {
          switch(argv[0][1])
          {
          case 'd': 
             argc--; argv++;
-            sscanf(argv[0],"%lf",&gBin);
-            if(gBin == 0.0) gBin = 1.0;
+            sscanf(argv[0],"%lf",&gSettings.binsize);
+            if(gSettings.binsize == 0.0) gSettings.binsize = 1.0;
             break;
          case 'a': 
             argc--; argv++;
-            sscanf(argv[0],"%lf",&gAccuracy);
-            if(gAccuracy == 0.0) gAccuracy = 100.0;
+            sscanf(argv[0],"%lf",&gSettings.accuracy);
+            if(gSettings.accuracy == 0.0) gSettings.accuracy = 100.0;
+            break;
+         case 'c': 
+            argc--; argv++;
+            sscanf(argv[0],"%lf",&gSettings.cutoff);
+            if(gSettings.cutoff < 0.0) gSettings.cutoff = 0.0;
             break;
          case 'i': 
             *invert = TRUE;
@@ -235,6 +624,58 @@ BOOL ParseCmdLine(int argc, char **argv, char *PatFile, char *StrucFile,
          case 'v': 
             *verbose = TRUE;
             break;
+         case 'l': 
+            *list = TRUE;
+            break;
+         case 'p': 
+            *patlist = TRUE;
+            break;
+         case 'j': 
+            argc--; argv++;
+            sscanf(argv[0],"%d",&gNThreads);
+            if(gNThreads < 1)          gNThreads = 1;
+            if(gNThreads > MAXTHREADS) gNThreads = MAXTHREADS;
+            break;
+         case 'X':
+            *build = TRUE;
+            /* Fall through                                             */
+         case 'x':
+            argc--; argv++;
+            if(argc == 0)
+               return(FALSE);
+            strcpy(IndexFile, argv[0]);
+            break;
+         case 't': 
+            argc--; argv++;
+            sscanf(argv[0],"%lf",&gScreen);
+            break;
+         case 'k': 
+            argc--; argv++;
+            sscanf(argv[0],"%d",&gTopK);
+            if(gTopK < 0) gTopK = 0;
+            break;
+         case 'S':
+            *serve = TRUE;
+            /* Fall through                                             */
+         case 'q':
+            argc--; argv++;
+            if(argc == 0)
+               return(FALSE);
+            strcpy(SocketFile, argv[0]);
+            break;
+         case 'w': 
+            *window = TRUE;
+            break;
+         case 'C': 
+            argc--; argv++;
+            sscanf(argv[0],"%ld",&gSettings.clique);
+            if(gSettings.clique < 1) gSettings.clique = 1;
+            break;
+         case 'm': 
+            argc--; argv++;
+            sscanf(argv[0],"%d",&gSettings.minmatch);
+            if(gSettings.minmatch < 0) gSettings.minmatch = 0;
+            break;
          default:
             return(FALSE);
             break;
@@ -242,6 +683,27 @@ BOOL ParseCmdLine(int argc, char **argv, char *PatFile, char *StrucFile,
          argc--;
          argv++;
       }
+      else if(*build || *serve)
+      {
+         /* Just the list of structures to index or serve               */
+         if(argc != 1)
+            return(FALSE);
+         strcpy(StrucFile,argv[0]);
+         argc--; argv++;
+      }
+      else if(IndexFile[0] || SocketFile[0])
+      {
+         /* The pattern and optional output file                        */
+         if(argc > 2)
+            return(FALSE);
+         strcpy(PatFile,argv[0]);
+         argc--; argv++;
+         if(argc)
+         {
+            strcpy(outfile, argv[0]);
+            argc--; argv++;
+         }
+      }
       else
       {
          /* Check that there are 2-3 arguments left                     */
@@ -261,6 +723,16 @@ BOOL ParseCmdLine(int argc, char **argv, char *PatFile, char *StrucFile,
       }
    }
    
+   /* An index replaces the structure list                             */
+   if(IndexFile[0] && (*list || !(*build ? StrucFile[0] : PatFile[0])))
+      return(FALSE);
+
+   /* As does a server                                                 */
+   if(SocketFile[0] && 
+      (*list || *patlist || IndexFile[0] ||
+       !(*serve ? StrucFile[0] : PatFile[0])))
+      return(FALSE);
+   
    return(TRUE);
 }
 
@@ -273,21 +745,128 @@ BOOL ParseCmdLine(int argc, char **argv, char *PatFile, char *StrucFile,
    18.11.93 Original   By: ACRM
    22.11.93 Added flag decriptions
    16.04.21 V1.1, V1.2, V1.3, V2.0
+   17.10.26 V2.1, V2.2, V2.3, V2.4, V2.5, V2.6, V2.7, V2.8, V2.9 By: agent
+   17.10.26 V3.0, V3.1, V3.2 By: agent
 */
 void Usage(void)
 {
-   fprintf(stderr,"\nMatch V2.0 (c) 1993-2021 SciTech Software / \
+   fprintf(stderr,"\nMatch V3.14 (c) 1993-2026 SciTech Software / \
 abYinformatics\n");
 
-   fprintf(stderr,"\nUsage: match [-v][-i][-d binsize][-a accuracy] \
-patternFile structureFile [outfile]\n");
+   fprintf(stderr,"\nUsage: match [-v][-w][-C nodes][-i][-d binsize]\
+[-a accuracy][-c cutoff][-m n]\n");
+   fprintf(stderr,"             patternFile structureFile [outfile]\n");
+   fprintf(stderr,"   or: match -l [-j nthreads][-v][-w][-C nodes][-i]\
+[-d binsize][-k n]\n");
+   fprintf(stderr,"             [-a accuracy][-c cutoff][-m n] patternFile \
+structureList\n");
+   fprintf(stderr,"             [outfile]\n");
+   fprintf(stderr,"   or: match -p [-j nthreads][-v][-w][-C nodes][-i]\
+[-d binsize][-k n]\n");
+   fprintf(stderr,"             [-a accuracy][-c cutoff][-m n] patternList \
+structureFile\n");
+   fprintf(stderr,"             [outfile]\n");
+   fprintf(stderr,"   or: match -p -l [-j nthreads][-v][-w][-C nodes]\
+[-i][-d binsize][-k n]\n");
+   fprintf(stderr,"             [-a accuracy][-c cutoff][-m n] patternList \
+structureList\n");
+   fprintf(stderr,"             [outfile]\n");
+   fprintf(stderr,"   or: match -X indexFile [-v][-d binsize][-c cutoff] \
+structureList\n");
+   fprintf(stderr,"   or: match -x indexFile [-p][-t percent][-j nthreads]\
+[-v][-w][-i][-k n]\n");
+   fprintf(stderr,"             [-C nodes][-d binsize][-a accuracy]\
+[-c cutoff] pattern(List)\n");
+   fprintf(stderr,"             [-m n] [outfile]\n");
+   fprintf(stderr,"   or: match -S socket [-j nthreads][-v][-C nodes]\
+[-d binsize][-a accuracy]\n");
+   fprintf(stderr,"             [-c cutoff][-m n] structureList\n");
+   fprintf(stderr,"   or: match -q socket [-w][-i] patternFile \
+[outfile]\n");
    fprintf(stderr,"       -v verbose\n");
+   fprintf(stderr,"       -w match the pattern against a window around \
+each structure\n");
+   fprintf(stderr,"          residue and report the window with most \
+matches\n");
+   fprintf(stderr,"       -C report the largest set of matches whose \
+distances all agree\n");
+   fprintf(stderr,"          to within %d bin. The clique search stops \
+after nodes steps\n", CLIQUETOL);
    fprintf(stderr,"       -i invert the properties in the pattern \
 file\n");
    fprintf(stderr,"       -d specifies distance bin size \
 (default: %.1f)\n", (double)DEFBIN);
    fprintf(stderr,"       -a specifies percent dist string match \
 accuracy (default: %.1f)\n", (double)DEFACC);
+   fprintf(stderr,"       -c ignore pairs of residues further apart than \
+cutoff\n");
+   fprintf(stderr,"          (default: use all pairs)\n");
+   fprintf(stderr,"       -m give no matches for a structure unless at \
+least n pattern\n");
+   fprintf(stderr,"          residues match. Structures are dropped as \
+soon as they can\n");
+   fprintf(stderr,"          no longer reach n matches\n");
+   fprintf(stderr,"       -l structureList is a list of structures. \
+The pattern is read\n");
+   fprintf(stderr,"          once and the results for each structure \
+are preceded by\n");
+   fprintf(stderr,"          'Structure: name Matches: n'\n");
+   fprintf(stderr,"       -p patternList is a list of patterns. The \
+structure is read\n");
+   fprintf(stderr,"          once and the results for each pattern are \
+preceded by\n");
+   fprintf(stderr,"          'Query: name Matches: n'\n");
+   fprintf(stderr,"       -p -l match every pattern against every \
+structure. The results\n");
+   fprintf(stderr,"          are preceded by 'Query: name Structure: \
+name Matches: n'\n");
+   fprintf(stderr,"       -j share the matches for -l and -p between \
+nthreads threads\n");
+   fprintf(stderr,"          (default: 1). The output is in the same \
+order\n");
+   fprintf(stderr,"       -X build an index of the structures in \
+structureList. The\n");
+   fprintf(stderr,"          bin size and cutoff must be the same when \
+it is used\n");
+   fprintf(stderr,"       -x match against the structures in an index. \
+Only structures\n");
+   fprintf(stderr,"          sharing at least the percentage given with \
+-t (default:\n");
+   fprintf(stderr,"          %.1f) of the pattern's (property, property, \
+distance bin)\n", (double)DEFSCREEN);
+   fprintf(stderr,"          pairs are matched. The results are \
+preceded by 'Structure:'\n");
+   fprintf(stderr,"          lines as for -l\n");
+   fprintf(stderr,"       -k report only the best n structures matched \
+by each pattern with\n");
+   fprintf(stderr,"          -l or -x, best first. They are ranked by \
+their number of\n");
+   fprintf(stderr,"          matches and then the mean score of the \
+matches, which is added\n");
+   fprintf(stderr,"          as 'Score: s'. Structures with no matches \
+are not reported\n");
+   fprintf(stderr,"       -S read the structures in structureList once \
+and answer queries\n");
+   fprintf(stderr,"          from -q on the Unix domain socket until \
+killed, using\n");
+   fprintf(stderr,"          nthreads threads. The -C, -d, -a, -c and -m \
+given here are\n");
+   fprintf(stderr,"          used\n");
+   fprintf(stderr,"       -q send the pattern to a server started with \
+-S. The results\n");
+   fprintf(stderr,"          are the same as for -l\n");
+   fprintf(stderr,"\nA list is a directory of %s files, a file listing \
+the files (one\n", SURFEXT);
+   fprintf(stderr,"per line) or a file of records each starting with a \
+'>name' line.\n");
+   fprintf(stderr,"Pattern and structure files may be text or binary \
+(written by\n");
+   fprintf(stderr,"matchpatchsurface -b). Directories may also contain \
+%s files.\n", SURFBINEXT);
+   fprintf(stderr,"Any one of the pattern, structure or list files may \
+be given as %s\n", STDINFILE);
+   fprintf(stderr,"to read it from stdin (a file of records can't be \
+read from stdin).\n");
    fprintf(stderr,"\nFind potential matches for a pattern in a structure \
 using Lesk's method\n");
    fprintf(stderr,"The input files are generated by \
@@ -298,601 +877,2115 @@ residues\n\n");
 
 
 /************************************************************************/
-/*>void MatchFiles(FILE *out, FILE *fp_pat, FILE *fp_struc, BOOL invert)
+/*>void MatchFiles(FILE *out, FILE *fp_pat, FILE *fp_struc, BOOL invert,
+                    BOOL window)
    ---------------------------------------------------------------------
+   Matches a pattern file against a structure file with the library
+   interface and prints the matches. With a window, they are preceded 
+   by a line giving the window's centre and the number of matches.
+
    18.11.93 Original   By: ACRM
+   17.10.26 Passes the number of distances as well as the number of atoms
+            to DoLesk() By: agent
+   17.10.26 Works with SURFACE structures By: agent
+   17.10.26 Creates the atom arrays By: agent
+   17.10.26 Creates the structure's signature By: agent
+   17.10.26 Added window By: agent
+   17.10.26 Uses MatchSurfaces() By: agent
+   17.10.26 Uses mpMatch(). verbose is now a setting By: agent
 */
 void MatchFiles(FILE *out, FILE *fp_pat, FILE *fp_struc, BOOL invert,
-                BOOL verbose)
+                BOOL window)
 {
-   DATA *pat,
-        *struc;
-   int  nPat,   nPatAtoms,
-        nStruc, nStrucAtoms;
+   MPPATTERN   *pat;
+   MPSTRUCTURE *struc;
+   MPRESULT    result;
+   char        label[MAXRESID+16];
 
-   pat   = ReadDataAndCreateMatrix(fp_pat,   &nPat,   &nPatAtoms);
-   struc = ReadDataAndCreateMatrix(fp_struc, &nStruc, &nStrucAtoms);
+   pat   = mpReadPattern(fp_pat, invert);
+   struc = mpReadStructure(fp_struc);
 
-   if(verbose)
+   if((pat == NULL) || (struc == NULL))
    {
-      fprintf(stderr, "%d distances calculated from %d pattern atoms; \
-%d distances calculated from %d structure atoms\n",
-              nPat, nPatAtoms, nStruc, nStrucAtoms);
+      fprintf(stderr,"No memory for input data\n");
+      mpFreePattern(pat);
+      mpFreeStructure(struc);
+      return;
    }
-   
-   DoLesk(out, nPatAtoms, pat, nStrucAtoms, struc, invert, verbose);
 
-   free(pat);
-   free(struc);
+   if(mpMatch(pat, struc, window, &result))
+   {
+      if(result.centre != NULL)
+      {
+         sprintf(label, "Window: %s", result.centre->resid);
+         PrintMatches(out, label, result.match, result.nmatch, NULL);
+      }
+      else
+      {
+         PrintMatches(out, NULL, result.match, result.nmatch, NULL);
+      }
+      mpFreeResult(&result);
+   }
+
+   mpFreePattern(pat);
+   mpFreeStructure(struc);
 }
 
 
 /************************************************************************/
-/*>ATOM *ReadDataAndCreateMatrix(FILE *fp, int *nrecords, int *natoms)
-   -------------------------------------------------------------------
-   Read the output from matchpatchsurface. Create an array of type ATOM 
-   which contains flags for the presence of connections of a given 
-   distance and flags the atom type.
+/*>int MatchSurfaces(FILE *out, MPPATTERN *pat, MPSTRUCTURE *struc, 
+                     char *label, BOOL window, int minmatch, 
+                     REAL *score, BOOL verbose)
+   ----------------------------------------------------------------
+   Matches a pattern against a structure with mpiMatch() (against a 
+   window around each structure residue if window is set) and prints 
+   the results. If label is not NULL, the results are preceded by a 
+   line giving the label and the number of matches; with a window, the
+   window's centre is added to the label. Nothing is printed if the 
+   match fails.
+
+   No matches are given if there are fewer than minmatch (see mpiDoLesk()).
+   If score is not NULL, the mean score of the matches is placed in it
+   and added to the label line. Returns the number of matches or -1 if
+   the match fails.
+
+   17.10.26 Original   By: agent
+   17.10.26 Added minmatch and score. Returns the number of matches By: agent
+   17.10.26 Prints with MPMATCHes By: agent
+   17.10.26 Matches prepared patterns and structures with mpiMatch()
+            By: agent
+*/
+int MatchSurfaces(FILE *out, MPPATTERN *pat, MPSTRUCTURE *struc, 
+                  char *label, BOOL window, int minmatch, REAL *score,
+                  BOOL verbose)
+{
+   MPRESULT result;
+   int      nmatch,
+            i;
+   char     WinLabel[MAXBUFF+MAXRESID+16];
 
-   18.11.93 Original   By: ACRM
-   22.11.93 Corrected return values
-   19.04.21 Now reads the coordinates and does the distance calculations
-*/
-DATA *ReadDataAndCreateMatrix(FILE *fp, int *outnrecords, int *outnatoms)
-{
-   int  maxrec    = 0,
-        i         = 0;
-   DATA *outdata  = NULL;
-   INDATA *indata = NULL,
-          *ini    = NULL,
-          *inj    = NULL;
-   char buffer[MAXBUFF];
-   
-   *outnatoms = *outnrecords = 0;
+   if(score != NULL)
+      *score = (REAL)0.0;
 
-   /* Scan the file to see how long it is                               */
-   while(fgets(buffer,MAXBUFF-1,fp)) maxrec++;
-   rewind(fp);
+   if(!mpiMatch(pat, struc, window, minmatch, verbose, &result))
+      return(-1);
 
-   *outnatoms = maxrec;
-   
-   /* maxrec is currently the number of atom points. We need the number
-      of distances between these atoms which is 
-      (maxrec^2 - maxrec/2)
-      i.e. one off-diagonal triangle from the matrix
-   */
-   maxrec = (int)((REAL)(maxrec*maxrec)/2.0 - (REAL)maxrec/2.0);
-
-   /* Allocate this much space                                          */
-   if((outdata = malloc(maxrec * sizeof(DATA)))==NULL)
-      return(NULL);
+   if(score != NULL)
+   {
+      for(i=0; i<result.nmatch; i++)
+         *score += result.match[i].score;
+      if(result.nmatch > 0)
+         *score /= result.nmatch;
+   }
 
-   /* Now read the file again, filling in data                          */
-   while(fgets(buffer,MAXBUFF-1,fp))
+   if(result.centre != NULL)
    {
-      if(indata==NULL)
-      {
-         INIT(indata, INDATA);
-         ini = indata;
-      }
+      if(label != NULL)
+         sprintf(WinLabel, "%s Window: %s", label, result.centre->resid);
       else
-      {
-         ALLOCNEXT(ini, INDATA);
-      }
-
-      if(ini == NULL)
-      {
-         fprintf(stderr,"No memory for input data\n");
-         FREELIST(indata, INDATA);
-         exit(1);
-      }
-      sscanf(buffer,"%s %s %lf %lf %lf %s",
-             ini->resnam, ini->resid,
-             &ini->x, &ini->y, &ini->z,
-             ini->properties);
+         sprintf(WinLabel, "Window: %s", result.centre->resid);
+      label = WinLabel;
    }
 
-   i=0;
-   for(ini=indata; ini!=NULL; NEXT(ini))
-   {
-      for(inj=ini->next; inj!=NULL; NEXT(inj))
-      {
+   nmatch = result.nmatch;
+   PrintMatches(out, label, result.match, nmatch, score);
+   mpFreeResult(&result);
+   return(nmatch);
+}
 
-         int  DistRange;
-         REAL dist;
-         
-         dist = DIST(ini, inj);
-         DistRange = ConvertDistanceToBin(dist);
-         
-         strcpy(outdata[i].resnam[0], ini->resnam);
-         strcpy(outdata[i].resid[0], ini->resid);
-         strcpy(outdata[i].properties[0], ini->properties);
 
-         strcpy(outdata[i].resnam[1], inj->resnam);
-         strcpy(outdata[i].resid[1], inj->resid);
-         strcpy(outdata[i].properties[1], inj->properties);
+/************************************************************************/
+/*>void PrintMatches(FILE *out, char *label, MPMATCH *match, 
+                     int nmatch, REAL *score)
+   -------------------------------------------------------
+   Prints the matches found by mpiMatch() or mpMatch(), preceded by a 
+   line giving the label and number of matches (and the score if score 
+   is not NULL) if label is not NULL
 
-         outdata[i].dist = DistRange;
-         outdata[i].dead = FALSE;
+   22.11.93 Original   By: ACRM
+   17.10.26 Replaces PrintResults() and PrintBestMatch() By: agent
+   17.10.26 Added score By: agent
+   17.10.26 Takes MPMATCHes By: agent
+*/
+void PrintMatches(FILE *out, char *label, MPMATCH *match, int nmatch,
+                  REAL *score)
+{
+   int i;
 
-         i++;
-         if(i > maxrec)
-         {
-            fprintf(stderr, "Error: Not enough memory allocated for the \
-distance matrix\n");
-            exit(1);
-         }
-      }
+   if(label != NULL)
+   {
+      fprintf(out, "%s Matches: %d", label, nmatch);
+      if(score != NULL)
+         fprintf(out, " Score: %.1f", (double)*score);
+      fprintf(out, "\n");
    }
 
-   FREELIST(indata, INDATA);
-
-   *outnrecords = i;
-   return(outdata);
+   for(i=0; i<nmatch; i++)
+   {
+      fprintf(out, "Pattern: %s %-5s matches Structure: %s %-5s\n",
+              match[i].pat->resnam,   match[i].pat->resid,
+              match[i].struc->resnam, match[i].struc->resid);
+   }
 }
 
 
 /************************************************************************/
-/*>ATOM *CreateAtomArray(DATA *data, int ndata, int *outnatom, 
-                         BOOL SwapProp)
-   -----------------------------------------------------------
-   19.11.93 Original   By: ACRM
+/*>void MatchSurfaceLists(FILE *out, SURFFILE *PatList, MPPATTERN **pat,
+                            int npat, SURFFILE *StrucList, int nstruc, 
+                            BOOL PatLabel, BOOL StrucLabel, BOOL window,
+                            BOOL verbose)
+   ------------------------------------------------------------------
+   Matches every pattern in PatList against every structure in 
+   StrucList. pat holds the patterns read by ReadPatterns(). Each 
+   structure is read and prepared when it is first needed and freed 
+   once all the patterns have been matched against it.
+
+   The matches are shared between gNThreads threads (including this 
+   one). The results for each match are written in the order of the
+   structures and, for each structure, the patterns. Each is preceded 
+   by a line giving the pattern name (if PatLabel), the structure name 
+   (if StrucLabel) and the number of matches. If window is set, the
+   matches are done with mpiDoWindowedLesk().
+
+   If gTopK is set, only the best gTopK structures for each pattern are
+   written, pattern by pattern, once all the matches are done. Once a 
+   pattern has that many, mpiDoLesk() is told to give up on structures
+   which can't match as many atoms as the worst of them.
+
+   17.10.26 Original   By: agent
+   17.10.26 Replaces MatchList() and MatchPatternList() By: agent
+   17.10.26 Takes the patterns rather than reading them By: agent
+   17.10.26 Added window By: agent
+   17.10.26 Added ranking with gTopK By: agent
+   17.10.26 Takes prepared patterns By: agent
 */
-ATOM *CreateAtomArray(DATA *data, int ndata, int *outnatom, BOOL SwapProp)
+void MatchSurfaceLists(FILE *out, SURFFILE *PatList, MPPATTERN **pat,
+                       int npat, SURFFILE *StrucList, int nstruc, 
+                       BOOL PatLabel, BOOL StrucLabel, BOOL window,
+                       BOOL verbose)
 {
-   int  i,
-        natom = 0,
-        pos;
-   ATOM *outatom;
+   MATCHRUN    run;
+   MATCHTHREAD threads[MAXTHREADS];
+   int         i, t;
+   BOOL        ok = TRUE;
+
+   run.out        = out;
+   run.PatList    = PatList;
+   run.StrucList  = StrucList;
+   run.npat       = npat;
+   run.nstruc     = nstruc;
+   run.nmatch     = npat * nstruc;
+   run.nqueue     = MIN(gNThreads, run.nmatch);
+   run.nwritten   = 0;
+   run.PatLabel   = PatLabel;
+   run.StrucLabel = StrucLabel;
+   run.window     = window;
+   run.verbose    = verbose;
+   run.pat        = pat;
+   run.struc      = (LISTSURF *)calloc(nstruc, sizeof(LISTSURF));
+   run.result     = (MATCHRESULT *)calloc(run.nmatch, sizeof(MATCHRESULT));
+   run.queue      = (MATCHQUEUE *)calloc(run.nqueue, sizeof(MATCHQUEUE));
+   run.ntop       = MIN(gTopK, nstruc);
+   run.rank       = NULL;
+   run.ranked     = NULL;
+   if(run.ntop)
+   {
+      run.rank    = (RANKING *)calloc(npat, sizeof(RANKING));
+      run.ranked  = (RANKED *)malloc((size_t)npat * run.ntop * 
+                                     sizeof(RANKED));
+      if((run.rank == NULL) || (run.ranked == NULL))
+         ok = FALSE;
+      else
+         for(i=0; i<npat; i++)
+            run.rank[i].best = run.ranked + (size_t)i * run.ntop;
+   }
 
-   /* Allocate memory for the output atom array                         */
-   if((outatom = (ATOM *)malloc(ndata * sizeof(ATOM))) == NULL)
-      return(NULL);
+   if(!ok || 
+      (run.struc == NULL) || (run.result == NULL) || (run.queue == NULL))
+   {
+      fprintf(stderr,"No memory for matching lists\n");
+      ok = FALSE;
+   }
 
-   for(i=0; i<ndata; i++)
+   if(ok)
    {
-      /* Skip this record if the dead flag is set                       */
-      if(data[i].dead) continue;
+      pthread_mutex_init(&(run.lock), NULL);
+      for(i=0; i<nstruc; i++)
+         pthread_mutex_init(&(run.struc[i].lock), NULL);
 
-      /* See if we've got a record for the first residue                */
-      pos = GotAtom(outatom, natom, data[i].resid[0]);
-      if(pos == (-1)) pos = natom++;
+      /* Give each thread an equal range of matches                     */
+      for(t=0; t<run.nqueue; t++)
+      {
+         run.queue[t].next = (int)(((long)run.nmatch * t) / run.nqueue);
+         run.queue[t].end  = (int)(((long)run.nmatch * (t+1)) / 
+                                   run.nqueue);
+         pthread_mutex_init(&(run.queue[t].lock), NULL);
+         threads[t].run = &run;
+         threads[t].id  = t;
+      }
+
+      /* Start the other threads. If any can't be started, their 
+         matches are stolen by the others
+      */
+      for(t=1; t<run.nqueue; t++)
+      {
+         run.queue[t].started = 
+            !pthread_create(&(run.queue[t].thread), NULL, MatchThread,
+                            (void *)&(threads[t]));
+      }
+      if(run.nqueue)
+         MatchThread((void *)&(threads[0]));
 
-      /* Fill this into the data array                                  */
-      FillAtom(outatom, natom, pos,
-               data[i].resid[0],
-               data[i].resnam[0], data[i].properties[0], data[i].dist,
-               SwapProp);
+      for(t=1; t<run.nqueue; t++)
+      {
+         if(run.queue[t].started)
+            pthread_join(run.queue[t].thread, NULL);
+      }
 
-      /* See if we've got a record for the second residue               */
-      pos = GotAtom(outatom, natom, data[i].resid[1]);
-      if(pos == (-1)) pos = natom++;
+      if(run.rank != NULL)
+         WriteRankings(&run);
 
-      /* Fill this into the data array                                  */
-      FillAtom(outatom, natom, pos,
-               data[i].resid[1],
-               data[i].resnam[1], data[i].properties[1], data[i].dist,
-               SwapProp);
+      for(t=0; t<run.nqueue; t++)
+         pthread_mutex_destroy(&(run.queue[t].lock));
+      for(i=0; i<nstruc; i++)
+         pthread_mutex_destroy(&(run.struc[i].lock));
+      pthread_mutex_destroy(&(run.lock));
    }
 
-   *outnatom = natom;
-
-   return(outatom);
+   FREE(run.struc);
+   FREE(run.result);
+   FREE(run.queue);
+   FREE(run.rank);
+   FREE(run.ranked);
 }
 
 
 /************************************************************************/
-/*>int ConvertDistanceToBin(REAL dist)
-   -----------------------
-   Converts a distance (REAL) to an integer bin number < MAXDIST. The bin
-   size is read from the global variable gBin
+/*>MPPATTERN **ReadPatterns(SURFFILE *PatList, int npat, BOOL invert, 
+                              BOOL verbose)
+   ---------------------------------------------------------------------
+   Reads and prepares each pattern in PatList, inverting the properties
+   if required. A pattern which can't be read is left NULL. Returns 
+   NULL (with a message) if there is no memory.
 
-   19.11.93 Original   By: ACRM
-   22.11.93 Changed to read bin size from global gBin
+   17.10.26 Original   By: agent
+   17.10.26 Moved out of MatchSurfaceLists() By: agent
+   17.10.26 Prepares the patterns with ReadPatternFile() By: agent
 */
-int ConvertDistanceToBin(REAL dist)
+MPPATTERN **ReadPatterns(SURFFILE *PatList, int npat, BOOL invert, 
+                         BOOL verbose)
 {
-   int idist;
+   MPPATTERN **pat;
+   int       i;
+
+   if((pat = (MPPATTERN **)calloc(MAX(npat, 1), sizeof(MPPATTERN *)))
+      == NULL)
+   {
+      fprintf(stderr,"No memory for patterns\n");
+      return(NULL);
+   }
 
-   idist = (int)(dist/gBin);
-   if(idist >= MAXDIST-1) idist = MAXDIST-2;
+   for(i=0; i<npat; i++)
+   {
+      if(((pat[i] = ReadPatternFile(&(PatList[i]), invert)) != NULL) &&
+         verbose)
+      {
+         fprintf(stderr, "%s: %ld distances calculated from %d \
+pattern atoms\n", PatList[i].label, pat[i]->surf->npair, 
+                 pat[i]->surf->nres);
+      }
+   }
 
-   return(idist);
+   return(pat);
 }
 
 
 /************************************************************************/
-/*>int GotAtom(ATOM *outdata, int natom, char *resid)
-   --------------------------------------------------------------
-   Searches the current outdata array to see if we already have this
-   residue. If so, returns the index into the array. If not, returns -1
+/*>void FreePatterns(MPPATTERN **pat, int npat)
+   ---------------------------------------------
+   Frees the patterns from ReadPatterns()
 
-   19.11.93 Original   By: ACRM
-   19.04.21 Changed to use resid
+   17.10.26 Original   By: agent
+   17.10.26 Frees prepared patterns By: agent
 */
-int GotAtom(ATOM *outdata, int natom, char *resid)
+void FreePatterns(MPPATTERN **pat, int npat)
 {
    int i;
 
-   for(i=0; i<natom; i++)
-   {
-      if(!strcmp(outdata[i].resid, resid))
-      {
-         return(i);
-      }
-   }
-   return(-1);
+   for(i=0; i<npat; i++)
+      mpFreePattern(pat[i]);
+   free(pat);
 }
 
 
 /************************************************************************/
-/*>void FillAtom(ATOM *outdata, int natom, int pos, char *resid,
-                 char *resnam, char *properties, int DistRange,
-                 BOOL SwapProp)
-   --------------------------------------------------------------------
-   Fill in an item in the data array. If (pos == natom-1) then it's a
-   new residue so we must fill in all data; otherwise just set the
-   appropriate flags.
+/*>void *MatchThread(void *arg)
+   -----------------------------
+   Thread function for MatchSurfaceLists(). Runs matches until there are
+   none left to take or steal. arg is a MATCHTHREAD.
 
-   19.11.93 Original   By: ACRM
-   22.11.93 Added aromatic support
-   19.05.94 Added DNA support
-   19.04.21 Changed to resid
+   17.10.26 Original   By: agent
 */
-void FillAtom(ATOM *outdata, int natom, int pos,  char *resid,
-              char *resnam, char *properties,
-              int DistRange, BOOL SwapProp)
+void *MatchThread(void *arg)
 {
-   if(pos == natom-1)
-   {
-      /* A new residue; fill in all data                                */
+   MATCHTHREAD *thread = (MATCHTHREAD *)arg;
+   int         match;
 
-      /* Initialize the distances bitstring                             */
-      int i;
-      for(i=0; i<MAXDIST; i++)
-      {
-         outdata[pos].dist[i] = '0';
-      }
-      outdata[pos].dist[MAXDIST-1] = '\0';
+   while(TakeMatch(thread->run, thread->id, &match))
+      RunMatch(thread->run, match);
 
-      strcpy(outdata[pos].resid,  resid);
-      strcpy(outdata[pos].resnam, resnam);
-      strcpy(outdata[pos].properties, properties);
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>BOOL TakeMatch(MATCHRUN *run, int id, int *match)
+   ---------------------------------------------------
+   Takes the next match from thread id's range. If the range is empty,
+   steals the second half of the range of the first other thread which 
+   has any left. Returns FALSE if there are no matches left anywhere.
+
+   17.10.26 Original   By: agent
+*/
+BOOL TakeMatch(MATCHRUN *run, int id, int *match)
+{
+   MATCHQUEUE *own = &(run->queue[id]),
+              *victim;
+   int        t, 
+              start = 0,
+              end   = 0;
+
+   pthread_mutex_lock(&(own->lock));
+   if(own->next < own->end)
+   {
+      *match = own->next++;
+      pthread_mutex_unlock(&(own->lock));
+      return(TRUE);
+   }
+   pthread_mutex_unlock(&(own->lock));
 
-      if(SwapProp)
+   /* Look for a thread with matches left, starting with the next one   */
+   for(t=1; (t<run->nqueue) && (start==end); t++)
+   {
+      victim = &(run->queue[(id + t) % run->nqueue]);
+      pthread_mutex_lock(&(victim->lock));
+      if(victim->next < victim->end)
       {
-         int temp = outdata[pos].properties[PROP_POSITIVE];
-         outdata[pos].properties[PROP_POSITIVE] = 
-            outdata[pos].properties[PROP_NEGATIVE];
-         outdata[pos].properties[PROP_NEGATIVE] = temp;
+         end          = victim->end;
+         start        = end - (end - victim->next + 1) / 2;
+         victim->end  = start;
       }
+      pthread_mutex_unlock(&(victim->lock));
    }
 
-   /* Now set the distance flag                                         */
-   outdata[pos].dist[DistRange] = '1';
+   if(start == end)
+      return(FALSE);
+
+   /* Keep the first stolen match and make the rest our own range       */
+   *match = start;
+   pthread_mutex_lock(&(own->lock));
+   own->next = start + 1;
+   own->end  = end;
+   pthread_mutex_unlock(&(own->lock));
+
+   return(TRUE);
 }
 
 
 /************************************************************************/
-/*>void DoLesk(FILE *out, int npat, DATA *pat, int nstruc, DATA *struc,
-               BOOL verbose)
-   ---------------------------------------------------------
-   Does the actual Lesk pattern matching algorithm (with some 
-   modifications).
-
-   19.11.93 Original   By: ACRM
-   21.11.93 Added property comparison and printing of results :-)
-   16.04.21 Added invert parameter instead of always inverting the pattern
-   19.04.21 Added verbose parameter
-*/
-void DoLesk(FILE *out, int npat, DATA *pat, int nstruc, DATA *struc,
-            BOOL invert, BOOL verbose)
-{
-   ATOM *PatAtom       = NULL,
-        *StrucAtom     = NULL;
-   int  NPatAtom       = 0,
-        NStrucAtom     = 0,
-        PrevPatAtoms   = 0,
-        PrevStrucAtoms = 0,
-        i, j, k;
+/*>void RunMatch(MATCHRUN *run, int match)
+   ----------------------------------------
+   Matches one pattern against one structure. If this is the only 
+   thread, the results are written straight to the output; otherwise 
+   they are kept in memory until all earlier matches have been written.
+
+   17.10.26 Original   By: agent
+   17.10.26 Added windows By: agent
+   17.10.26 Uses MatchSurfaces() By: agent
+   17.10.26 Ranks the results if gTopK is set By: agent
+   17.10.26 Matches the prepared pattern and structure By: agent
+*/
+void RunMatch(MATCHRUN *run, int match)
+{
+   int         p      = match % run->npat,
+               s      = match / run->npat;
+   MPPATTERN   *pat   = run->pat[p];
+   MPSTRUCTURE *struc = NULL;
+   FILE        *out   = run->out;
+   char        *text  = NULL,
+               label[MAXBUFF];
+   size_t      len    = 0;
+   int         nchar  = 0,
+               nmatch = 0;
+   REAL        score  = (REAL)0.0;
+
+   /* Don't bother reading the structure if the pattern is missing      */
+   if(pat != NULL)
+      struc = GetStructure(run, s);
    
-   for(i=0; i<MAXITER; i++)
+   if(struc != NULL)
    {
-      /* Create the bit strings for the atoms from the data arrays      */
-      PatAtom   = CreateAtomArray(pat,   npat,   &NPatAtom,   invert);
-      StrucAtom = CreateAtomArray(struc, nstruc, &NStrucAtom, FALSE);
-
-      /* Print information on remaining atoms                           */
-      if(verbose)
-      {
-         fprintf(stderr, "Iteration %d: %d pattern atoms and %d \
-structure atoms remain\n",i,NPatAtom,NStrucAtom);
-      }
-
-      /* Remove any distance flags from the bit strings which are 
-         never seen in the other structure
-      */
-      TrimBitStrings(NPatAtom, PatAtom, NStrucAtom, StrucAtom);
-
-      /* Exit if we've converged                                        */
-      if(NPatAtom == PrevPatAtoms && NStrucAtom == PrevStrucAtoms)
-         break;
-      PrevPatAtoms   = NPatAtom;
-      PrevStrucAtoms = NStrucAtom;
-         
-#ifdef DEBUG
-      fprintf(stderr, "\nPattern atoms are:\n");
-      for(j=0;j<NPatAtom;j++)
-      {
-         fprintf(stderr, "Property: %s; Distance: %s\n",
-                 PatAtom[j].properties, PatAtom[j].dist);
-      }
+      if((run->nqueue > 1) || (run->rank != NULL))
+         out = open_memstream(&text, &len);
 
-      fprintf(stderr, "\nStructure atoms are:\n");
-      for(j=0;j<NStrucAtom;j++)
+      if(out == NULL)
       {
-         fprintf(stderr, "Property: %s; Distance: %s\n",
-                 StrucAtom[j].properties, StrucAtom[j].dist);
+         fprintf(stderr,"No memory for matching %s against %s\n",
+                 run->PatList[p].label, run->StrucList[s].label);
       }
-#endif      
-
-      /* For each atom in the structure look to see if the bit string is
-         not found in the pattern. If not found, kill the atom
-      */
-      for(j=0; j<NStrucAtom; j++)
+      else
       {
-         BOOL Found = FALSE;
-
-         for(k=0; k<NPatAtom; k++)
+         label[0] = '\0';
+         if(run->PatLabel)
          {
-	    if(!strncmp(StrucAtom[j].properties,
-                        PatAtom[k].properties, MAXPROPERTIES))
-	    {
-	       if(!Compare(StrucAtom[j].dist,PatAtom[k].dist,MAXDIST))
-	       {
-		  Found = TRUE;
-		  break;
-	       }
-	    }
-	 }
-
-         if(!Found)
-	 {
-            KillAtom(StrucAtom[j].resid, struc, nstruc);
-            if(verbose)
-            {
-               fprintf(stderr, "Structure atom: %s %-5s killed\n",
-                       StrucAtom[j].resnam, StrucAtom[j].resid);
-            }
+            nchar = sprintf(label, "Query: %.*s", (MAXBUFF-10)/2, 
+                            run->PatList[p].label);
+         }
+         if(run->StrucLabel)
+         {
+            sprintf(label+nchar, "%sStructure: %.*s", 
+                    (nchar ? " " : ""), (MAXBUFF-14)/2, 
+                    run->StrucList[s].label);
+         }
+         
+         if(run->rank != NULL)
+         {
+            nmatch = MatchSurfaces(out, pat, struc, label, run->window,
+                                   MAX(gSettings.minmatch, 
+                                       RankThreshold(run, p)),
+                                   &score, run->verbose);
+         }
+         else
+         {
+            MatchSurfaces(out, pat, struc, label, run->window, 
+                          gSettings.minmatch, NULL, run->verbose);
          }
       }
 
-      FREE(PatAtom);
-      FREE(StrucAtom);
+      if((out != NULL) && (out != run->out))
+         fclose(out);
    }
 
-   if(i==MAXITER)
-   {
-      fprintf(stderr,"Error: Too many iterations - increase MAXITER\n");
-   }
+   ReleaseStructure(run, s);
+   if(run->rank != NULL)
+      RankMatch(run, p, s, nmatch, score, text, len);
    else
-   {
-      PrintResults(out, NPatAtom, PatAtom, NStrucAtom, StrucAtom);
-   }
-   
-   FREE(PatAtom);
-   FREE(StrucAtom);
+      WriteMatchResult(run, match, text, len);
 }
 
 
 /************************************************************************/
-/*>void KillAtom(char *resid, DATA *struc, int nstruc)
-   ----------------------------------------------------
-   Set the dead flag in the data array for an atom;
-
-   19.11.93 Original   By: ACRM
+/*>MPSTRUCTURE *GetStructure(MATCHRUN *run, int s)
+   ------------------------------------------------
+   Returns structure s, reading and preparing it if this is the first 
+   time it is needed. Returns NULL if it can't be read.
+
+   17.10.26 Original   By: agent
+   17.10.26 Creates the signature By: agent
+   17.10.26 Prepares it with ReadStructureFile() By: agent
 */
-void KillAtom(char *resid, DATA *data, int ndata)
+MPSTRUCTURE *GetStructure(MATCHRUN *run, int s)
 {
-   int i;
+   LISTSURF *struc = &(run->struc[s]);
 
-   for(i=0; i<ndata; i++)
+   pthread_mutex_lock(&(struc->lock));
+   if(!struc->loaded)
    {
-      if(!strcmp(resid, data[i].resid[0]) ||
-         !strcmp(resid, data[i].resid[1]))
+      struc->loaded = TRUE;
+      if(((struc->handle = ReadStructureFile(&(run->StrucList[s])))
+          != NULL) && run->verbose)
       {
-         data[i].dead = TRUE;
+         fprintf(stderr, "%s: %ld distances calculated from %d \
+structure atoms\n", run->StrucList[s].label, 
+                 struc->handle->surf->npair, struc->handle->surf->nres);
       }
    }
+   pthread_mutex_unlock(&(struc->lock));
+
+   return(struc->handle);
 }
 
 
 /************************************************************************/
-/*>void TrimBitStrings(int npat, ATOM *pat, int nstruc, ATOM *struc)
-   -----------------------------------------------------------------
-   Search the bit strings of the pattern and remove any distance flags
-   which never occur in the structure and vice versa
+/*>void ReleaseStructure(MATCHRUN *run, int s)
+   ---------------------------------------------
+   Notes that a pattern has been matched against structure s and frees 
+   the structure if this was the last one.
 
-   19.11.93 Original   By: ACRM
+   17.10.26 Original   By: agent
+   17.10.26 Frees the prepared structure By: agent
 */
-void TrimBitStrings(int npat, ATOM *pat, int nstruc, ATOM *struc)
+void ReleaseStructure(MATCHRUN *run, int s)
 {
-   int  i, j;
+   LISTSURF *struc = &(run->struc[s]);
 
-   /* For each distance in the distance bit string                      */
-   for(i=0; i<MAXDIST; i++)
+   pthread_mutex_lock(&(struc->lock));
+   if(++(struc->nused) == run->npat)
    {
-      BOOL PatHit   = FALSE,
-           StrucHit = FALSE;
+      mpFreeStructure(struc->handle);
+      struc->handle = NULL;
+   }
+   pthread_mutex_unlock(&(struc->lock));
+}
 
-      /* Search the pattern array for this distance being flagged       */
-      for(j=0; j<npat; j++)
-      {
-         if(pat[j].dist[i] == '1')
-	 {
-            PatHit = TRUE;
-            break;
-         }
-      }
 
-      /* Search the structure array for this distance being flagged     */
-      for(j=0; j<nstruc; j++)
-      {
-         if(struc[j].dist[i] == '1')
-	 {
-            StrucHit = TRUE;
-            break;
-         }
-      }
+/************************************************************************/
+/*>void WriteMatchResult(MATCHRUN *run, int match, char *text, 
+                           size_t len)
+   ---------------------------------------------------------------
+   Stores the results of a match (NULL if they have been written 
+   already) and writes the results of all the finished matches which
+   follow the last one written.
 
-      /* If there was a hit in pattern, but not structure, kill refs in
-         pattern
-      */
-      if(PatHit && !StrucHit)
+   17.10.26 Original   By: agent
+*/
+void WriteMatchResult(MATCHRUN *run, int match, char *text, size_t len)
+{
+   MATCHRESULT *result;
+
+   pthread_mutex_lock(&(run->lock));
+   run->result[match].text = text;
+   run->result[match].len  = len;
+   run->result[match].done = TRUE;
+
+   while((run->nwritten < run->nmatch) && 
+         run->result[run->nwritten].done)
+   {
+      result = &(run->result[run->nwritten++]);
+      if(result->text != NULL)
       {
-         for(j=0; j<npat; j++)
-	 {
-            pat[j].dist[i] = '0';
+         fwrite(result->text, 1, result->len, run->out);
+         free(result->text);
+         result->text = NULL;
+      }
+   }
+   pthread_mutex_unlock(&(run->lock));
+}
+
+
+/************************************************************************/
+/*>int RankThreshold(MATCHRUN *run, int p)
+   ----------------------------------------
+   Returns the fewest matches a structure needs to be ranked for 
+   pattern p: one until it has run->ntop structures, then the number 
+   for the worst of them (a structure with as many may still have a 
+   better score).
+
+   17.10.26 Original   By: agent
+*/
+int RankThreshold(MATCHRUN *run, int p)
+{
+   RANKING *rank = &(run->rank[p]);
+   int     threshold;
+
+   pthread_mutex_lock(&(run->lock));
+   threshold = (rank->nbest < run->ntop) ? 1 : rank->best[0].nmatch;
+   pthread_mutex_unlock(&(run->lock));
+
+   return(threshold);
+}
+
+
+/************************************************************************/
+/*>void RankMatch(MATCHRUN *run, int p, int s, int nmatch, REAL score,
+                  char *text, size_t len)
+   -------------------------------------------------------------------
+   Adds the results (text) of matching pattern p against structure s to
+   the pattern's ranking if they are among the best run->ntop so far, 
+   replacing the worst if it is full. text is freed if it isn't kept.
+
+   17.10.26 Original   By: agent
+*/
+void RankMatch(MATCHRUN *run, int p, int s, int nmatch, REAL score,
+               char *text, size_t len)
+{
+   RANKING *rank = &(run->rank[p]);
+   RANKED  entry;
+   int     i, child;
+
+   entry.text   = text;
+   entry.len    = len;
+   entry.score  = score;
+   entry.struc  = s;
+   entry.nmatch = nmatch;
+
+   pthread_mutex_lock(&(run->lock));
+   if((text != NULL) && (nmatch > 0))
+   {
+      if(rank->nbest < run->ntop)
+      {
+         /* Add it at the bottom and move it up past any better entries */
+         for(i=rank->nbest++; 
+             (i > 0) && (CompareRanked(&entry, &(rank->best[(i-1)/2])) > 0);
+             i=(i-1)/2)
+         {
+            rank->best[i] = rank->best[(i-1)/2];
+         }
+         rank->best[i] = entry;
+         entry.text    = NULL;
+      }
+      else if(CompareRanked(&entry, &(rank->best[0])) < 0)
+      {
+         /* Replace the worst and move it down past any worse entries   */
+         free(rank->best[0].text);
+         for(i=0; (child = 2*i+1) < rank->nbest; i=child)
+         {
+            if((child+1 < rank->nbest) &&
+               (CompareRanked(&(rank->best[child+1]), 
+                              &(rank->best[child])) > 0))
+               child++;
+            if(CompareRanked(&(rank->best[child]), &entry) <= 0)
+               break;
+            rank->best[i] = rank->best[child];
          }
+         rank->best[i] = entry;
+         entry.text    = NULL;
+      }
+   }
+   pthread_mutex_unlock(&(run->lock));
+
+   FREE(entry.text);
+}
+
+
+/************************************************************************/
+/*>int CompareRanked(const void *a, const void *b)
+   -----------------------------------------------
+   qsort() comparison function to sort RANKEDs best first: most matches,
+   then highest mean score, then in the order of the structure list
+
+   17.10.26 Original   By: agent
+*/
+int CompareRanked(const void *a, const void *b)
+{
+   RANKED *r1 = (RANKED *)a,
+          *r2 = (RANKED *)b;
+
+   if(r1->nmatch != r2->nmatch)
+      return((r1->nmatch > r2->nmatch) ? -1 : 1);
+   if(r1->score != r2->score)
+      return((r1->score > r2->score) ? -1 : 1);
+   return(r1->struc - r2->struc);
+}
+
+
+/************************************************************************/
+/*>void WriteRankings(MATCHRUN *run)
+   ---------------------------------
+   Writes the ranked results for each pattern, best first, and frees 
+   them
+
+   17.10.26 Original   By: agent
+*/
+void WriteRankings(MATCHRUN *run)
+{
+   RANKING *rank;
+   int     p, i;
+
+   for(p=0; p<run->npat; p++)
+   {
+      rank = &(run->rank[p]);
+      qsort(rank->best, rank->nbest, sizeof(RANKED), CompareRanked);
+      for(i=0; i<rank->nbest; i++)
+      {
+         fwrite(rank->best[i].text, 1, rank->best[i].len, run->out);
+         free(rank->best[i].text);
+      }
+      rank->nbest = 0;
+   }
+}
+
+
+/************************************************************************/
+/*>SURFFILE *ReadSurfaceList(char *ListFile, int *nsurf)
+   -----------------------------------------------------
+   Reads a list of surfaces. ListFile may be:
+   - a directory, in which case the surfaces are the files in it ending
+     in SURFEXT or SURFBINEXT (sorted by name)
+   - a file of records each starting with a line >name and followed by
+     the output of matchpatchsurface
+   - a file listing surface files, one per line. Blank lines and lines
+     starting with # are ignored.
+   A ListFile of - is read from stdin. This must be a list of files since
+   records are read from the list file later.
+   Returns NULL (with a message) if the list can't be read, is empty or 
+   there is no memory.
+
+   17.10.26 Original   By: agent
+   17.10.26 Renamed from ReadStructureList(). Added records By: agent
+   17.10.26 Directories may contain binary files By: agent
+   17.10.26 Reads stdin By: agent
+*/
+SURFFILE *ReadSurfaceList(char *ListFile, int *nsurf)
+{
+   DIR           *dir;
+   struct dirent *entry;
+   FILE          *fp;
+   SURFFILE      *list    = NULL;
+   char          buffer[MAXBUFF],
+                 name[MAXBUFF];
+   int           maxsurf  = 0,
+                 extlen   = strlen(SURFEXT),
+                 binlen   = strlen(SURFBINEXT),
+                 len;
+   BOOL          ok       = TRUE,
+                 records  = FALSE,
+                 first    = TRUE;
+
+   *nsurf = 0;
+   
+   if((dir = opendir(ListFile)) != NULL)
+   {
+      while(ok && ((entry = readdir(dir)) != NULL))
+      {
+         len = strlen(entry->d_name);
+         if(((len > extlen) && 
+             !strcmp(entry->d_name + len - extlen, SURFEXT)) ||
+            ((len > binlen) && 
+             !strcmp(entry->d_name + len - binlen, SURFBINEXT)))
+            ok = AddSurfFile(&list, nsurf, &maxsurf, ListFile, 
+                             entry->d_name, NULL, 0L);
       }
+      closedir(dir);
 
-      /* If there was a hit in structure, but not pattern, kill refs in
-         structure
+      if(ok && (*nsurf > 1))
+         qsort(list, *nsurf, sizeof(SURFFILE), CompareSurfFiles);
+   }
+   else if((fp = OpenSurfaceFile(ListFile)) != NULL)
+   {
+      /* The first non-blank line says whether this is a file of 
+         records or a list of files
       */
-      if(StrucHit && !PatHit)
+      while(ok && fgets(buffer,MAXBUFF-1,fp))
       {
-         for(j=0; j<nstruc; j++)
-	 {
-            struc[j].dist[i] = '0';
+         if(sscanf(buffer, "%s", name) != 1)
+            continue;
+
+         if(first)
+         {
+            records = (buffer[0] == '>');
+            first   = FALSE;
+            if(records && (fp == stdin))
+            {
+               fprintf(stderr,"A file of records can't be read from \
+stdin\n");
+               return(NULL);
+            }
+         }
+         
+         if(records)
+         {
+            if(buffer[0] == '>')
+            {
+               if(sscanf(buffer+1, "%s", name) != 1)
+                  sprintf(name, "%d", *nsurf + 1);
+               ok = AddSurfFile(&list, nsurf, &maxsurf, NULL, ListFile,
+                                name, ftell(fp));
+            }
+         }
+         else if(name[0] != '#')
+         {
+            ok = AddSurfFile(&list, nsurf, &maxsurf, NULL, name, name, 
+                             0L);
          }
       }
+      if(fp != stdin)
+         fclose(fp);
    }
+   else
+   {
+      fprintf(stderr,"Unable to read list: %s\n", ListFile);
+      return(NULL);
+   }
+
+   if(!ok)
+   {
+      fprintf(stderr,"No memory for list: %s\n", ListFile);
+      FreeSurfaceList(list, *nsurf);
+      return(NULL);
+   }
+   if(*nsurf == 0)
+   {
+      fprintf(stderr,"No surfaces found in: %s\n", ListFile);
+      return(NULL);
+   }
+   
+   return(list);
 }
 
 
 /************************************************************************/
-/*>void PrintResults(FILE *out,
-                     int NPatAtom,   ATOM *PatAtom, 
-                     int NStrucAtom, ATOM *StrucAtom)
-   --------------------------------------------------
-   Run through the pattern atoms and, for each, print the best match 
-   from the structure atoms
+/*>SURFFILE *SingleSurfaceList(char *file, int *nsurf)
+   ----------------------------------------------------
+   Creates a list containing just one surface file. The label is the 
+   file name. Returns NULL (with a message) if there is no memory.
 
-   22.11.93 Original   By: ACRM
+   17.10.26 Original   By: agent
 */
-void PrintResults(FILE *out,
-                  int NPatAtom,   ATOM *PatAtom, 
-                  int NStrucAtom, ATOM *StrucAtom)
+SURFFILE *SingleSurfaceList(char *file, int *nsurf)
 {
-   int i;
+   SURFFILE *list   = NULL;
+   int      maxsurf = 0;
+
+   *nsurf = 0;
+   if(!AddSurfFile(&list, nsurf, &maxsurf, NULL, file, NULL, 0L))
+   {
+      fprintf(stderr,"No memory for list: %s\n", file);
+      FREE(list);
+      return(NULL);
+   }
+   return(list);
+}
+
+
+/************************************************************************/
+/*>BOOL AddSurfFile(SURFFILE **list, int *nsurf, int *maxsurf, 
+                      char *dir, char *file, char *label, long offset)
+   ---------------------------------------------------------------------
+   Adds a surface to an expandable list of surfaces. The file name is
+   prefixed by dir/ if dir is not NULL. Copies are made of the file name
+   and label; if label is NULL, the file name is used as the label.
+   Returns FALSE if there is no memory.
+
+   17.10.26 Original   By: agent
+   17.10.26 Renamed from AddFileName(). Added label and offset By: agent
+*/
+BOOL AddSurfFile(SURFFILE **list, int *nsurf, int *maxsurf, char *dir,
+                 char *file, char *label, long offset)
+{
+   SURFFILE *newlist,
+            *sf;
+   int      len = strlen(file) + 1;
+
+   if(*nsurf == *maxsurf)
+   {
+      *maxsurf = (*maxsurf == 0) ? 64 : (2 * *maxsurf);
+      if((newlist = (SURFFILE *)realloc(*list, 
+                                        *maxsurf * sizeof(SURFFILE)))
+         == NULL)
+         return(FALSE);
+      *list = newlist;
+   }
+
+   if(dir != NULL)
+      len += strlen(dir) + 1;
+
+   sf = &((*list)[*nsurf]);
+   sf->offset = offset;
+   if((sf->file = (char *)malloc(len)) == NULL)
+      return(FALSE);
 
-   for(i=0; i<NPatAtom; i++)
-      PrintBestMatch(out, PatAtom, i, StrucAtom, NStrucAtom);
+   if(dir != NULL)
+      sprintf(sf->file, "%s/%s", dir, file);
+   else
+      strcpy(sf->file, file);
+
+   if(label == NULL)
+      label = sf->file;
+   if((sf->label = (char *)malloc(strlen(label) + 1)) == NULL)
+   {
+      free(sf->file);
+      return(FALSE);
+   }
+   strcpy(sf->label, label);
+   (*nsurf)++;
+
+   return(TRUE);
 }
 
 
 /************************************************************************/
-/*>void PrintBestMatch(FILE *out,
-                       ATOM *PatAtom,   int PatIndex, 
-                       ATOM *StrucAtom, int NStrucAtom)
-   ----------------------------------------------------
-   Print the best match from the structure for this pattern atom
+/*>MPPATTERN *ReadPatternFile(SURFFILE *sf, BOOL invert)
+   ------------------------------------------------------
+   Reads and prepares a pattern from a list of surfaces, inverting its
+   properties if required. Returns NULL (with a message) if the file 
+   can't be read or there is no memory.
+
+   17.10.26 Original   By: agent
+   17.10.26 Reads stdin By: agent
+   17.10.26 Renamed from ReadSurfFile() and prepares a pattern By: agent
+*/
+MPPATTERN *ReadPatternFile(SURFFILE *sf, BOOL invert)
+{
+   FILE      *fp;
+   MPPATTERN *pat;
 
-   22.11.93 Original   By: ACRM
+   if((fp = SeekSurfFile(sf)) == NULL)
+      return(NULL);
+
+   if((pat = mpReadPattern(fp, invert)) == NULL)
+      fprintf(stderr,"No memory for surface: %s\n", sf->label);
+
+   if(fp != stdin)
+      fclose(fp);
+   return(pat);
+}
+
+
+/************************************************************************/
+/*>MPSTRUCTURE *ReadStructureFile(SURFFILE *sf)
+   --------------------------------------------
+   Reads and prepares a structure from a list of surfaces. Returns NULL
+   (with a message) if the file can't be read or there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+MPSTRUCTURE *ReadStructureFile(SURFFILE *sf)
+{
+   FILE        *fp;
+   MPSTRUCTURE *struc;
+
+   if((fp = SeekSurfFile(sf)) == NULL)
+      return(NULL);
+
+   if((struc = mpReadStructure(fp)) == NULL)
+      fprintf(stderr,"No memory for surface: %s\n", sf->label);
+
+   if(fp != stdin)
+      fclose(fp);
+   return(struc);
+}
+
+
+/************************************************************************/
+/*>FILE *SeekSurfFile(SURFFILE *sf)
+   --------------------------------
+   Opens the file holding a surface from a list of surfaces and moves to
+   the start of the surface. Returns NULL (with a message) if this
+   can't be done. The file must be closed unless it is stdin.
+
+   17.10.26 Original   By: agent
+*/
+FILE *SeekSurfFile(SURFFILE *sf)
+{
+   FILE *fp;
+
+   if((fp = OpenSurfaceFile(sf->file)) == NULL)
+   {
+      fprintf(stderr,"Unable to open surface file: %s\n", sf->file);
+      return(NULL);
+   }
+
+   if((sf->offset != 0L) && (fseek(fp, sf->offset, SEEK_SET) != 0))
+   {
+      fprintf(stderr,"Unable to read surface: %s\n", sf->label);
+      if(fp != stdin)
+         fclose(fp);
+      return(NULL);
+   }
+   return(fp);
+}
+
+
+/************************************************************************/
+/*>FILE *OpenSurfaceFile(char *file)
+   ----------------------------------
+   Opens a surface or list file for reading. A file of - is stdin.
+
+   17.10.26 Original   By: agent
+*/
+FILE *OpenSurfaceFile(char *file)
+{
+   if(!strcmp(file, STDINFILE))
+      return(stdin);
+   return(fopen(file, "r"));
+}
+
+
+/************************************************************************/
+/*>int CompareSurfFiles(const void *a, const void *b)
+   ---------------------------------------------------
+   qsort() comparison function to sort SURFFILEs by file name
+
+   17.10.26 Original   By: agent
+   17.10.26 Renamed from CompareStrings() and works on SURFFILEs By: agent
+*/
+int CompareSurfFiles(const void *a, const void *b)
+{
+   return(strcmp(((SURFFILE *)a)->file, ((SURFFILE *)b)->file));
+}
+
+
+/************************************************************************/
+/*>void FreeSurfaceList(SURFFILE *list, int nsurf)
+   ------------------------------------------------
+   Frees a list of surfaces. NULL is ignored.
+
+   17.10.26 Original   By: agent
+   17.10.26 Renamed from FreeStructureList() and works on SURFFILEs By: agent
 */
-void PrintBestMatch(FILE *out,
-                    ATOM *PatAtom,   int PatIndex, 
-                    ATOM *StrucAtom, int NStrucAtom)
+void FreeSurfaceList(SURFFILE *list, int nsurf)
 {
-   int  j,
-        best      = -1;
-   REAL score, 
-        BestScore = 0.0;
+   int i;
+
+   if(list != NULL)
+   {
+      for(i=0; i<nsurf; i++)
+      {
+         free(list[i].file);
+         free(list[i].label);
+      }
+      free(list);
+   }
+}
+
+
+/************************************************************************/
+/*>BOOL BuildIndex(char *IndexFile, SURFFILE *StrucList, int nstruc, 
+                     BOOL verbose)
+   -------------------------------------------------------------------
+   Builds an inverted index of the structures in StrucList and writes it
+   to IndexFile. For each pair of residue properties and distance bin,
+   the index lists the structures having such pairs of residues and how
+   many. Pairs in the last distance bin (which holds all the longer 
+   distances) are left out. Structures which can't be read are kept in 
+   the list but have no entries. Returns FALSE (with a message) if 
+   there is no memory or the index can't be written.
+
+   17.10.26 Original   By: agent
+   17.10.26 Reads each structure as a pattern for CountPairKeys() 
+            By: agent
+*/
+BOOL BuildIndex(char *IndexFile, SURFFILE *StrucList, int nstruc, 
+                BOOL verbose)
+{
+   MPPATTERN *surf;
+   POSTING   *post     = NULL,
+             *sorted   = NULL,
+             *newpost;
+   int       *count    = NULL,
+             *keys     = NULL,
+             *start    = NULL,
+             *keyof    = NULL,
+             *newkeyof,
+             npost     = 0,
+             maxpost   = 0,
+             nkeys,
+             s, i;
+   BOOL      ok        = TRUE;
+
+   count = (int *)calloc(NINDEXKEY, sizeof(int));
+   keys  = (int *)malloc(NINDEXKEY * sizeof(int));
+   start = (int *)calloc(NINDEXKEY + 1, sizeof(int));
+   if((count == NULL) || (keys == NULL) || (start == NULL))
+      ok = FALSE;
+
+   /* Collect the postings for each structure in turn                   */
+   for(s=0; ok && (s<nstruc); s++)
+   {
+      if((surf = ReadPatternFile(&(StrucList[s]), FALSE)) == NULL)
+         continue;
+
+      nkeys = CountPairKeys(surf, count, keys);
+      mpFreePattern(surf);
+
+      if(npost + nkeys > maxpost)
+      {
+         maxpost = MAX(2 * maxpost, npost + nkeys);
+         newpost  = (POSTING *)realloc(post, maxpost * sizeof(POSTING));
+         newkeyof = (int *)realloc(keyof, maxpost * sizeof(int));
+         if(newpost  != NULL) post  = newpost;
+         if(newkeyof != NULL) keyof = newkeyof;
+         if((newpost == NULL) || (newkeyof == NULL))
+         {
+            ok = FALSE;
+            break;
+         }
+      }
+      
+      for(i=0; i<nkeys; i++)
+      {
+         post[npost].struc   = s;
+         post[npost].count   = count[keys[i]];
+         keyof[npost++]      = keys[i];
+         start[keys[i]+1]++;
+         count[keys[i]]      = 0;
+      }
+
+      if(verbose)
+      {
+         fprintf(stderr,"%s: %d keys\n", StrucList[s].label, nkeys);
+      }
+   }
+
+   /* Sort the postings by key, keeping them in structure order         */
+   if(ok && ((sorted = (POSTING *)malloc(MAX(npost,1) * sizeof(POSTING)))
+             == NULL))
+      ok = FALSE;
 
-   for(j=0; j<NStrucAtom; j++)
+   if(ok)
    {
-      if(!strncmp(PatAtom[PatIndex].properties,
-                  StrucAtom[j].properties, MAXPROPERTIES) &&
-         !Compare(PatAtom[PatIndex].dist,
-                  StrucAtom[j].dist,       MAXDIST))
+      for(i=0; i<NINDEXKEY; i++)
+         start[i+1] += start[i];
+      for(i=0; i<npost; i++)
+         sorted[start[keyof[i]]++] = post[i];
+      /* start[key] is now the end of key so move it back one place     */
+      for(i=NINDEXKEY; i>0; i--)
+         start[i] = start[i-1];
+      start[0] = 0;
+
+      ok = WriteIndex(IndexFile, StrucList, nstruc, start, sorted, npost);
+   }
+   else
+   {
+      fprintf(stderr,"No memory for index\n");
+   }
+
+   FREE(count);
+   FREE(keys);
+   FREE(start);
+   FREE(keyof);
+   FREE(post);
+   FREE(sorted);
+
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>int CountPairKeys(MPPATTERN *pat, int *count, int *keys)
+   ---------------------------------------------------------
+   Counts the pairs of residues in a prepared surface with each index 
+   key (see PAIRKEY()) leaving out the last distance bin. The 
+   properties are taken from the atom array so they are inverted if 
+   the pattern was. count must be zeroed on entry and is incremented 
+   for each key; the keys which are found are placed in keys. Returns 
+   the number of different keys.
+
+   17.10.26 Original   By: agent
+   17.10.26 Takes a prepared pattern By: agent
+*/
+int CountPairKeys(MPPATTERN *pat, int *count, int *keys)
+{
+   SURFACE *surf  = pat->surf;
+   ATOM    *atoms = pat->atoms;
+   int     i, j, k,
+           key,
+           bin,
+           prop1, prop2,
+           nkeys = 0;
+
+   for(i=0; i<surf->nres; i++)
+   {
+      prop1 = atoms[i].properties;
+      
+      if(surf->bin == NULL)
+      {
+         /* Each pair is in both neighbour lists so just count it once  */
+         for(k=surf->nbrstart[i]; k<surf->nbrstart[i+1]; k++)
+         {
+            if((j = surf->nbr[k]) < i)
+               continue;
+            bin   = surf->nbrbin[k];
+            prop2 = atoms[j].properties;
+            if(bin < MAXDIST-2)
+            {
+               key = PAIRKEY(prop1, prop2, bin);
+               if(count[key]++ == 0)
+                  keys[nkeys++] = key;
+            }
+         }
+      }
+      else
       {
-         score = CalcScore(PatAtom[PatIndex].dist, StrucAtom[j].dist,
-                           MAXDIST);
-         if(score > BestScore)
+         for(j=i+1; j<surf->nres; j++)
          {
-            BestScore = score;
-            best = j;
+            bin   = surf->bin[mpiPairIndex(i, j, surf->nres)];
+            prop2 = atoms[j].properties;
+            if(bin < MAXDIST-2)
+            {
+               key = PAIRKEY(prop1, prop2, bin);
+               if(count[key]++ == 0)
+                  keys[nkeys++] = key;
+            }
          }
       }
    }
 
-   /* If we got a best score, print it out                              */
-   if(best != (-1))
+   return(nkeys);
+}
+
+
+/************************************************************************/
+/*>BOOL WriteIndex(char *IndexFile, SURFFILE *StrucList, int nstruc,
+                     int *start, POSTING *post, int npost)
+   -------------------------------------------------------------------
+   Writes an index. After the INDEXHEADER, each structure is written as
+   its offset, the lengths of its file name and label and the file name 
+   and label themselves. These are followed by the start of each key's
+   postings (and the end of the last) and the postings. Returns FALSE
+   (with a message) if the file can't be written.
+
+   17.10.26 Original   By: agent
+*/
+BOOL WriteIndex(char *IndexFile, SURFFILE *StrucList, int nstruc,
+                int *start, POSTING *post, int npost)
+{
+   FILE        *fp;
+   INDEXHEADER header;
+   int         s,
+               len[2];
+   BOOL        ok = TRUE;
+
+   if((fp = fopen(IndexFile, "wb")) == NULL)
    {
-      fprintf(out, "Pattern: %s %-5s matches Structure: %s %-5s\n",
-              PatAtom[PatIndex].resnam, PatAtom[PatIndex].resid,
-              StrucAtom[best].resnam, StrucAtom[best].resid);
+      fprintf(stderr,"Unable to write index file: %s\n", IndexFile);
+      return(FALSE);
    }
+
+   memset(&header, 0, sizeof(INDEXHEADER));
+   strcpy(header.magic, INDEXMAGIC);
+   header.version = INDEXVERSION;
+   header.endian  = INDEXENDIAN;
+   header.nstruc  = nstruc;
+   header.nkey    = NINDEXKEY;
+   header.npost   = npost;
+   header.maxdist = MAXDIST;
+   header.binsize = gSettings.binsize;
+   header.cutoff  = gSettings.cutoff;
+   if(fwrite(&header, sizeof(INDEXHEADER), 1, fp) != 1)
+      ok = FALSE;
+
+   for(s=0; ok && (s<nstruc); s++)
+   {
+      len[0] = strlen(StrucList[s].file);
+      len[1] = strlen(StrucList[s].label);
+      if((fwrite(&(StrucList[s].offset), sizeof(long), 1, fp) != 1) ||
+         (fwrite(len, sizeof(int), 2, fp) != 2) ||
+         (fwrite(StrucList[s].file, 1, len[0], fp) != (size_t)len[0]) ||
+         (fwrite(StrucList[s].label, 1, len[1], fp) != (size_t)len[1]))
+         ok = FALSE;
+   }
+
+   if(ok && 
+      ((fwrite(start, sizeof(int), NINDEXKEY+1, fp) != NINDEXKEY+1) ||
+       ((npost > 0) && 
+        (fwrite(post, sizeof(POSTING), npost, fp) != (size_t)npost))))
+      ok = FALSE;
+
+   if(fclose(fp) != 0)
+      ok = FALSE;
+   if(!ok)
+      fprintf(stderr,"Error writing index file: %s\n", IndexFile);
+
+   return(ok);
 }
 
 
 /************************************************************************/
-/*>BOOL Compare(char *str1, chsr *str2, int len)
-   ---------------------------------------------
-   Compares two bitstrings (1/0 character strings) using a 75% identity
-   requirement
+/*>SURFINDEX *ReadIndex(char *IndexFile)
+   --------------------------------------
+   Reads an index written by WriteIndex(). Returns NULL (with a message)
+   if the file can't be read, is from a different version or machine,
+   was built with a different bin size or cutoff, has postings outside
+   its lists of keys and structures, or there is no memory.
+
+   17.10.26 Original   By: agent
+   17.10.26 Checks the key starts and the structure of each posting
+            By: agent
+*/
+SURFINDEX *ReadIndex(char *IndexFile)
+{
+   FILE        *fp;
+   INDEXHEADER header;
+   SURFINDEX   *index;
+   char        *file,
+               *label;
+   long        offset;
+   int         s,
+               maxstruc = 0,
+               len[2];
+   BOOL        ok       = TRUE;
+
+   if((fp = fopen(IndexFile, "rb")) == NULL)
+   {
+      fprintf(stderr,"Unable to open index file: %s\n", IndexFile);
+      return(NULL);
+   }
 
-   22.11.93 Original   By: ACRM
+   if((fread(&header, sizeof(INDEXHEADER), 1, fp) != 1) ||
+      strncmp(header.magic, INDEXMAGIC, sizeof(header.magic)) ||
+      (header.version != INDEXVERSION) || 
+      (header.endian != INDEXENDIAN) ||
+      (header.nkey != NINDEXKEY) || (header.maxdist != MAXDIST) ||
+      (header.nstruc < 0) || (header.npost < 0))
+   {
+      fprintf(stderr,"Not an index file or from a different version \
+or machine: %s\n", IndexFile);
+      fclose(fp);
+      return(NULL);
+   }
+   if((header.binsize != gSettings.binsize) || 
+      (header.cutoff  != gSettings.cutoff))
+   {
+      fprintf(stderr,"Index was built with bin size %.2f and cutoff \
+%.2f: %s\n", header.binsize, header.cutoff, IndexFile);
+      fclose(fp);
+      return(NULL);
+   }
+
+   if((index = (SURFINDEX *)calloc(1, sizeof(SURFINDEX))) == NULL)
+   {
+      fprintf(stderr,"No memory for index\n");
+      fclose(fp);
+      return(NULL);
+   }
+   index->start = (int *)malloc((NINDEXKEY+1) * sizeof(int));
+   index->post  = (POSTING *)malloc(MAX(header.npost,1) * 
+                                    sizeof(POSTING));
+   if((index->start == NULL) || (index->post == NULL))
+      ok = FALSE;
+
+   for(s=0; ok && (s<header.nstruc); s++)
+   {
+      file = label = NULL;
+      if((fread(&offset, sizeof(long), 1, fp) != 1) ||
+         (fread(len, sizeof(int), 2, fp) != 2) ||
+         (len[0] < 0) || (len[1] < 0) ||
+         ((file  = (char *)calloc(len[0]+1, 1)) == NULL) ||
+         ((label = (char *)calloc(len[1]+1, 1)) == NULL) ||
+         (fread(file, 1, len[0], fp) != (size_t)len[0]) ||
+         (fread(label, 1, len[1], fp) != (size_t)len[1]) ||
+         !AddSurfFile(&(index->StrucList), &(index->nstruc), &maxstruc,
+                      NULL, file, label, offset))
+         ok = FALSE;
+      FREE(file);
+      FREE(label);
+   }
+
+   if(ok &&
+      ((fread(index->start, sizeof(int), NINDEXKEY+1, fp) != 
+        NINDEXKEY+1) ||
+       (fread(index->post, sizeof(POSTING), header.npost, fp) != 
+        (size_t)header.npost) ||
+       (index->start[NINDEXKEY] != header.npost)))
+      ok = FALSE;
+   index->npost = header.npost;
+   fclose(fp);
+
+   /* Check the postings can be used without going outside the arrays  */
+   if(ok && (index->start[0] != 0))
+      ok = FALSE;
+   for(s=0; ok && (s<NINDEXKEY); s++)
+   {
+      if(index->start[s] > index->start[s+1])
+         ok = FALSE;
+   }
+   for(s=0; ok && (s<index->npost); s++)
+   {
+      if((index->post[s].struc < 0) || 
+         (index->post[s].struc >= index->nstruc))
+         ok = FALSE;
+   }
+
+   if(!ok)
+   {
+      fprintf(stderr,"Unable to read index file: %s\n", IndexFile);
+      FreeIndex(index);
+      return(NULL);
+   }
+   
+   return(index);
+}
+
+
+/************************************************************************/
+/*>void FreeIndex(SURFINDEX *index)
+   ---------------------------------
+   Frees an index. NULL is ignored.
+
+   17.10.26 Original   By: agent
+*/
+void FreeIndex(SURFINDEX *index)
+{
+   if(index != NULL)
+   {
+      FreeSurfaceList(index->StrucList, index->nstruc);
+      FREE(index->start);
+      FREE(index->post);
+      free(index);
+   }
+}
+
+
+/************************************************************************/
+/*>void MatchIndex(FILE *out, SURFINDEX *index, SURFFILE *PatList, 
+                     int npat, BOOL PatLabel, BOOL invert, BOOL window,
+                     BOOL verbose)
+   --------------------------------------------------------------------
+   Matches each pattern against the structures in an index which pass
+   ScreenIndex(). The results are as for MatchSurfaceLists() with the 
+   structure names given.
+
+   17.10.26 Original   By: agent
+   17.10.26 Added window By: agent
+   17.10.26 Screens with the prepared patterns By: agent
 */
-BOOL Compare(char *str1, char *str2, int len)
+void MatchIndex(FILE *out, SURFINDEX *index, SURFFILE *PatList, 
+                int npat, BOOL PatLabel, BOOL invert, BOOL window,
+                BOOL verbose)
 {
-   int  i,
-        CountStr1 = 0,
-        CountStr2 = 0,
-        NMatch    = 0;
-   REAL Accuracy;
+   MPPATTERN **pat;
+   SURFFILE  *cand;
+   int       ncand,
+             i;
+
+   if((pat = ReadPatterns(PatList, npat, invert, verbose)) == NULL)
+      return;
 
-   for(i=0; i<len; i++)
+   for(i=0; i<npat; i++)
    {
-      if(str1[i] == '1') CountStr1++;
-      if(str2[i] == '1') CountStr2++;
+      if(pat[i] == NULL)
+         continue;
+
+      if((cand = ScreenIndex(index, pat[i], &ncand)) == NULL)
+      {
+         if(ncand)
+            fprintf(stderr,"No memory for screening: %s\n", 
+                    PatList[i].label);
+         continue;
+      }
+      
+      if(verbose)
+      {
+         fprintf(stderr,"%s: %d of %d structures pass the index \
+screen\n", PatList[i].label, ncand, index->nstruc);
+      }
+
+      MatchSurfaceLists(out, &(PatList[i]), &(pat[i]), 1, cand, ncand,
+                        PatLabel, TRUE, window, verbose);
+      FreeSurfaceList(cand, ncand);
+   }
+
+   FreePatterns(pat, npat);
+}
+
+
+/************************************************************************/
+/*>SURFFILE *ScreenIndex(SURFINDEX *index, MPPATTERN *pat, int *ncand)
+   --------------------------------------------------------------------
+   Finds the structures in an index which are worth matching against a
+   pattern. Each structure scores the number of the pattern's pairs of
+   residues it also has (with the same properties and distance bin). 
+   Those scoring at least gScreen percent of the pattern's pairs are
+   returned as a list (in index order) with their number in ncand. 
+   If the pattern has no pairs to score, all the structures are 
+   returned. Returns NULL if there are no candidates (ncand is 0) or 
+   there is no memory (ncand is not 0).
+
+   17.10.26 Original   By: agent
+   17.10.26 Takes a prepared pattern By: agent
+*/
+SURFFILE *ScreenIndex(SURFINDEX *index, MPPATTERN *pat, int *ncand)
+{
+   SURFFILE *cand     = NULL;
+   int      *count    = NULL,
+            *keys     = NULL,
+            *score    = NULL,
+            maxcand   = 0,
+            nkeys,
+            npair     = 0,
+            i, k,
+            key;
+   BOOL     ok        = TRUE;
+
+   *ncand = 1;
+   count  = (int *)calloc(NINDEXKEY, sizeof(int));
+   keys   = (int *)malloc(NINDEXKEY * sizeof(int));
+   score  = (int *)calloc(MAX(index->nstruc,1), sizeof(int));
+   if((count == NULL) || (keys == NULL) || (score == NULL))
+   {
+      FREE(count);
+      FREE(keys);
+      FREE(score);
+      return(NULL);
+   }
+   
+   /* Score the structures from the postings for the pattern's keys     */
+   nkeys = CountPairKeys(pat, count, keys);
+   for(i=0; i<nkeys; i++)
+   {
+      key    = keys[i];
+      npair += count[key];
+      for(k=index->start[key]; k<index->start[key+1]; k++)
+         score[index->post[k].struc] += MIN(count[key], 
+                                            index->post[k].count);
+   }
+
+   *ncand = 0;
+   for(i=0; ok && (i<index->nstruc); i++)
+   {
+      if((npair == 0) || (100.0 * score[i] >= gScreen * npair))
+      {
+         ok = AddSurfFile(&cand, ncand, &maxcand, NULL, 
+                          index->StrucList[i].file,
+                          index->StrucList[i].label,
+                          index->StrucList[i].offset);
+      }
+   }
 
-      if((str1[i] == '1') && (str2[i] == '1')) NMatch++;
+   FREE(count);
+   FREE(keys);
+   FREE(score);
+
+   if(!ok)
+   {
+      FreeSurfaceList(cand, *ncand);
+      *ncand = 1;
+      return(NULL);
    }
+   return(cand);
+}
 
-   if((Accuracy = ((REAL)100.0 * (REAL)NMatch / 
-                   (REAL)MAX(CountStr1, CountStr2))) >= 
-      gAccuracy)
+
+/************************************************************************/
+/*>BOOL Serve(char *SocketFile, SURFFILE *StrucList, int nstruc, 
+              BOOL verbose)
+   -------------------------------------------------------------
+   Reads and prepares every structure in StrucList once, then answers 
+   queries from matchpatch -q on the Unix domain socket SocketFile 
+   using gNThreads threads. Each query is matched against all the 
+   structures as -l does. Only returns (FALSE, with a message) if the 
+   structures or socket can't be set up or connections can no longer 
+   be accepted.
+
+   17.10.26 Original   By: agent
+   17.10.26 Prepares the structures with ReadStructureFile() By: agent
+*/
+BOOL Serve(char *SocketFile, SURFFILE *StrucList, int nstruc, 
+           BOOL verbose)
+{
+   SERVER    server;
+   pthread_t thread[MAXTHREADS];
+   int       nthread = 0,
+             i;
+
+   server.StrucList = StrucList;
+   server.nstruc    = nstruc;
+   server.verbose   = verbose;
+   if((server.struc = (LISTSURF *)calloc(MAX(nstruc, 1), 
+                                         sizeof(LISTSURF))) == NULL)
    {
+      fprintf(stderr,"No memory for structures\n");
       return(FALSE);
    }
 
+   for(i=0; i<nstruc; i++)
+   {
+      LISTSURF *struc = &(server.struc[i]);
+
+      struc->loaded = TRUE;
+      if(((struc->handle = ReadStructureFile(&(StrucList[i]))) != NULL) &&
+         verbose)
+      {
+         fprintf(stderr, "%s: %ld distances calculated from %d \
+structure atoms\n", StrucList[i].label, struc->handle->surf->npair, 
+                 struc->handle->surf->nres);
+      }
+   }
+
+   if((server.listenfd = ConnectSocket(SocketFile, TRUE)) >= 0)
+   {
+      if(verbose)
+         fprintf(stderr,"Serving %d structures on %s\n", nstruc, 
+                 SocketFile);
+
+      /* This thread serves too                                         */
+      for(i=1; i<gNThreads; i++)
+      {
+         if(!pthread_create(&(thread[nthread]), NULL, ServeThread,
+                            (void *)&server))
+            nthread++;
+      }
+      ServeThread((void *)&server);
+
+      for(i=0; i<nthread; i++)
+         pthread_join(thread[i], NULL);
+      close(server.listenfd);
+      unlink(SocketFile);
+   }
+
+   for(i=0; i<nstruc; i++)
+      mpFreeStructure(server.struc[i].handle);
+   free(server.struc);
+   return(FALSE);
+}
+
+
+/************************************************************************/
+/*>void *ServeThread(void *arg)
+   ----------------------------
+   Thread function for Serve(). Accepts connections and answers the
+   query on each in turn. Connections are made non-blocking so that 
+   ServeClient() can drop a client which doesn't keep to its deadlines.
+   Only returns if accept() fails.
+
+   17.10.26 Original   By: agent
+   17.10.26 Added the timeouts By: agent
+   17.10.26 Connections are non-blocking rather than having timeouts
+            By: agent
+*/
+void *ServeThread(void *arg)
+{
+   SERVER *server = (SERVER *)arg;
+   int    fd,
+          fdflags;
+
+   for(;;)
+   {
+      if((fd = accept(server->listenfd, NULL, NULL)) < 0)
+      {
+         if((errno == EINTR) || (errno == ECONNABORTED))
+            continue;
+         fprintf(stderr,"Unable to accept connections: %s\n",
+                 strerror(errno));
+         break;
+      }
+
+      if(((fdflags = fcntl(fd, F_GETFL)) < 0) ||
+         (fcntl(fd, F_SETFL, fdflags | O_NONBLOCK) < 0))
+      {
+         fprintf(stderr,"Unable to set up a connection: %s\n",
+                 strerror(errno));
+      }
+      else
+      {
+         ServeClient(server, fd);
+      }
+      close(fd);
+   }
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>void ServeClient(SERVER *server, int fd)
+   ----------------------------------------
+   Answers a single query on a connection, which the caller then 
+   closes. A query is a line "PATTERN nbytes flags" followed by nbytes 
+   of pattern (text or binary output of matchpatchsurface). flags 
+   contains i to invert the pattern and w to use windows (or is - for 
+   neither). The reply is a line "RESULT nbytes -" followed by the 
+   output that -l would give, or "ERROR nbytes -" followed by a message.
+   Nothing is sent if the query can't be read.
+
+   The client must send the whole query within SERVETIMEOUT seconds of
+   connecting and take the whole reply within SERVETIMEOUT seconds of
+   it being ready, however it spreads the bytes out, or it is dropped.
+
+   17.10.26 Original   By: agent
+   17.10.26 Answers one query rather than all those on the connection
+            By: agent
+   17.10.26 Added the deadlines By: agent
+*/
+void ServeClient(SERVER *server, int fd)
+{
+   char   type[MAXBUFF],
+          flags[MAXBUFF],
+          *query,
+          *reply,
+          *error = NULL;
+   size_t len,
+          outlen;
+
+   if(ReadFrame(fd, type, flags, &query, &len, MAXREQUEST,
+                Deadline(SERVETIMEOUT)))
+   {
+      if(strcmp(type, "PATTERN"))
+         error = "Unknown request\n";
+      else if((reply = MatchQuery(server, query, len,
+                                  (strchr(flags, 'i') != NULL),
+                                  (strchr(flags, 'w') != NULL),
+                                  &outlen)) == NULL)
+         error = "Unable to read or match the pattern\n";
+      free(query);
+
+      if(error != NULL)
+      {
+         WriteFrame(fd, "ERROR", "-", error, strlen(error),
+                    Deadline(SERVETIMEOUT));
+      }
+      else
+      {
+         WriteFrame(fd, "RESULT", "-", reply, outlen, 
+                    Deadline(SERVETIMEOUT));
+         free(reply);
+      }
+   }
+}
+
+
+/************************************************************************/
+/*>char *MatchQuery(SERVER *server, char *query, size_t len, 
+                    BOOL invert, BOOL window, size_t *outlen)
+   ---------------------------------------------------------------
+   Reads the pattern in the len bytes of query and matches it against
+   every structure held by the server. Returns the output (of outlen 
+   bytes), which must be freed, or NULL if the pattern can't be read, 
+   has no residues or there is no memory.
+
+   17.10.26 Original   By: agent
+   17.10.26 A pattern with no residues is rejected By: agent
+   17.10.26 Prepares the pattern with mpReadPattern() By: agent
+*/
+char *MatchQuery(SERVER *server, char *query, size_t len, BOOL invert,
+                 BOOL window, size_t *outlen)
+{
+   FILE        *fp,
+               *out  = NULL;
+   MPPATTERN   *pat  = NULL;
+   MPSTRUCTURE *struc;
+   char        *text = NULL,
+               label[MAXBUFF];
+   int         s;
+
+   *outlen = 0;
+   if((len == 0) || ((fp = fmemopen(query, len, "r")) == NULL))
+      return(NULL);
+   pat = mpReadPattern(fp, invert);
+   fclose(fp);
+   if(pat == NULL)
+      return(NULL);
+   if(pat->surf->nres == 0)
+   {
+      mpFreePattern(pat);
+      return(NULL);
+   }
+
+   if((out = open_memstream(&text, outlen)) != NULL)
+   {
+      for(s=0; s<server->nstruc; s++)
+      {
+         if((struc = server->struc[s].handle) == NULL)
+            continue;
+
+         sprintf(label, "Structure: %.*s", (MAXBUFF-14)/2,
+                 server->StrucList[s].label);
+         MatchSurfaces(out, pat, struc, label, window, 
+                       gSettings.minmatch, NULL, server->verbose);
+      }
+      if(fclose(out))
+         FREE(text);
+   }
+
+   mpFreePattern(pat);
+   return(text);
+}
+
+
+/************************************************************************/
+/*>BOOL SendQuery(char *SocketFile, FILE *fp_pat, FILE *out, 
+                  BOOL invert, BOOL window)
+   ---------------------------------------------------------
+   Sends the pattern read from fp_pat to the server on SocketFile and
+   writes its reply to out. Returns FALSE (with a message) if the 
+   server can't be reached, reports an error or sends a reply of more
+   than MAXREPLY bytes.
+
+   17.10.26 Original   By: agent
+   17.10.26 Limits the reply to MAXREPLY By: agent
+*/
+BOOL SendQuery(char *SocketFile, FILE *fp_pat, FILE *out, BOOL invert,
+               BOOL window)
+{
+   char   *query = NULL,
+          *reply = NULL,
+          *tmp,
+          type[MAXBUFF],
+          flags[MAXBUFF];
+   size_t len    = 0,
+          maxlen = 0,
+          nread;
+   int    fd;
+   BOOL   ok     = FALSE;
+
+   /* Read the whole pattern                                            */
+   do
+   {
+      if(len == maxlen)
+      {
+         maxlen = (maxlen == 0) ? BUFSIZ : 2 * maxlen;
+         if((tmp = (char *)realloc(query, maxlen)) == NULL)
+         {
+            fprintf(stderr,"No memory for pattern\n");
+            FREE(query);
+            return(FALSE);
+         }
+         query = tmp;
+      }
+      nread = fread(query+len, 1, maxlen-len, fp_pat);
+      len  += nread;
+   }  while(nread > 0);
+
+   sprintf(flags, "%s%s%s", (invert ? "i" : ""), (window ? "w" : ""),
+           ((invert || window) ? "" : "-"));
+
+   if((fd = ConnectSocket(SocketFile, FALSE)) >= 0)
+   {
+      if(!WriteFrame(fd, "PATTERN", flags, query, len, 0) ||
+         !ReadFrame(fd, type, flags, &reply, &len, MAXREPLY, 0))
+      {
+         fprintf(stderr,"No reply from server: %s\n", SocketFile);
+      }
+      else if(!strcmp(type, "RESULT"))
+      {
+         ok = (fwrite(reply, 1, len, out) == len);
+      }
+      else
+      {
+         fprintf(stderr,"Server error: %s", reply);
+      }
+      FREE(reply);
+      close(fd);
+   }
+
+   free(query);
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>int ConnectSocket(char *SocketFile, BOOL listening)
+   ----------------------------------------------------
+   Creates a Unix domain socket for SocketFile. If listening is set, 
+   any old socket file is removed and the new socket bound to it and 
+   set listening, otherwise the socket is connected to a server. 
+   Returns the socket or -1 (with a message) on error.
+
+   17.10.26 Original   By: agent
+*/
+int ConnectSocket(char *SocketFile, BOOL listening)
+{
+   struct sockaddr_un addr;
+   int                fd;
+
+   if(strlen(SocketFile) >= sizeof(addr.sun_path))
+   {
+      fprintf(stderr,"Socket name is too long: %s\n", SocketFile);
+      return(-1);
+   }
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strcpy(addr.sun_path, SocketFile);
+
+   if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+   {
+      fprintf(stderr,"Unable to create socket: %s\n", strerror(errno));
+      return(-1);
+   }
+
+   if(listening)
+   {
+      unlink(SocketFile);
+      if((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+         (listen(fd, SERVEBACKLOG) < 0))
+      {
+         fprintf(stderr,"Unable to listen on socket %s: %s\n", 
+                 SocketFile, strerror(errno));
+         close(fd);
+         return(-1);
+      }
+   }
+   else if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+   {
+      fprintf(stderr,"Unable to connect to socket %s: %s\n", 
+              SocketFile, strerror(errno));
+      close(fd);
+      return(-1);
+   }
+
+   return(fd);
+}
+
+
+/************************************************************************/
+/*>BOOL ReadFrame(int fd, char *type, char *flags, char **data, 
+                  size_t *len, size_t maxlen, time_t deadline)
+   ---------------------------------------------------------------------
+   Reads a line "type nbytes flags" and the nbytes of data that follow
+   it from a socket. The data are placed in allocated memory (with a
+   '\0' added) which must be freed. type and flags must be MAXBUFF 
+   long. Returns FALSE at the end of the input, on error, if there 
+   are more than maxlen bytes or if deadline (see ReadBytes()) passes
+   before it has all been read. nbytes can't be so large that the space
+   for the '\0' would wrap round whatever maxlen is.
+
+   17.10.26 Original   By: agent
+   17.10.26 Added deadline By: agent
+   17.10.26 Rejects nbytes which would wrap the allocation By: agent
+*/
+BOOL ReadFrame(int fd, char *type, char *flags, char **data, 
+               size_t *len, size_t maxlen, time_t deadline)
+{
+   char          line[MAXBUFF];
+   unsigned long nbytes;
+   int           i;
+
+   *data = NULL;
+   for(i=0; i<MAXBUFF-1; i++)
+   {
+      if(!ReadBytes(fd, line+i, 1, deadline))
+         return(FALSE);
+      if(line[i] == '\n')
+         break;
+   }
+   line[i] = '\0';
+
+   if((i == MAXBUFF-1) ||
+      (sscanf(line, "%s %lu %s", type, &nbytes, flags) != 3) ||
+      (nbytes > maxlen) || (nbytes + 1 == 0) ||
+      ((*data = (char *)malloc(nbytes + 1)) == NULL))
+      return(FALSE);
+
+   if(!ReadBytes(fd, *data, nbytes, deadline))
+   {
+      FREE(*data);
+      return(FALSE);
+   }
+   (*data)[nbytes] = '\0';
+   *len = nbytes;
    return(TRUE);
 }
 
 
 /************************************************************************/
-/*>REAL CalcScore(char *str1, char *str2, int len)
-   -----------------------------------------------
-   Calculate the score for this match. Much the same as compare, but 
-   returns the percentage score rather than a BOOL
+/*>BOOL WriteFrame(int fd, char *type, char *flags, char *data, 
+                   size_t len, time_t deadline)
+   ------------------------------------------------------------
+   Writes a line "type len flags" followed by len bytes of data to a 
+   socket. Returns FALSE on error or if deadline (see WriteBytes()) 
+   passes before it has all been written.
+
+   17.10.26 Original   By: agent
+   17.10.26 Added deadline By: agent
+*/
+BOOL WriteFrame(int fd, char *type, char *flags, char *data, 
+                size_t len, time_t deadline)
+{
+   char line[MAXBUFF];
 
-   22.11.93 Original   By: ACRM
+   sprintf(line, "%.*s %lu %.*s\n", (MAXBUFF-32)/2, type, 
+           (unsigned long)len, (MAXBUFF-32)/2, flags);
+   return(WriteBytes(fd, line, strlen(line), deadline) && 
+          WriteBytes(fd, data, len, deadline));
+}
+
+
+/************************************************************************/
+/*>BOOL ReadBytes(int fd, char *buffer, size_t len, time_t deadline)
+   -----------------------------------------------------------------
+   Reads exactly len bytes from a socket. Returns FALSE on error or if
+   it is closed first. If the socket is non-blocking, waits for more 
+   data with WaitForSocket(), so returns FALSE if deadline passes 
+   first.
+
+   17.10.26 Original   By: agent
+   17.10.26 Added deadline By: agent
 */
-REAL CalcScore(char *str1, char *str2, int len)
+BOOL ReadBytes(int fd, char *buffer, size_t len, time_t deadline)
 {
-   int i,
-       CountStr1 = 0,
-       CountStr2 = 0,
-       NMatch    = 0;
+   ssize_t nread;
 
-   for(i=0; i<len; i++)
+   while(len > 0)
    {
-      if(str1[i] == '1') CountStr1++;
-      if(str2[i] == '1') CountStr2++;
+      if((nread = recv(fd, buffer, len, 0)) <= 0)
+      {
+         if((nread < 0) && (errno == EINTR))
+            continue;
+         if((nread < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            && WaitForSocket(fd, POLLIN, deadline))
+            continue;
+         return(FALSE);
+      }
+      buffer += nread;
+      len    -= nread;
+   }
+   return(TRUE);
+}
 
-      if((str1[i] == '1') && (str2[i] == '1')) NMatch++;
+
+/************************************************************************/
+/*>BOOL WriteBytes(int fd, char *buffer, size_t len, time_t deadline)
+   ------------------------------------------------------------------
+   Writes len bytes to a socket. Returns FALSE on error, including the
+   other end having closed it (which would otherwise raise SIGPIPE).
+   If the socket is non-blocking, waits for room with WaitForSocket(),
+   so returns FALSE if deadline passes first.
+
+   17.10.26 Original   By: agent
+   17.10.26 Added deadline By: agent
+*/
+BOOL WriteBytes(int fd, char *buffer, size_t len, time_t deadline)
+{
+   ssize_t nwritten;
+
+   while(len > 0)
+   {
+      if((nwritten = send(fd, buffer, len, MSG_NOSIGNAL)) < 0)
+      {
+         if(errno == EINTR)
+            continue;
+         if(((errno == EAGAIN) || (errno == EWOULDBLOCK)) &&
+            WaitForSocket(fd, POLLOUT, deadline))
+            continue;
+         return(FALSE);
+      }
+      buffer += nwritten;
+      len    -= nwritten;
    }
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>time_t Deadline(int seconds)
+   ----------------------------
+   Returns the time seconds from now on the monotonic clock, for use as
+   a deadline by WaitForSocket().
+
+   17.10.26 Original   By: agent
+*/
+time_t Deadline(int seconds)
+{
+   struct timespec now;
 
-   return((REAL)100.0 * (REAL)NMatch / (REAL)MAX(CountStr1, CountStr2));
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return(now.tv_sec + seconds);
 }
+
+
+/************************************************************************/
+/*>BOOL WaitForSocket(int fd, short events, time_t deadline)
+   ---------------------------------------------------------
+   Waits until a non-blocking socket is ready for events (POLLIN or
+   POLLOUT). deadline is from Deadline(), or 0 to wait for ever. 
+   Returns FALSE on error or if the deadline passes first.
+
+   17.10.26 Original   By: agent
+*/
+BOOL WaitForSocket(int fd, short events, time_t deadline)
+{
+   struct pollfd   pfd;
+   struct timespec now;
+   int             wait = (-1),
+                   ready;
+
+   pfd.fd     = fd;
+   pfd.events = events;
+   do
+   {
+      if(deadline != 0)
+      {
+         clock_gettime(CLOCK_MONOTONIC, &now);
+         if(now.tv_sec >= deadline)
+            return(FALSE);
+         wait = (int)(deadline - now.tv_sec) * 1000;
+      }
+      ready = poll(&pfd, 1, wait);
+   }  while((ready < 0) && (errno == EINTR));
+
+   return(ready > 0);
+}
+
+
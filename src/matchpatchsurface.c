@@ -4,8 +4,8 @@
    Program:    matchpatchsurface
    File:       matchpatchsurface.c
    
-   Version:    V2.0
-   Date:       16.04.21
+   Version:    V2.11
+   Date:       17.10.26
    Function:   To create a distance map of surface features
    
    Copyright:  (c) SciTech Software / abYinformatics 1993-2021
@@ -38,11 +38,36 @@
 
    Notes:
    ======
-   This is a very crude simple and slow version; the surface searching
-   takes for ever! This could be improved dramatically by using IndexPDB
-   to create an array of pointers into the linked list then sorting
-   this array on each of x, y and z. Flagging the surface atoms would 
-   then be extremely fast.
+   The surface is found by sweeping a probe along grid lines parallel to
+   each axis. Originally each probe point was tested against every atom
+   which took for ever! By default the atoms are now placed in a grid of
+   cells (using IndexPDB) so each probe point is only tested against the
+   atoms in the neighbouring cells. The original method is still 
+   available with -e sweep. With -e voxel, the probe points covered by
+   atoms are rasterized into bitmaps so each search along a grid line is
+   just a scan for the first set bit.
+
+   The sweeps along grid lines may be shared between several threads 
+   with -j. Each thread flags atoms in its own bitmap and the bitmaps 
+   are merged at the end so the result does not depend on the number 
+   of threads.
+
+   The atoms of interest and residue properties are defined by a table
+   of features which may be read from a file with -f. The table is 
+   looked up through a hash keyed on the packed residue and atom names.
+
+   Alternatively, -e sasa calculates solvent accessibility using the 
+   Shrake and Rupley method and selects residues by their relative 
+   accessibility.
+
+   With -P, a patch is written for each surface residue (or those in 
+   the chains given with -c). With -e sasa these are the residues with
+   a relative accessibility above -t (10% by default). The patch 
+   contains the residues of interest whose centres lie within the 
+   radius of the residue's CA. These are found using a cell list of the
+   residues of interest. Each patch is 
+   written as a record starting with a line >resid so the patches from 
+   a template can all be matched by a single run of matchpatch -p.
    
 **************************************************************************
 
@@ -54,6 +79,31 @@
    V2.0  16.04.21 Now just outputs the residues of interest with their
                   properties rather than the distances. Modified to use
                   standard BiopTools methods of I/O
+   V2.1  17.10.26 Added cell list surface engine and -e to select the
+                  engine. Fixed the backwards search along y which
+                  stopped at zmin rather than ymin By: agent
+   V2.2  17.10.26 Added voxel surface engine By: agent
+   V2.3  17.10.26 Added Shrake-Rupley accessibility engine with -p, -t,
+                  -a and -r options By: agent
+   V2.4  17.10.26 Added -j to run the sweeps in several threads By: agent
+   V2.5  17.10.26 Atoms of interest and residue properties are now 
+                  defined by a feature table which may be read with -f
+                  By: agent
+   V2.6  17.10.26 Residues of interest are found through a hash and
+                  placed at the true centre of their atoms of interest
+                  By: agent
+   V2.7  17.10.26 Added -b to write a binary surface file and -d to 
+                  store the distance bins in it By: agent
+   V2.8  17.10.26 Added -P to write a patch of the residues of interest
+                  around each surface residue as records for matchpatch
+                  By: agent
+   V2.9  17.10.26 -b doesn't store the distance bins if there are too 
+                  many pairs for the file to hold By: agent
+   V2.10 17.10.26 -P centres each patch on the residue's CA taken from
+                  the full structure and skips residues with no CA 
+                  By: agent
+   V2.11 17.10.26 Exits with 1 if -P or -b fails to write its output
+                  By: agent
 
 *************************************************************************/
 /* Includes
@@ -61,7 +111,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "bioplib/MathType.h"
 #include "bioplib/SysDefs.h"
@@ -69,6 +121,7 @@
 #include "bioplib/macros.h"
 
 #include "properties.h"
+#include "surfbin.h"
 
 /************************************************************************/
 /* Defines
@@ -79,6 +132,29 @@
 #define WATERSQ (WATER * WATER)
 #define MAXBUFF 160
 
+#define CELLSIZE     1.5      /* Cell list size; must be > WATER        */
+#define MAXCELLRATIO 8        /* Max cells per atom in the cell list    */
+
+#define ENGINE_SWEEP 0        /* Test probe points against every atom   */
+#define ENGINE_CELL  1        /* Test probe points using a cell list    */
+#define ENGINE_VOXEL 2        /* Scan bitmaps of occupied probe points  */
+#define ENGINE_SASA  3        /* Select residues by accessibility       */
+
+#define DEFRELACCESS  10.0    /* Default min relative accessibility (%) */
+#define DEFRADIUS     1.80    /* Radius for unknown elements            */
+#define NSPHEREPOINTS  480    /* Points on each sphere for accessibility*/
+#define SASABLOCK        8    /* Neighbours tested together for a point */
+
+#define VOXBITS      (sizeof(VOXWORD) * 8)
+
+#define FEATHASHSIZE 256      /* Initial size of feature hash (power 2) */
+
+#ifdef __GNUC__
+#  define FIRSTBIT(x) __builtin_ctzl(x)
+#else
+#  define FIRSTBIT(x) FirstBit(x)
+#endif
+
 
 #ifdef DEBUG
 #define D(BUG) fprintf(stderr,BUG)
@@ -86,9 +162,209 @@
 #define D(BUG)
 #endif
 
+/************************************************************************/
+/* Structure and type definitions
+*/
+/* Atoms sorted by the grid cell they occupy. The atoms in cell c are
+   atom[start[c]] to atom[start[c+1]-1] where c = (ix * ny + iy) * nz + iz
+   index[] gives the position of each atom in the linked list
+*/
+typedef struct
+{
+   PDB  **atom;
+   int  *start,
+        *index,
+        nx, ny, nz;
+   REAL xmin, ymin, zmin,
+        size;
+}  CELLLIST;
+
+typedef unsigned long VOXWORD;
+
+/* The probe points used when searching along one axis in one direction.
+   Map axis a is coordinate axis[a] (0, 1, 2 for x, y, z) with grid 
+   coordinates coord[a][0..n[a]-1]. Searches run along map axis 2 whose
+   coordinates are in search order. A bit is set for each point within 
+   the water radius of an atom; the bits for the grid line at (i,j) are 
+   in the nwords words starting at bits[(i * n[1] + j) * nwords]
+*/
+typedef struct
+{
+   VOXWORD *bits;
+   REAL    *coord[3],
+           step[3];
+   int     n[3],
+           axis[3],
+           nwords;
+}  VOXELMAP;
+
+/* The sweeps to be shared between threads. Each task searches all the
+   grid lines through one grid coordinate of the outer loop of a search.
+   Threads take the next task when they become free.
+*/
+typedef struct
+{
+   PDB             *pdb;
+   CELLLIST        *cells;
+   REAL            *line[3],        /* Grid coordinates on each axis    */
+                   min[3],
+                   max[3];
+   int             nline[3],
+                   ntask,
+                   next;            /* The next task to be taken        */
+   pthread_mutex_t lock;
+}  SWEEPJOB;
+
+/* A thread working on a SWEEPJOB. flags has a bit for each atom        */
+typedef struct
+{
+   SWEEPJOB  *job;
+   VOXWORD   *flags;
+   pthread_t thread;
+   BOOL      started;
+}  SWEEPTHREAD;
+
+/* A feature definition. Names are packed into 4 characters; a name is
+   matched if (name & mask) == key so a wildcard has a zero mask. Atom
+   features give the properties which make an atom of interest; residue
+   features give the properties reported for a residue.
+*/
+typedef struct _feature
+{
+   struct _feature *next;
+   unsigned long   reskey, resmask,
+                   atkey,  atmask;
+   int             properties;
+   BOOL            atom;
+}  FEATURE;
+
+/* An entry in the hashed lookup of the properties of a residue and atom
+   name (atkey is 0 for residue properties). Empty if reskey is 0.
+*/
+typedef struct
+{
+   unsigned long reskey,
+                 atkey;
+   int           properties;
+}  FEATHASH;
+
+/* An entry in the hash of residues of interest. res is the residue's
+   entry in the output list (NULL if the hash entry is empty) and x, y, z
+   are the sums of the coordinates of its count atoms of interest.
+*/
+typedef struct
+{
+   PDB  *res;
+   REAL x, y, z;
+   int  count;
+}  RESHASH;
+
+/* The accessibility of a residue whose atoms are start up to (but not
+   including) stop
+*/
+typedef struct
+{
+   PDB  *start,
+        *stop;
+   REAL access,
+        relaccess;               /* Percentage or -1 if not known       */
+}  RESACCESS;
+
 /************************************************************************/
 /* Globals
 */
+REAL gProbe        = WATER,        /* Probe radius for accessibility    */
+     gMinRelAccess = DEFRELACCESS; /* Min relative access for surface   */
+int  gNThreads     = 1;            /* Threads for the sweeps            */
+REAL gBinSize      = 0.0;          /* Bin size for binary files (0: none)*/
+REAL gPatchRadius  = 0.0;          /* Radius of patches for -P (0: none)*/
+FEATURE  *gFeatures    = NULL;     /* Feature definitions               */
+FEATHASH *gFeatHash    = NULL;     /* Lookup of features by name        */
+int      gFeatHashSize = 0,
+         gFeatHashUsed = 0;
+
+/* The default features. Each line is
+      ATOM resnam atnam properties   or   RESIDUE resnam properties
+   where properties is a string of 0s and 1s in the order of the 
+   PROP_ values in properties.h, a resnam of * matches any residue and
+   an atnam ending in * matches any atom name starting with the 
+   preceding characters.
+*/
+static char *sDefaultFeatures[] =
+{
+   "ATOM    GLU OE*  01001",
+   "ATOM    ASP OD*  01001",
+   "ATOM    ARG NE*  10001",
+   "ATOM    ARG CZ*  10001",
+   "ATOM    ARG NH*  10001",
+   "ATOM    LYS NZ*  10001",
+   "ATOM    PHE CG*  00110",
+   "ATOM    PHE CD*  00110",
+   "ATOM    PHE CE*  00110",
+   "ATOM    PHE CZ*  00110",
+   "ATOM    TYR CG*  00101",
+   "ATOM    TYR CD*  00101",
+   "ATOM    TYR CE*  00101",
+   "ATOM    TYR CZ*  00101",
+   "ATOM    TRP CD*  00110",
+   "ATOM    TRP NE*  00110",
+   "ATOM    TRP CE*  00110",
+   "ATOM    TRP CZ*  00110",
+   "ATOM    TRP CH*  00110",
+   "ATOM    HIS ND1* 10001",
+   "ATOM    HIS NE2* 10001",
+   "ATOM    *   P    01000",
+   "ATOM    ASN OD1* 00001",
+   "ATOM    ASN ND2* 00001",
+   "ATOM    GLN OE1* 00001",
+   "ATOM    GLN NE1* 00001",
+   "ATOM    SER OG*  00001",
+   "ATOM    THR OG1* 00001",
+   "ATOM    ILE CB*  00010",
+   "ATOM    ILE CG*  00010",
+   "ATOM    ILE CD*  00010",
+   "ATOM    LEU CB*  00010",
+   "ATOM    LEU CG*  00010",
+   "ATOM    LEU CD*  00010",
+   "ATOM    VAL CB*  00010",
+   "ATOM    VAL CG*  00010",
+   "RESIDUE ASP      01001",
+   "RESIDUE GLU      01001",
+   "RESIDUE A        01000",
+   "RESIDUE T        01000",
+   "RESIDUE C        01000",
+   "RESIDUE G        01000",
+   "RESIDUE LYS      10001",
+   "RESIDUE ARG      10001",
+   "RESIDUE HIS      10001",
+   "RESIDUE PHE      00110",
+   "RESIDUE TYR      00101",
+   "RESIDUE TRP      00110",
+   "RESIDUE ILE      00010",
+   "RESIDUE LEU      00010",
+   "RESIDUE VAL      00010",
+   "RESIDUE ASN      00001",
+   "RESIDUE GLN      00001",
+   "RESIDUE SER      00001",
+   "RESIDUE THR      00001",
+   NULL
+};
+
+/* Van der Waals radii by element                                       */
+static char *sElements = "CNOSPH";
+static REAL sRadii[]   = {1.87, 1.65, 1.40, 1.85, 1.90, 1.20};
+
+/* Accessibility of each amino acid in an Ala-X-Ala tripeptide with a 
+   1.4A probe (as used by NACCESS)
+*/
+static char *sStdResnam[] = {"ALA", "ARG", "ASN", "ASP", "CYS", "GLN",
+                             "GLU", "GLY", "HIS", "ILE", "LEU", "LYS",
+                             "MET", "PHE", "PRO", "SER", "THR", "TRP",
+                             "TYR", "VAL", NULL};
+static REAL sStdAccess[]  = {107.95, 238.76, 143.94, 140.39, 134.28,
+                             178.50, 172.25,  80.10, 182.88, 175.12,
+                             178.63, 200.81, 194.15, 199.48, 136.13,
+                             116.50, 139.27, 249.36, 212.76, 151.44};
 
 /************************************************************************/
 /* Prototypes
@@ -96,15 +372,59 @@
 int  main(int argc, char **argv);
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
                   char *limitfile, BOOL *doSurface, BOOL *doMatrix,
-                  BOOL *philphob, BOOL *verbose);
-PDB *FindSurfaceAtoms(PDB *pdb, BOOL verbose);
+                  BOOL *philphob, BOOL *verbose, int *engine,
+                  char *atomfile, char *resfile, char *featfile,
+                  BOOL *binary, char *chains);
+PDB *FindSurfaceAtoms(PDB *pdb, int engine, BOOL verbose);
+PDB *CopyFlaggedAtoms(PDB *pdb);
+PDB *FindAccessibleAtoms(PDB *pdb, char *atomfile, char *resfile,
+                         BOOL verbose);
+BOOL CalcAtomAccess(PDB *pdb, REAL probe, BOOL verbose);
+REAL AtomRadius(PDB *p);
+REAL *CreateSpherePoints(int npoints);
+RESACCESS *CalcResidueAccess(PDB *pdb, int *nres);
+REAL StandardAccess(char *resnam);
+void WriteResidueAccess(FILE *out, RESACCESS *resacc, int nres);
+BOOL FlagSurfaceSweep(PDB *pdb, CELLLIST *cells, REAL xmin, REAL xmax,
+                      REAL ymin, REAL ymax, REAL zmin, REAL zmax,
+                      BOOL verbose);
+void *SweepThread(void *arg);
+void SweepGridLines(SWEEPJOB *job, int task, VOXWORD *flags);
+VOXWORD *CreateAtomFlags(PDB *pdb);
+void MergeAtomFlags(PDB *pdb, VOXWORD *flags);
+BOOL FlagSurfaceVoxels(PDB *pdb, CELLLIST *cells, REAL xmin, REAL xmax,
+                       REAL ymin, REAL ymax, REAL zmin, REAL zmax,
+                       BOOL verbose);
+int  CreateGridLine(REAL min, REAL max, BOOL forwards, REAL **coord);
+BOOL RasterizeAtoms(PDB *pdb, VOXELMAP *map);
+void ScanVoxelMap(PDB *pdb, CELLLIST *cells, VOXELMAP *map,
+                  VOXWORD *flags);
+void SetGridPoint(PDB *grid, VOXELMAP *map, int i, int j, int k);
+int  FirstBit(VOXWORD bits);
+BOOL ProbePoint(PDB *pdb, CELLLIST *cells, PDB *grid, VOXWORD *flags);
+CELLLIST *CreateCellList(PDB *pdb, REAL size, REAL xmin, REAL xmax,
+                         REAL ymin, REAL ymax, REAL zmin, REAL zmax);
+void FreeCellList(CELLLIST *cells);
 PDB *FindAtomsOfInterest(PDB *surface, BOOL philphob, BOOL verbose);
+RESHASH *FindResidueHash(RESHASH *hash, int hashsize, PDB *p);
 void DoDistMatrix(FILE *out, PDB *interest);
 void PrintInterestingResidues(FILE *out, PDB *interest);
+void PrintResidue(FILE *out, PDB *p);
+BOOL WritePatches(FILE *out, PDB *pdb, PDB *surface, PDB *interest,
+                  REAL radius, char *chains, BOOL verbose);
+PDB  *FindPatchCentre(PDB *pdb, PDB **from, PDB *res);
+int  CompareInts(const void *a, const void *b);
+BOOL WriteBinaryResidues(FILE *out, PDB *interest, REAL binsize);
 void Usage(void);
 PDB *SelectRanges(PDB *pdb, char *limitfile);
 void SetProperties(PDB *p, int *charge, int *aromatic, int *hydropathy);
 void SetPropertyString(PDB *p, char *properties);
+BOOL ReadFeatures(char *featfile);
+BOOL ParseFeature(char *buffer);
+unsigned long PackName(char *name, unsigned long *mask);
+int  LookupFeature(char *resnam, char *atnam);
+BOOL GrowFeatureHash(void);
+void FreeFeatures(void);
 
 
 /************************************************************************/
@@ -114,6 +434,13 @@ void SetPropertyString(PDB *p, char *properties);
 
    18.11.93 Original   By: ACRM
    19.11.93 Modified for surface flag
+   17.10.26 Added engine By: agent
+   17.10.26 Added accessibility engine and files By: agent
+   17.10.26 Added feature file By: agent
+   17.10.26 Added binary output By: agent
+   17.10.26 Added patches By: agent
+   17.10.26 Exits with 1 if the patches or binary file can't be written
+            By: agent
 */
 int main(int argc, char **argv)
 {
@@ -123,25 +450,41 @@ int main(int argc, char **argv)
         *interest = NULL;
    char infile[MAXBUFF],
         outfile[MAXBUFF],
-        limitfile[MAXBUFF];
+        limitfile[MAXBUFF],
+        atomfile[MAXBUFF],
+        resfile[MAXBUFF],
+        featfile[MAXBUFF],
+        chains[MAXBUFF];
    BOOL doSurface = TRUE,
         doMatrix  = FALSE,
         verbose   = FALSE,
-        philphob  = TRUE;
+        philphob  = TRUE,
+        binary    = FALSE;
    FILE *in       = stdin,
         *out      = stdout;
-   int  natoms;
+   int  natoms,
+        engine    = ENGINE_CELL,
+        retval    = 0;
    
 
    if(ParseCmdLine(argc, argv, infile, outfile, limitfile, &doSurface,
-                   &doMatrix, &philphob, &verbose))
+                   &doMatrix, &philphob, &verbose, &engine,
+                   atomfile, resfile, featfile, &binary, chains))
    {
+      if(!ReadFeatures(featfile))
+         return(1);
+
       if(blOpenStdFiles(infile, outfile, &in, &out))
       {
          if((pdb = blReadPDBAtoms(in, &natoms))!=NULL)
          {
-            if(doSurface) surface = FindSurfaceAtoms(pdb, verbose);
-            else          surface = pdb;
+            if(!doSurface)
+               surface = pdb;
+            else if(engine == ENGINE_SASA)
+               surface = FindAccessibleAtoms(pdb, atomfile, resfile, 
+                                             verbose);
+            else
+               surface = FindSurfaceAtoms(pdb, engine, verbose);
          
             if(surface != NULL)
             {
@@ -153,23 +496,37 @@ int main(int argc, char **argv)
                if((interest = FindAtomsOfInterest(surf, philphob, verbose))
                   != NULL)
                {
-                  if(surf != surface)
-                     FREELIST(surf, PDB);
-
-                  if(surface != pdb)
-                     FREELIST(surface, PDB);
-
 #ifdef DEBUG
                   fprintf(stderr,"\n\Interesting atom list\n");
                   WritePDB(stderr,interest);
 #endif
-                  if(doMatrix)
+                  if(gPatchRadius > (REAL)0.0)
+                  {
+                     if(!WritePatches(out, pdb, surf, interest,
+                                      gPatchRadius, chains, verbose))
+                        retval = 1;
+                  }
+                  else if(doMatrix)
+                  {
                      DoDistMatrix(out, interest);
+                  }
+                  else if(binary)
+                  {
+                     if(!WriteBinaryResidues(out, interest, gBinSize))
+                        retval = 1;
+                  }
                   else
+                  {
                      PrintInterestingResidues(out, interest);
+                  }
 
                   FREELIST(interest, PDB);
                }
+
+               if(surf != surface)
+                  FREELIST(surf, PDB);
+               if(surface != pdb)
+                  FREELIST(surface, PDB);
             }
 
             FREELIST(pdb, PDB);
@@ -183,13 +540,15 @@ int main(int argc, char **argv)
             fprintf(stderr,"Warning: No atoms read from PDB file\n");
          }
       }
+
+      FreeFeatures();
    }
    else
    {
       Usage();
    }
 
-   return(0);
+   return(retval);
 }
 
 /************************************************************************/
@@ -198,19 +557,31 @@ int main(int argc, char **argv)
    19.11.93 Added doSurface parameter and flag
    16.04.21 Rewritten
    19.04.21 Added -v
+   17.10.26 Added -e By: agent
+   17.10.26 Added -p, -t, -a, -r By: agent
+   17.10.26 Added -j By: agent
+   17.10.26 Added -f By: agent
+   17.10.26 Added -b and -d By: agent
+   17.10.26 Added -P and -c By: agent
+   17.10.26 Rejects a negative probe radius By: agent
 */
 BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
                   char *limitfile, BOOL *doSurface, BOOL *doMatrix,
-                  BOOL *philphob, BOOL *verbose)
+                  BOOL *philphob, BOOL *verbose, int *engine,
+                  char *atomfile, char *resfile, char *featfile,
+                  BOOL *binary, char *chains)
 {
    argc--;
    argv++;
    
    infile[0]  = outfile[0] = limitfile[0] = '\0';
+   atomfile[0] = resfile[0] = featfile[0] = chains[0] = '\0';
    *doSurface = TRUE;
    *philphob  = TRUE;
    *verbose   = FALSE;
    *doMatrix  = FALSE;
+   *engine    = ENGINE_CELL;
+   *binary    = FALSE;
    
    while(argc)
    {
@@ -234,6 +605,79 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
 	 case 'v':
             *verbose = TRUE;
             break;
+	 case 'e':
+            argc--; argv++;
+            if(argc == 0)
+               return(FALSE);
+            if(!strcmp(argv[0], "sweep"))
+               *engine = ENGINE_SWEEP;
+            else if(!strcmp(argv[0], "cell"))
+               *engine = ENGINE_CELL;
+            else if(!strcmp(argv[0], "voxel"))
+               *engine = ENGINE_VOXEL;
+            else if(!strcmp(argv[0], "sasa"))
+               *engine = ENGINE_SASA;
+            else
+               return(FALSE);
+            break;
+	 case 'f':
+            argc--; argv++;
+            if(argc == 0)
+               return(FALSE);
+            strcpy(featfile, argv[0]);
+            break;
+	 case 'j':
+            argc--; argv++;
+            if((argc == 0) || (sscanf(argv[0],"%d",&gNThreads) != 1) ||
+               (gNThreads < 1))
+               return(FALSE);
+            break;
+	 case 'p':
+            argc--; argv++;
+            if((argc == 0) || (sscanf(argv[0],"%lf",&gProbe) != 1) ||
+               (gProbe < 0.0))
+               return(FALSE);
+            break;
+	 case 't':
+            argc--; argv++;
+            if((argc == 0) || (sscanf(argv[0],"%lf",&gMinRelAccess) != 1))
+               return(FALSE);
+            break;
+	 case 'a':
+            argc--; argv++;
+            if(argc == 0)
+               return(FALSE);
+            strcpy(atomfile, argv[0]);
+            break;
+	 case 'r':
+            argc--; argv++;
+            if(argc == 0)
+               return(FALSE);
+            strcpy(resfile, argv[0]);
+            break;
+	 case 'b':
+            *binary = TRUE;
+            break;
+	 case 'd':
+            argc--; argv++;
+            if((argc == 0) || (sscanf(argv[0],"%lf",&gBinSize) != 1) ||
+               (gBinSize <= 0.0))
+               return(FALSE);
+            *binary = TRUE;
+            break;
+	 case 'P':
+            argc--; argv++;
+            if((argc == 0) || 
+               (sscanf(argv[0],"%lf",&gPatchRadius) != 1) ||
+               (gPatchRadius <= 0.0))
+               return(FALSE);
+            break;
+	 case 'c':
+            argc--; argv++;
+            if(argc == 0)
+               return(FALSE);
+            strcpy(chains, argv[0]);
+            break;
          default:
             return(FALSE);
             break;
@@ -259,14 +703,18 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
          }
       }
    }
+
+   /* Patches are written as text records                               */
+   if((gPatchRadius > 0.0) && (*binary || *doMatrix))
+      return(FALSE);
    
    return(TRUE);
 }
 
 
 /************************************************************************/
-/*>PDB *FindSurfaceAtoms(PDB *pdb, BOOL verbose)
-   ---------------------------------------------
+/*>PDB *FindSurfaceAtoms(PDB *pdb, int engine, BOOL verbose)
+   ---------------------------------------------------------
    Identifies surface atoms using a simple grid search along x, y and z
    axes. This is not an ideal analytical answer since it will not handle
    re-entrant surfaces correctly.
@@ -274,17 +722,26 @@ BOOL ParseCmdLine(int argc, char **argv, char *infile, char *outfile,
    atoms.
    N.B. The occ field in the PDB linked lists will no longer be valid
    since it is used as a flag by this routine.
+   The engine says whether each probe point is tested against all atoms
+   (ENGINE_SWEEP), just those in neighbouring cells (ENGINE_CELL) or 
+   whether bitmaps of the probe points are scanned (ENGINE_VOXEL). All
+   flag the same atoms.
 
    18.11.93 Original   By: ACRM
+   17.10.26 Added engine. Moved the probe test into ProbePoint(). Fixed
+            backwards search along y to stop at ymin not zmin By: agent
+   17.10.26 Moved the searches into FlagSurfaceSweep() and added
+            ENGINE_VOXEL By: agent
+   17.10.26 Moved copying the atoms into CopyFlaggedAtoms() By: agent
+   17.10.26 FlagSurfaceSweep() may now run out of memory By: agent
 */
-PDB *FindSurfaceAtoms(PDB *pdb, BOOL verbose)
+PDB *FindSurfaceAtoms(PDB *pdb, int engine, BOOL verbose)
 {
-   PDB  *surface = NULL,
-        *p,
-        *q;
-   REAL xmin, xmax, x,
-        ymin, ymax, y,
-        zmin, zmax, z;
+   PDB      *p;
+   REAL     xmin, xmax,
+            ymin, ymax,
+            zmin, zmax;
+   CELLLIST *cells   = NULL;
 
    if(verbose)
    {
@@ -323,161 +780,66 @@ PDB *FindSurfaceAtoms(PDB *pdb, BOOL verbose)
               (double)(ymax-ymin),
               (double)(zmax-zmin));
    }
-   
-   /* For each point on the x-y plane, search along the z axis          */
-   if(verbose)
-   {
-      fprintf(stderr,"Searching along z...\n");
-   }
-   
-   for(x=xmin; x<=xmax; x+=GRID)
+
+   /* Place the atoms in a cell list if required                        */
+   if((engine == ENGINE_CELL) || (engine == ENGINE_VOXEL))
    {
-      for(y=ymin; y<=ymax; y+=GRID)
+      if((cells = CreateCellList(pdb, (REAL)CELLSIZE, xmin, xmax, 
+                                 ymin, ymax, zmin, zmax)) == NULL)
       {
-         PDB grid;
-
-         grid.x = x;
-         grid.y = y;
-
-         /* Forwards on z                                               */
-         for(z=zmin; z<=zmax; z+=GRID)
-         {
-            BOOL GotHit=FALSE;
-
-            grid.z = z;
-            for(p=pdb; p!=NULL; NEXT(p))
-            {
-               if(DISTSQ(&grid, p) < WATERSQ)
- 	       {
-                  p->occ = (REAL)1.0;
-                  GotHit = TRUE;
-	       }
-	    }
-            if(GotHit) break;
-	 }
-
-         /* Backwards on z                                              */
-         for(z=zmax; z>=zmin; z-=GRID)
-         {
-            BOOL GotHit=FALSE;
-
-            grid.z = z;
-            for(p=pdb; p!=NULL; NEXT(p))
-            {
-               if(DISTSQ(&grid, p) < WATERSQ)
- 	       {
-                  p->occ = (REAL)1.0;
-                  GotHit = TRUE;
-	       }
-	    }
-            if(GotHit) break;
-	 }
+         fprintf(stderr,"No memory for cell list\n");
+         return(NULL);
+      }
+      if(verbose)
+      {
+         fprintf(stderr,"Using %d x %d x %d cell list\n",
+                 cells->nx, cells->ny, cells->nz);
       }
-   }
-
-
-   /* For each point on the x-z plane, search along the y axis          */
-   if(verbose)
-   {
-      fprintf(stderr,"Searching along y...\n");
    }
    
-   for(x=xmin; x<=xmax; x+=GRID)
+   /* Flag the surface atoms                                            */
+   if(engine == ENGINE_VOXEL)
    {
-      for(z=zmin; z<=zmax; z+=GRID)
+      if(!FlagSurfaceVoxels(pdb, cells, xmin, xmax, ymin, ymax, 
+                            zmin, zmax, verbose))
       {
-         PDB grid;
-
-         grid.x = x;
-         grid.z = z;
-
-         /* Forwards on y                                               */
-         for(y=ymin; y<=ymax; y+=GRID)
-         {
-            BOOL GotHit=FALSE;
-
-            grid.y = y;
-            for(p=pdb; p!=NULL; NEXT(p))
-            {
-               if(DISTSQ(&grid, p) < WATERSQ)
- 	       {
-                  p->occ = (REAL)1.0;
-                  GotHit = TRUE;
-	       }
-	    }
-            if(GotHit) break;
-	 }
-
-         /* Backwards on y                                              */
-         for(y=ymax; y>=zmin; y-=GRID)
-         {
-            BOOL GotHit=FALSE;
-
-            grid.y = y;
-            for(p=pdb; p!=NULL; NEXT(p))
-            {
-               if(DISTSQ(&grid, p) < WATERSQ)
- 	       {
-                  p->occ = (REAL)1.0;
-                  GotHit = TRUE;
-	       }
-	    }
-            if(GotHit) break;
-	 }
+         fprintf(stderr,"No memory for voxel maps\n");
+         FreeCellList(cells);
+         return(NULL);
       }
    }
-
-
-   /* For each point on the y-z plane, search along the x axis          */
-   if(verbose)
-   {
-      fprintf(stderr,"Searching along x...\n");
-   }
-   
-   for(y=ymin; y<=ymax; y+=GRID)
+   else
    {
-      for(z=zmin; z<=zmax; z+=GRID)
+      if(!FlagSurfaceSweep(pdb, cells, xmin, xmax, ymin, ymax, 
+                           zmin, zmax, verbose))
       {
-         PDB grid;
+         fprintf(stderr,"No memory for surface search\n");
+         FreeCellList(cells);
+         return(NULL);
+      }
+   }
 
-         grid.z = z;
-         grid.y = y;
+   FreeCellList(cells);
 
-         /* Forwards on x                                               */
-         for(x=xmin; x<=xmax; x+=GRID)
-         {
-            BOOL GotHit=FALSE;
+   /* Now copy the flagged atoms into an output linked list             */
+   return(CopyFlaggedAtoms(pdb));
+}
 
-            grid.x = x;
-            for(p=pdb; p!=NULL; NEXT(p))
-            {
-               if(DISTSQ(&grid, p) < WATERSQ)
- 	       {
-                  p->occ = (REAL)1.0;
-                  GotHit = TRUE;
-	       }
-	    }
-            if(GotHit) break;
-	 }
 
-         /* Backwards on x                                              */
-         for(x=xmax; x>=xmin; x-=GRID)
-         {
-            BOOL GotHit=FALSE;
+/************************************************************************/
+/*>PDB *CopyFlaggedAtoms(PDB *pdb)
+   --------------------------------
+   Copies the atoms whose occ field is non-zero into a new linked list.
+   Returns NULL if there are none or there is no memory.
 
-            grid.x = x;
-            for(p=pdb; p!=NULL; NEXT(p))
-            {
-               if(DISTSQ(&grid, p) < WATERSQ)
- 	       {
-                  p->occ = (REAL)1.0;
-                  GotHit = TRUE;
-	       }
-	    }
-            if(GotHit) break;
-	 }
-      }
-   }
+   18.11.93 Original   By: ACRM
+   17.10.26 Moved out of FindSurfaceAtoms() By: agent
+*/
+PDB *CopyFlaggedAtoms(PDB *pdb)
+{
+   PDB *surface = NULL,
+       *p,
+       *q       = NULL;
 
    /* Now copy the flagged atoms into an output linked list             */
    for(p=pdb; p!=NULL; NEXT(p))
@@ -511,210 +873,1301 @@ PDB *FindSurfaceAtoms(PDB *pdb, BOOL verbose)
 
 
 /************************************************************************/
-/*>PDB *FindAtomsOfInterest(PDB *surface, BOOL philphob, BOOL verbose)
-   -------------------------------------------------------------------
-   Searches a PDB linked list for all charged atoms and returns a PDB 
-   linked list containing only those atoms.
-   This could be improved to read the atoms of interest from a file
-   for more flexibility. At the moment, we just stick with charged
-   atoms.
-
-   18.11.93 Original   By: ACRM
-   22.11.93 Added aromatics
-   19.05.94 Added phosphate for DNA
-   20.04.21 Added philphob and verbose
+/*>PDB *FindAccessibleAtoms(PDB *pdb, char *atomfile, char *resfile,
+                              BOOL verbose)
+   -----------------------------------------------------------------
+   An alternative to FindSurfaceAtoms(). Calculates the solvent 
+   accessibility of each atom and residue and returns a linked list of 
+   the atoms in residues whose relative accessibility is more than 
+   gMinRelAccess. Residues with no standard accessibility are included 
+   if they have any accessible area. If atomfile is specified, the atoms
+   are written to it in PDB format with the accessibility in the B-value
+   column and the radius in the occupancy column. If resfile is 
+   specified, the accessibility of each residue is written to it.
+   N.B. The occ and bval fields in the PDB linked list will no longer be
+   valid.
+
+   17.10.26 Original   By: agent
 */
-PDB *FindAtomsOfInterest(PDB *surface, BOOL philphob, BOOL verbose)
+PDB *FindAccessibleAtoms(PDB *pdb, char *atomfile, char *resfile,
+                         BOOL verbose)
 {
-   PDB *interest = NULL,
-       *CurrInt  = NULL,
-       *p,
-       *q;
+   RESACCESS *resacc;
+   PDB       *p;
+   FILE      *fp;
+   int       nres,
+             i;
+   BOOL      accessible;
 
    if(verbose)
    {
-      fprintf(stderr,"Finding atoms of interest on the surface...\n");
+      fprintf(stderr,"Calculating accessibility with a %.2f Angstrom \
+probe\n", (double)gProbe);
    }
 
-   /* We use occ as a flag to indicate interesting atoms                */
-   D("Clearing occ flag\n");
-   for(p=surface; p!=NULL; NEXT(p))
-      p->occ = 0.0;
-
-   D("Finding charged and aromatic residues\n");
-   for(p=surface; p!=NULL; NEXT(p))
+   if(!CalcAtomAccess(pdb, gProbe, verbose) ||
+      ((resacc = CalcResidueAccess(pdb, &nres)) == NULL))
    {
-      if(!strncmp(p->resnam,"GLU",3) && !strncmp(p->atnam,"OE",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"ASP",3) && !strncmp(p->atnam,"OD",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"ARG",3) && !strncmp(p->atnam,"NE",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"ARG",3) && !strncmp(p->atnam,"CZ",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"ARG",3) && !strncmp(p->atnam,"NH",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"LYS",3) && !strncmp(p->atnam,"NZ",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"PHE",3) && !strncmp(p->atnam,"CG",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"PHE",3) && !strncmp(p->atnam,"CD",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"PHE",3) && !strncmp(p->atnam,"CE",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"PHE",3) && !strncmp(p->atnam,"CZ",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"TYR",3) && !strncmp(p->atnam,"CG",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"TYR",3) && !strncmp(p->atnam,"CD",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"TYR",3) && !strncmp(p->atnam,"CE",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"TYR",3) && !strncmp(p->atnam,"CZ",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"TRP",3) && !strncmp(p->atnam,"CD",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"TRP",3) && !strncmp(p->atnam,"NE",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"TRP",3) && !strncmp(p->atnam,"CE",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"TRP",3) && !strncmp(p->atnam,"CZ",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"TRP",3) && !strncmp(p->atnam,"CH",2))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"HIS",3) && !strncmp(p->atnam,"ND1",3))
-         p->occ = 1.0;
-      if(!strncmp(p->resnam,"HIS",3) && !strncmp(p->atnam,"NE2",3))
-         p->occ = 1.0;
-      if(!strncmp(p->atnam,"P ",2))
-         p->occ = 1.0;
+      fprintf(stderr,"No memory for accessibility calculation\n");
+      return(NULL);
+   }
 
-      if(philphob)
-      {
-         /* Hydrophilic                                                 */
-         if(!strncmp(p->resnam,"ASN",3) && !strncmp(p->atnam,"OD1",3))
-            p->occ = 1.0;
-         if(!strncmp(p->resnam,"ASN",3) && !strncmp(p->atnam,"ND2",3))
-            p->occ = 1.0;
-         if(!strncmp(p->resnam,"GLN",3) && !strncmp(p->atnam,"OE1",3))
-            p->occ = 1.0;
-         if(!strncmp(p->resnam,"GLN",3) && !strncmp(p->atnam,"NE1",3))
-            p->occ = 1.0;
-         if(!strncmp(p->resnam,"SER",3) && !strncmp(p->atnam,"OG",2))
-            p->occ = 1.0;
-         if(!strncmp(p->resnam,"THR",3) && !strncmp(p->atnam,"OG1",3))
-            p->occ = 1.0;
-         /* Hydrophobic                                                 */
-         if(!strncmp(p->resnam,"ILE",3) && !strncmp(p->atnam,"CB",2))
-            p->occ = 1.0;
-         if(!strncmp(p->resnam,"ILE",3) && !strncmp(p->atnam,"CG",2))
-            p->occ = 1.0;
-         if(!strncmp(p->resnam,"ILE",3) && !strncmp(p->atnam,"CD",2))
-            p->occ = 1.0;
-         if(!strncmp(p->resnam,"LEU",3) && !strncmp(p->atnam,"CB",2))
-            p->occ = 1.0;
-         if(!strncmp(p->resnam,"LEU",3) && !strncmp(p->atnam,"CG",2))
-            p->occ = 1.0;
-         if(!strncmp(p->resnam,"LEU",3) && !strncmp(p->atnam,"CD",2))
-            p->occ = 1.0;
-         if(!strncmp(p->resnam,"VAL",3) && !strncmp(p->atnam,"CB",2))
-            p->occ = 1.0;
-         if(!strncmp(p->resnam,"VAL",3) && !strncmp(p->atnam,"CG",2))
-            p->occ = 1.0;
+   /* Write the atom and residue accessibilities if required            */
+   if(atomfile[0])
+   {
+      if((fp = fopen(atomfile, "w")) == NULL)
+      {
+         fprintf(stderr,"Unable to write atom accessibility file: %s\n",
+                 atomfile);
+      }
+      else
+      {
+         blWritePDB(fp, pdb);
+         fclose(fp);
       }
    }
-
-   /* Now we copy this list, but include only one entry for each residue*/
-   for(p=surface; p!=NULL; NEXT(p))
+   if(resfile[0])
    {
-      if(p->occ != 0.0)
+      if((fp = fopen(resfile, "w")) == NULL)
       {
-         BOOL ResFound = FALSE;
+         fprintf(stderr,"Unable to write residue accessibility file: \
+%s\n", resfile);
+      }
+      else
+      {
+         WriteResidueAccess(fp, resacc, nres);
+         fclose(fp);
+      }
+   }
+
+   /* Flag the atoms in accessible residues                             */
+   for(i=0; i<nres; i++)
+   {
+      if(resacc[i].relaccess < (REAL)0.0)
+         accessible = (resacc[i].access > (REAL)0.0);
+      else
+         accessible = (resacc[i].relaccess > gMinRelAccess);
+
+      for(p=resacc[i].start; p!=resacc[i].stop; NEXT(p))
+         p->occ = accessible ? (REAL)1.0 : (REAL)0.0;
+   }
+   free(resacc);
+
+   return(CopyFlaggedAtoms(pdb));
+}
+
+
+/************************************************************************/
+/*>BOOL CalcAtomAccess(PDB *pdb, REAL probe, BOOL verbose)
+   -------------------------------------------------------
+   Calculates the solvent accessible area of each atom using the Shrake
+   and Rupley method. NSPHEREPOINTS points are placed on the expanded
+   sphere around each atom and the fraction not inside the expanded
+   sphere of any neighbour gives the accessible fraction. The neighbours 
+   are found using a cell list and stored as separate coordinate arrays
+   so that they can be tested SASABLOCK at a time in a loop which the
+   compiler can vectorize. The block which last buried a point is tried
+   first for the next point.
+   The accessibility is placed in bval and the radius in occ. Returns 
+   FALSE if there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+BOOL CalcAtomAccess(PDB *pdb, REAL probe, BOOL verbose)
+{
+   PDB      *p, *q,
+            **idx     = NULL;
+   CELLLIST *cells    = NULL;
+   REAL     *sphere   = NULL,
+            *nx       = NULL,
+            *ny       = NULL,
+            *nz       = NULL,
+            *nr2      = NULL,
+            min[3], max[3],
+            maxrad    = (REAL)0.0,
+            size, rad, sumrad,
+            px, py, pz;
+   int      natoms,
+            nnbr, npoint, last,
+            i, k, l, end, c,
+            ix, iy, iz, cx, cy, cz;
+   BOOL     buried;
+
+   if(pdb == NULL)
+      return(TRUE);
+
+   /* Set the radii and find the bounds of the atoms                    */
+   min[0] = max[0] = pdb->x;
+   min[1] = max[1] = pdb->y;
+   min[2] = max[2] = pdb->z;
+   for(p=pdb; p!=NULL; NEXT(p))
+   {
+      p->occ = AtomRadius(p);
+      maxrad = MAX(maxrad, p->occ);
+      min[0] = MIN(min[0], p->x);   max[0] = MAX(max[0], p->x);
+      min[1] = MIN(min[1], p->y);   max[1] = MAX(max[1], p->y);
+      min[2] = MIN(min[2], p->z);   max[2] = MAX(max[2], p->z);
+   }
 
-         /* See if this residue has been flagged already                */
-         if(interest != NULL)
+   /* Cells this size mean overlapping atoms are in neighbouring cells  */
+   size = (REAL)2.0 * (maxrad + probe);
+
+   idx    = blIndexPDB(pdb, &natoms);
+   cells  = CreateCellList(pdb, size, min[0], max[0], min[1], max[1],
+                           min[2], max[2]);
+   sphere = CreateSpherePoints(NSPHEREPOINTS);
+   nx     = (REAL *)malloc(natoms * sizeof(REAL));
+   ny     = (REAL *)malloc(natoms * sizeof(REAL));
+   nz     = (REAL *)malloc(natoms * sizeof(REAL));
+   nr2    = (REAL *)malloc(natoms * sizeof(REAL));
+
+   if((idx == NULL) || (cells == NULL) || (sphere == NULL) ||
+      (nx == NULL) || (ny == NULL) || (nz == NULL) || (nr2 == NULL))
+   {
+      FREE(idx);
+      FreeCellList(cells);
+      FREE(sphere);
+      FREE(nx);
+      FREE(ny);
+      FREE(nz);
+      FREE(nr2);
+      return(FALSE);
+   }
+
+   if(verbose)
+   {
+      fprintf(stderr,"Using %d x %d x %d cell list for %d atoms\n",
+              cells->nx, cells->ny, cells->nz, natoms);
+   }
+
+   for(i=0; i<natoms; i++)
+   {
+      p   = idx[i];
+      rad = p->occ + probe;
+
+      /* Collect the neighbours whose expanded spheres overlap          */
+      cx = (int)((p->x - cells->xmin) / cells->size);
+      cy = (int)((p->y - cells->ymin) / cells->size);
+      cz = (int)((p->z - cells->zmin) / cells->size);
+      nnbr = 0;
+      for(ix=MAX(cx-1, 0); ix<=MIN(cx+1, cells->nx-1); ix++)
+      {
+         for(iy=MAX(cy-1, 0); iy<=MIN(cy+1, cells->ny-1); iy++)
          {
-            D("Searching for this residue found already\n");
-            for(q=interest; q!=NULL; NEXT(q))
+            for(iz=MAX(cz-1, 0); iz<=MIN(cz+1, cells->nz-1); iz++)
             {
-               if(q->resnum    == p->resnum    && 
-                  q->insert[0] == p->insert[0] &&
-                  q->chain[0]  == p->chain[0])
+               c = (ix * cells->ny + iy) * cells->nz + iz;
+               for(k=cells->start[c]; k<cells->start[c+1]; k++)
                {
-                  /* Yes, it's been found before so shift CofG          */
-                  D("   YES: updating CofG\n");
-
-                  q->x *= q->occ;
-                  q->x += p->x;
-                  (q->occ) += (REAL)1.0;
-                  q->x /= q->occ;
-
-                  q->y *= q->occ;
-                  q->y += p->y;
-                  (q->occ) += (REAL)1.0;
-                  q->y /= q->occ;
-
-                  q->z *= q->occ;
-                  q->z += p->z;
-                  (q->occ) += (REAL)1.0;
-                  q->z /= q->occ;
-
-                  ResFound = TRUE;
-                  break;
+                  q      = cells->atom[k];
+                  sumrad = rad + q->occ + probe;
+                  if((q != p) && (DISTSQ(p, q) < sumrad * sumrad))
+                  {
+                     nx[nnbr]  = q->x;
+                     ny[nnbr]  = q->y;
+                     nz[nnbr]  = q->z;
+                     nr2[nnbr] = (q->occ + probe) * (q->occ + probe);
+                     nnbr++;
+                  }
                }
             }
          }
+      }
 
-         /* If not found, then add to the list                          */
-         if(!ResFound)
-	 {
-            D("   Not Found: adding to list\n");
+      /* Count the sphere points not buried by a neighbour              */
+      npoint = 0;
+      last   = 0;
+      for(k=0; k<NSPHEREPOINTS; k++)
+      {
+         px = p->x + rad * sphere[3*k];
+         py = p->y + rad * sphere[3*k+1];
+         pz = p->z + rad * sphere[3*k+2];
 
-            if(interest == NULL)
+         buried = FALSE;
+         for(l=0; !buried && (l<nnbr); l+=SASABLOCK)
+         {
+            /* Try the block that buried the last point first           */
+            int block = (l == 0) ? last : ((l == last) ? 0 : l),
+                hit   = 0,
+                n;
+
+            end = MIN(block + SASABLOCK, nnbr);
+            for(n=block; n<end; n++)
             {
-               INIT(interest,PDB);
-               CurrInt = interest;
+               REAL dx = nx[n] - px,
+                    dy = ny[n] - py,
+                    dz = nz[n] - pz;
+               hit |= ((dx*dx + dy*dy + dz*dz) < nr2[n]);
             }
-            else
+            if(hit)
             {
-               ALLOCNEXT(CurrInt,PDB);
-            }
-
-            if(CurrInt==NULL)
-	    {
-               if(interest!=NULL) FREELIST(interest,PDB);
-               fprintf(stderr,"No memory for charged atom list\n");
-               return(NULL);
+               buried = TRUE;
+               last   = block;
             }
+         }
 
-            blCopyPDB(CurrInt,p);
-            /* Use occ to store a count of number of times this residue
-               has been found.
-            */
-            CurrInt->occ = (REAL)1.0;
-	 }
+         if(!buried) npoint++;
       }
+
+      p->bval = (REAL)4.0 * PI * rad * rad * 
+                (REAL)npoint / (REAL)NSPHEREPOINTS;
    }
-   return(interest);
+
+   free(idx);
+   FreeCellList(cells);
+   free(sphere);
+   free(nx);
+   free(ny);
+   free(nz);
+   free(nr2);
+
+   return(TRUE);
 }
 
 
 /************************************************************************/
-/*>void DoDistMatrix(FILE *out, PDB *interest)
-   --------------------------------
-   Calculate a distance matrix for all the atoms in the input PDB linked
-   list. Print this to stdout.
+/*>REAL AtomRadius(PDB *p)
+   -----------------------
+   Returns the van der Waals radius of an atom based on the element given
+   by the first letter of the atom name
 
-   18.11.93 Original   By: ACRM
+   17.10.26 Original   By: agent
 */
-void DoDistMatrix(FILE *out, PDB *interest)
+REAL AtomRadius(PDB *p)
 {
-   PDB *p, *q;
+   char *elem,
+        *atnam = p->atnam;
 
-   D("Entered DoDistMatrix\n");
+   /* Skip any leading spaces or digits (e.g. 1HB)                      */
+   while(*atnam && ((*atnam == ' ') || ((*atnam >= '0') && 
+                                          (*atnam <= '9'))))
+      atnam++;
 
-   for(p=interest; p!=NULL; NEXT(p))
-   {
+   if(*atnam && ((elem = strchr(sElements, *atnam)) != NULL))
+      return(sRadii[elem - sElements]);
+
+   return((REAL)DEFRADIUS);
+}
+
+
+/************************************************************************/
+/*>REAL *CreateSpherePoints(int npoints)
+   -------------------------------------
+   Creates an array of x,y,z coordinates of points spread evenly over a
+   unit sphere using a golden section spiral. Returns NULL if there is no
+   memory.
+
+   17.10.26 Original   By: agent
+*/
+REAL *CreateSpherePoints(int npoints)
+{
+   REAL *sphere,
+        inc = PI * ((REAL)3.0 - sqrt((REAL)5.0)),
+        y, r, phi;
+   int  k;
+
+   if((sphere = (REAL *)malloc(3 * npoints * sizeof(REAL))) == NULL)
+      return(NULL);
+
+   for(k=0; k<npoints; k++)
+   {
+      y   = (REAL)1.0 - ((REAL)(2 * k + 1) / (REAL)npoints);
+      r   = sqrt((REAL)1.0 - y * y);
+      phi = (REAL)k * inc;
+      sphere[3*k]   = r * cos(phi);
+      sphere[3*k+1] = y;
+      sphere[3*k+2] = r * sin(phi);
+   }
+
+   return(sphere);
+}
+
+
+/************************************************************************/
+/*>RESACCESS *CalcResidueAccess(PDB *pdb, int *nres)
+   -------------------------------------------------
+   Sums the atom accessibilities (in bval) for each residue and 
+   calculates the relative accessibility where the residue type has a 
+   standard accessibility. Returns NULL if there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+RESACCESS *CalcResidueAccess(PDB *pdb, int *nres)
+{
+   RESACCESS *resacc;
+   PDB       *p,
+             *start,
+             *stop;
+   REAL      std;
+   int       maxres = 0;
+
+   /* Count the residues                                                */
+   for(start=pdb; start!=NULL; start=stop)
+   {
+      stop = blFindNextResidue(start);
+      maxres++;
+   }
+
+   if((resacc = (RESACCESS *)malloc((maxres ? maxres : 1) * 
+                                    sizeof(RESACCESS))) == NULL)
+      return(NULL);
+
+   *nres = 0;
+   for(start=pdb; start!=NULL; start=stop)
+   {
+      stop = blFindNextResidue(start);
+
+      resacc[*nres].start  = start;
+      resacc[*nres].stop   = stop;
+      resacc[*nres].access = (REAL)0.0;
+      for(p=start; p!=stop; NEXT(p))
+         resacc[*nres].access += p->bval;
+
+      if((std = StandardAccess(start->resnam)) > (REAL)0.0)
+         resacc[*nres].relaccess = (REAL)100.0 * 
+                                   resacc[*nres].access / std;
+      else
+         resacc[*nres].relaccess = (REAL)(-1.0);
+
+      (*nres)++;
+   }
+
+   return(resacc);
+}
+
+
+/************************************************************************/
+/*>REAL StandardAccess(char *resnam)
+   ---------------------------------
+   Returns the accessibility of a residue type in an Ala-X-Ala 
+   tripeptide or -1 if it is not a standard amino acid
+
+   17.10.26 Original   By: agent
+*/
+REAL StandardAccess(char *resnam)
+{
+   int i;
+
+   for(i=0; sStdResnam[i]!=NULL; i++)
+   {
+      if(!strncmp(resnam, sStdResnam[i], 3))
+         return(sStdAccess[i]);
+   }
+   return((REAL)(-1.0));
+}
+
+
+/************************************************************************/
+/*>void WriteResidueAccess(FILE *out, RESACCESS *resacc, int nres)
+   ---------------------------------------------------------------
+   Writes the residue name, residue identifier, accessibility and 
+   relative accessibility (-1 if not known) for each residue
+
+   17.10.26 Original   By: agent
+*/
+void WriteResidueAccess(FILE *out, RESACCESS *resacc, int nres)
+{
+   int  i;
+   char resid[32];
+
+   for(i=0; i<nres; i++)
+   {
+      MAKERESID(resid, resacc[i].start);
+      fprintf(out, "%s %-5s %8.3f %8.3f\n",
+              resacc[i].start->resnam, resid,
+              resacc[i].access, resacc[i].relaccess);
+   }
+}
+
+
+/************************************************************************/
+/*>BOOL FlagSurfaceSweep(PDB *pdb, CELLLIST *cells, 
+                          REAL xmin, REAL xmax, REAL ymin, REAL ymax,
+                          REAL zmin, REAL zmax, BOOL verbose)
+   ---------------------------------------------------------------
+   Searches along grid lines parallel to each axis in both directions
+   through the box, setting the occ flag of the atoms within the water
+   radius of the first probe point which hits anything. cells may be 
+   NULL (see ProbePoint()). 
+   The searches are shared between gNThreads threads (including this
+   one). Each thread flags atoms in its own bitmap and these are merged 
+   into the occ flags at the end. Returns FALSE if there is no memory.
+
+   18.11.93 Original   By: ACRM
+   17.10.26 Moved out of FindSurfaceAtoms() By: agent
+   17.10.26 Split the searches into tasks shared between threads By: agent
+*/
+BOOL FlagSurfaceSweep(PDB *pdb, CELLLIST *cells, REAL xmin, REAL xmax,
+                      REAL ymin, REAL ymax, REAL zmin, REAL zmax,
+                      BOOL verbose)
+{
+   SWEEPJOB    job;
+   SWEEPTHREAD *threads;
+   int         a, t;
+   BOOL        ok = TRUE;
+
+   if(verbose)
+   {
+      fprintf(stderr,"Searching along z, y and x using %d thread%s...\n",
+              gNThreads, (gNThreads==1)?"":"s");
+   }
+
+   job.pdb    = pdb;
+   job.cells  = cells;
+   job.min[0] = xmin;   job.max[0] = xmax;
+   job.min[1] = ymin;   job.max[1] = ymax;
+   job.min[2] = zmin;   job.max[2] = zmax;
+   job.next   = 0;
+   for(a=0; a<3; a++)
+   {
+      job.nline[a] = CreateGridLine(job.min[a], job.max[a], TRUE, 
+                                    &(job.line[a]));
+      if(job.line[a] == NULL) ok = FALSE;
+   }
+   /* Searches along z and y run over x; searches along x run over y    */
+   job.ntask  = 2 * job.nline[0] + job.nline[1];
+
+   if((threads = (SWEEPTHREAD *)calloc(gNThreads, sizeof(SWEEPTHREAD)))
+      == NULL)
+      ok = FALSE;
+
+   for(t=0; ok && (t<gNThreads); t++)
+   {
+      threads[t].job = &job;
+      if((threads[t].flags = CreateAtomFlags(pdb)) == NULL)
+         ok = FALSE;
+   }
+
+   if(ok)
+   {
+      pthread_mutex_init(&(job.lock), NULL);
+
+      /* Start the other threads. If any can't be started, the tasks are
+         just shared between fewer threads
+      */
+      for(t=1; t<gNThreads; t++)
+      {
+         threads[t].started = 
+            !pthread_create(&(threads[t].thread), NULL, SweepThread, 
+                            (void *)&(threads[t]));
+      }
+      SweepThread((void *)&(threads[0]));
+
+      for(t=1; t<gNThreads; t++)
+      {
+         if(threads[t].started)
+            pthread_join(threads[t].thread, NULL);
+      }
+      pthread_mutex_destroy(&(job.lock));
+
+      for(t=0; t<gNThreads; t++)
+         MergeAtomFlags(pdb, threads[t].flags);
+   }
+
+   if(threads != NULL)
+   {
+      for(t=0; t<gNThreads; t++)
+         FREE(threads[t].flags);
+      free(threads);
+   }
+   for(a=0; a<3; a++)
+      FREE(job.line[a]);
+
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>void *SweepThread(void *arg)
+   -----------------------------
+   Thread function for FlagSurfaceSweep(). Takes tasks from the 
+   SWEEPJOB until there are none left, flagging atoms in the thread's 
+   own bitmap. arg is a SWEEPTHREAD.
+
+   17.10.26 Original   By: agent
+*/
+void *SweepThread(void *arg)
+{
+   SWEEPTHREAD *thread = (SWEEPTHREAD *)arg;
+   SWEEPJOB    *job    = thread->job;
+   int         task;
+
+   for(;;)
+   {
+      pthread_mutex_lock(&(job->lock));
+      task = job->next++;
+      pthread_mutex_unlock(&(job->lock));
+
+      if(task >= job->ntask)
+         break;
+      
+      SweepGridLines(job, task, thread->flags);
+   }
+
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>void SweepGridLines(SWEEPJOB *job, int task, VOXWORD *flags)
+   -------------------------------------------------------------
+   Does one task of a SWEEPJOB. The first nline[0] tasks search along z 
+   for each x, the next nline[0] search along y for each x and the last
+   nline[1] search along x for each y. Each grid line is searched
+   forwards and backwards, stepping exactly as the original loops did.
+
+   18.11.93 Original   By: ACRM
+   17.10.26 Moved out of FindSurfaceAtoms() and split into tasks By: agent
+*/
+void SweepGridLines(SWEEPJOB *job, int task, VOXWORD *flags)
+{
+   PDB  grid;
+   REAL pos[3],
+        v;
+   int  search, i, j,
+        outer, inner, along;
+   /* For each search, the outer, inner and search axes                 */
+   static int axes[3][3] = {{0, 1, 2},    /* Along z                    */
+                            {0, 2, 1},    /* Along y                    */
+                            {1, 2, 0}};   /* Along x                    */
+
+   if(task < job->nline[0])
+   {
+      search = 0;
+      i      = task;
+   }
+   else if(task < 2 * job->nline[0])
+   {
+      search = 1;
+      i      = task - job->nline[0];
+   }
+   else
+   {
+      search = 2;
+      i      = task - 2 * job->nline[0];
+   }
+   outer = axes[search][0];
+   inner = axes[search][1];
+   along = axes[search][2];
+
+   pos[outer] = job->line[outer][i];
+   for(j=0; j<job->nline[inner]; j++)
+   {
+      pos[inner] = job->line[inner][j];
+
+      /* Forwards                                                       */
+      for(v=job->min[along]; v<=job->max[along]; v+=GRID)
+      {
+         pos[along] = v;
+         grid.x     = pos[0];
+         grid.y     = pos[1];
+         grid.z     = pos[2];
+         if(ProbePoint(job->pdb, job->cells, &grid, flags)) break;
+      }
+
+      /* Backwards                                                      */
+      for(v=job->max[along]; v>=job->min[along]; v-=GRID)
+      {
+         pos[along] = v;
+         grid.x     = pos[0];
+         grid.y     = pos[1];
+         grid.z     = pos[2];
+         if(ProbePoint(job->pdb, job->cells, &grid, flags)) break;
+      }
+   }
+}
+
+
+/************************************************************************/
+/*>VOXWORD *CreateAtomFlags(PDB *pdb)
+   ----------------------------------
+   Allocates a cleared bitmap with a bit for each atom in the linked 
+   list. Returns NULL if there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+VOXWORD *CreateAtomFlags(PDB *pdb)
+{
+   PDB *p;
+   int natoms = 0;
+
+   for(p=pdb; p!=NULL; NEXT(p))
+      natoms++;
+
+   return((VOXWORD *)calloc(MAX((natoms + VOXBITS - 1) / VOXBITS, 1),
+                            sizeof(VOXWORD)));
+}
+
+
+/************************************************************************/
+/*>void MergeAtomFlags(PDB *pdb, VOXWORD *flags)
+   ----------------------------------------------
+   Sets the occ flag of each atom whose bit is set in the bitmap
+
+   17.10.26 Original   By: agent
+*/
+void MergeAtomFlags(PDB *pdb, VOXWORD *flags)
+{
+   PDB *p;
+   int i;
+
+   for(p=pdb, i=0; p!=NULL; NEXT(p), i++)
+   {
+      if(flags[i / VOXBITS] & ((VOXWORD)1 << (i % VOXBITS)))
+         p->occ = (REAL)1.0;
+   }
+}
+
+
+/************************************************************************/
+/*>BOOL FlagSurfaceVoxels(PDB *pdb, CELLLIST *cells, 
+                           REAL xmin, REAL xmax, REAL ymin, REAL ymax,
+                           REAL zmin, REAL zmax, BOOL verbose)
+   ---------------------------------------------------------------
+   Does the same searches as FlagSurfaceSweep() using exactly the same
+   probe points. For each search direction, the probe points within the 
+   water radius of any atom are rasterized into a VOXELMAP. Each search 
+   along a grid line is then a scan for the first set bit. Only the 
+   probe point where the bit is found is tested against the atoms (using
+   the cell list) to set the occ flags. Returns FALSE if there is no 
+   memory.
+
+   The forwards and backwards searches start from opposite corners of
+   the box so use different grid points unless the box is a whole number
+   of grid steps; each direction has its own map.
+
+   17.10.26 Original   By: agent
+   17.10.26 Atoms are flagged in a bitmap By: agent
+*/
+BOOL FlagSurfaceVoxels(PDB *pdb, CELLLIST *cells, REAL xmin, REAL xmax,
+                       REAL ymin, REAL ymax, REAL zmin, REAL zmax,
+                       BOOL verbose)
+{
+   VOXWORD  *flags;
+   REAL     *line[3][2];
+   int      nline[3][2],
+            search, a, b;
+   BOOL     ok = TRUE;
+   VOXELMAP map;
+   /* For each search, the coordinate axes of the map axes              */
+   static int axes[3][3] = {{0, 1, 2},    /* Along z                    */
+                            {0, 2, 1},    /* Along y                    */
+                            {1, 2, 0}};   /* Along x                    */
+   static char *axisName = "xyz";
+
+   /* Create the forwards and backwards grid lines along each axis      */
+   nline[0][0] = CreateGridLine(xmin, xmax, TRUE,  &(line[0][0]));
+   nline[0][1] = CreateGridLine(xmin, xmax, FALSE, &(line[0][1]));
+   nline[1][0] = CreateGridLine(ymin, ymax, TRUE,  &(line[1][0]));
+   nline[1][1] = CreateGridLine(ymin, ymax, FALSE, &(line[1][1]));
+   nline[2][0] = CreateGridLine(zmin, zmax, TRUE,  &(line[2][0]));
+   nline[2][1] = CreateGridLine(zmin, zmax, FALSE, &(line[2][1]));
+
+   for(a=0; a<3; a++)
+   {
+      for(b=0; b<2; b++)
+      {
+         if(line[a][b] == NULL) ok = FALSE;
+      }
+   }
+   if((flags = CreateAtomFlags(pdb)) == NULL)
+      ok = FALSE;
+
+   /* The grid lines across the search always run forwards; the search
+      itself runs forwards then backwards
+   */
+   for(search=0; ok && (search<3); search++)
+   {
+      if(verbose)
+      {
+         fprintf(stderr,"Searching along %c...\n", 
+                 axisName[axes[search][2]]);
+      }
+
+      for(b=0; ok && (b<2); b++)
+      {
+         for(a=0; a<3; a++)
+         {
+            map.axis[a]  = axes[search][a];
+            map.coord[a] = line[map.axis[a]][(a==2)?b:0];
+            map.n[a]     = nline[map.axis[a]][(a==2)?b:0];
+            map.step[a]  = ((a==2) && b) ? -GRID : GRID;
+         }
+
+         if(RasterizeAtoms(pdb, &map))
+         {
+            ScanVoxelMap(pdb, cells, &map, flags);
+            free(map.bits);
+         }
+         else
+         {
+            ok = FALSE;
+         }
+      }
+   }
+
+   if(ok)
+      MergeAtomFlags(pdb, flags);
+
+   for(a=0; a<3; a++)
+   {
+      for(b=0; b<2; b++)
+      {
+         FREE(line[a][b]);
+      }
+   }
+   FREE(flags);
+
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>int CreateGridLine(REAL min, REAL max, BOOL forwards, REAL **coord)
+   -------------------------------------------------------------------
+   Creates an array of the grid coordinates from min to max (or max to
+   min if not forwards), stepping in exactly the same way as the loops in
+   FlagSurfaceSweep(). Returns the number of points and sets *coord to 
+   NULL if there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+int CreateGridLine(REAL min, REAL max, BOOL forwards, REAL **coord)
+{
+   REAL v;
+   int  n = 0;
+
+   if(forwards)
+      for(v=min; v<=max; v+=GRID) n++;
+   else
+      for(v=max; v>=min; v-=GRID) n++;
+
+   if((*coord = (REAL *)malloc(MAX(n, 1) * sizeof(REAL))) == NULL)
+      return(0);
+
+   n = 0;
+   if(forwards)
+      for(v=min; v<=max; v+=GRID) (*coord)[n++] = v;
+   else
+      for(v=max; v>=min; v-=GRID) (*coord)[n++] = v;
+
+   return(n);
+}
+
+
+/************************************************************************/
+/*>BOOL RasterizeAtoms(PDB *pdb, VOXELMAP *map)
+   --------------------------------------------
+   Allocates the bits for a VOXELMAP and sets the bit for each probe 
+   point within the water radius of an atom. Only the points in a small 
+   block around each atom are tested. Returns FALSE if there is no 
+   memory.
+
+   17.10.26 Original   By: agent
+*/
+BOOL RasterizeAtoms(PDB *pdb, VOXELMAP *map)
+{
+   PDB  *p,
+        grid;
+   REAL pos[3];
+   int  lo[3], hi[3],
+        range = (int)(WATER / GRID) + 1,
+        a, i, j, k;
+
+   /* SetGridPoint() always sets all three but gcc -O3 can't tell      */
+   grid.x = grid.y = grid.z = (REAL)0.0;
+
+   map->nwords = (map->n[2] + VOXBITS - 1) / VOXBITS;
+   if((map->bits = (VOXWORD *)calloc(MAX(map->n[0] * map->n[1] * 
+                                         map->nwords, 1),
+                                     sizeof(VOXWORD))) == NULL)
+      return(FALSE);
+
+   for(p=pdb; p!=NULL; NEXT(p))
+   {
+      /* Find the block of probe points around this atom                */
+      for(a=0; a<3; a++)
+      {
+         pos[a] = (map->axis[a] == 0) ? p->x :
+                  ((map->axis[a] == 1) ? p->y : p->z);
+         i      = (int)floor((pos[a] - map->coord[a][0]) / map->step[a]);
+         lo[a]  = MAX(i - range, 0);
+         hi[a]  = MIN(i + range, map->n[a] - 1);
+      }
+
+      for(i=lo[0]; i<=hi[0]; i++)
+      {
+         for(j=lo[1]; j<=hi[1]; j++)
+         {
+            VOXWORD *line = map->bits + (i * map->n[1] + j) * map->nwords;
+            for(k=lo[2]; k<=hi[2]; k++)
+            {
+               SetGridPoint(&grid, map, i, j, k);
+               if(DISTSQ(&grid, p) < WATERSQ)
+                  line[k / VOXBITS] |= ((VOXWORD)1 << (k % VOXBITS));
+            }
+         }
+      }
+   }
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>void ScanVoxelMap(PDB *pdb, CELLLIST *cells, VOXELMAP *map,
+                      VOXWORD *flags)
+   ------------------------------------------------------------
+   For each grid line in a VOXELMAP, finds the first set bit a word at a
+   time and flags the atoms within the water radius of that probe point.
+
+   17.10.26 Original   By: agent
+   17.10.26 Added flags By: agent
+*/
+void ScanVoxelMap(PDB *pdb, CELLLIST *cells, VOXELMAP *map,
+                  VOXWORD *flags)
+{
+   PDB     grid;
+   VOXWORD *line;
+   int     i, j, w;
+
+   for(i=0; i<map->n[0]; i++)
+   {
+      for(j=0; j<map->n[1]; j++)
+      {
+         line = map->bits + (i * map->n[1] + j) * map->nwords;
+         for(w=0; w<map->nwords; w++)
+         {
+            if(line[w])
+            {
+               SetGridPoint(&grid, map, i, j, 
+                            w * VOXBITS + FIRSTBIT(line[w]));
+               ProbePoint(pdb, cells, &grid, flags);
+               break;
+            }
+         }
+      }
+   }
+}
+
+
+/************************************************************************/
+/*>void SetGridPoint(PDB *grid, VOXELMAP *map, int i, int j, int k)
+   -----------------------------------------------------------------
+   Sets the coordinates of a PDB item to the probe point (i,j,k) in a
+   VOXELMAP
+
+   17.10.26 Original   By: agent
+*/
+void SetGridPoint(PDB *grid, VOXELMAP *map, int i, int j, int k)
+{
+   int a,
+       idx[3];
+   REAL v;
+
+   idx[0] = i;
+   idx[1] = j;
+   idx[2] = k;
+   
+   for(a=0; a<3; a++)
+   {
+      v = map->coord[a][idx[a]];
+      switch(map->axis[a])
+      {
+      case 0:
+         grid->x = v;
+         break;
+      case 1:
+         grid->y = v;
+         break;
+      default:
+         grid->z = v;
+         break;
+      }
+   }
+}
+
+
+/************************************************************************/
+/*>int FirstBit(VOXWORD bits)
+   ---------------------------
+   Portable version of FIRSTBIT() used when the compiler has no builtin.
+   Returns the position of the lowest set bit (bits must not be zero).
+
+   17.10.26 Original   By: agent
+*/
+int FirstBit(VOXWORD bits)
+{
+   int i = 0;
+
+   while(!(bits & (VOXWORD)1))
+   {
+      bits >>= 1;
+      i++;
+   }
+   return(i);
+}
+
+
+/************************************************************************/
+/*>BOOL ProbePoint(PDB *pdb, CELLLIST *cells, PDB *grid, 
+                    VOXWORD *flags)
+   ------------------------------------------------------
+   Sets the bit in flags for every atom within the water radius of a 
+   probe point. If cells is NULL, all atoms in the linked list are 
+   tested; otherwise only those in the cells around the probe. Returns 
+   TRUE if any atoms were hit.
+
+   18.11.93 Original   By: ACRM
+   17.10.26 Moved out of FindSurfaceAtoms() and added cell list By: agent
+   17.10.26 Sets bits in flags rather than the occ flags so it may be
+            used by several threads By: agent
+*/
+BOOL ProbePoint(PDB *pdb, CELLLIST *cells, PDB *grid, VOXWORD *flags)
+{
+   BOOL GotHit = FALSE;
+   PDB  *p;
+   int  ix, iy, iz,
+        cx, cy, cz,
+        i, k, c;
+
+   if(cells == NULL)
+   {
+      for(p=pdb, i=0; p!=NULL; NEXT(p), i++)
+      {
+         if(DISTSQ(grid, p) < WATERSQ)
+         {
+            flags[i / VOXBITS] |= ((VOXWORD)1 << (i % VOXBITS));
+            GotHit = TRUE;
+         }
+      }
+      return(GotHit);
+   }
+
+   /* Find the cell containing the probe and test the atoms in it and
+      its neighbours. The probe may be just outside the box.
+   */
+   cx = (int)floor((grid->x - cells->xmin) / cells->size);
+   cy = (int)floor((grid->y - cells->ymin) / cells->size);
+   cz = (int)floor((grid->z - cells->zmin) / cells->size);
+
+   for(ix=MAX(cx-1, 0); ix<=MIN(cx+1, cells->nx-1); ix++)
+   {
+      for(iy=MAX(cy-1, 0); iy<=MIN(cy+1, cells->ny-1); iy++)
+      {
+         c = (ix * cells->ny + iy) * cells->nz;
+         for(iz=MAX(cz-1, 0); iz<=MIN(cz+1, cells->nz-1); iz++)
+         {
+            k = cells->start[c+iz+1];
+            for(i=cells->start[c+iz]; i<k; i++)
+            {
+               p = cells->atom[i];
+               if(DISTSQ(grid, p) < WATERSQ)
+               {
+                  flags[cells->index[i] / VOXBITS] |= 
+                     ((VOXWORD)1 << (cells->index[i] % VOXBITS));
+                  GotHit = TRUE;
+               }
+            }
+         }
+      }
+   }
+
+   return(GotHit);
+}
+
+
+/************************************************************************/
+/*>CELLLIST *CreateCellList(PDB *pdb, REAL size, REAL xmin, REAL xmax,
+                              REAL ymin, REAL ymax, REAL zmin, REAL zmax)
+   ---------------------------------------------------------------------
+   Sorts the atoms into a grid of cells covering the specified box. The
+   cells are size across, or larger if there would be more than
+   MAXCELLRATIO cells per atom. Returns NULL if there is no memory.
+
+   17.10.26 Original   By: agent
+   17.10.26 Added size By: agent
+   17.10.26 Added index By: agent
+   17.10.26 Counts the cells as a REAL before making them ints By: agent
+*/
+CELLLIST *CreateCellList(PDB *pdb, REAL size, REAL xmin, REAL xmax,
+                         REAL ymin, REAL ymax, REAL zmin, REAL zmax)
+{
+   CELLLIST *cells;
+   PDB      **idx;
+   int      *cellof = NULL,
+            natoms,
+            ncells,
+            i, c;
+
+   if((cells = (CELLLIST *)calloc(1, sizeof(CELLLIST))) == NULL)
+      return(NULL);
+   if((idx = blIndexPDB(pdb, &natoms)) == NULL)
+   {
+      free(cells);
+      return(NULL);
+   }
+   
+   cells->xmin = xmin;
+   cells->ymin = ymin;
+   cells->zmin = zmin;
+   cells->size = size;
+
+   /* Count the cells as a REAL so a tiny size can't overflow an int   */
+   for(;;)
+   {
+      if(((REAL)1.0 + floor((xmax - xmin) / cells->size)) *
+         ((REAL)1.0 + floor((ymax - ymin) / cells->size)) *
+         ((REAL)1.0 + floor((zmax - zmin) / cells->size)) <=
+         (REAL)MAXCELLRATIO * (REAL)(natoms + 1))
+         break;
+      cells->size *= (REAL)2.0;
+   }
+   cells->nx = 1 + (int)((xmax - xmin) / cells->size);
+   cells->ny = 1 + (int)((ymax - ymin) / cells->size);
+   cells->nz = 1 + (int)((zmax - zmin) / cells->size);
+   ncells = cells->nx * cells->ny * cells->nz;
+
+   cells->atom  = (PDB **)malloc(MAX(natoms, 1) * sizeof(PDB *));
+   cells->index = (int *)malloc(MAX(natoms, 1) * sizeof(int));
+   cells->start = (int *)calloc(ncells + 1, sizeof(int));
+   cellof       = (int *)malloc(MAX(natoms, 1) * sizeof(int));
+   if((cells->atom == NULL) || (cells->index == NULL) || 
+      (cells->start == NULL) || (cellof == NULL))
+   {
+      FREE(cellof);
+      free(idx);
+      FreeCellList(cells);
+      return(NULL);
+   }
+
+   /* Find the cell for each atom and count the atoms in each cell      */
+   for(i=0; i<natoms; i++)
+   {
+      cellof[i] = 
+         ((int)((idx[i]->x - xmin) / cells->size) * cells->ny + 
+          (int)((idx[i]->y - ymin) / cells->size)) * cells->nz +
+         (int)((idx[i]->z - zmin) / cells->size);
+      cells->start[cellof[i]+1]++;
+   }
+
+   /* Convert the counts to start positions and place the atoms         */
+   for(c=0; c<ncells; c++)
+      cells->start[c+1] += cells->start[c];
+   for(i=0; i<natoms; i++)
+   {
+      cells->index[cells->start[cellof[i]]] = i;
+      cells->atom[cells->start[cellof[i]]++] = idx[i];
+   }
+
+   /* Placing the atoms moved each start to the start of the next cell  */
+   for(c=ncells; c>0; c--)
+      cells->start[c] = cells->start[c-1];
+   cells->start[0] = 0;
+
+   free(cellof);
+   free(idx);
+   return(cells);
+}
+
+
+/************************************************************************/
+/*>void FreeCellList(CELLLIST *cells)
+   -----------------------------------
+   Frees a cell list. NULL is ignored.
+
+   17.10.26 Original   By: agent
+*/
+void FreeCellList(CELLLIST *cells)
+{
+   if(cells != NULL)
+   {
+      FREE(cells->atom);
+      FREE(cells->index);
+      FREE(cells->start);
+      free(cells);
+   }
+}
+
+
+/************************************************************************/
+/*>PDB *FindAtomsOfInterest(PDB *surface, BOOL philphob, BOOL verbose)
+   -------------------------------------------------------------------
+   Searches a PDB linked list for all atoms of interest as defined by 
+   the atom features and returns a PDB linked list containing one entry
+   for each residue placed at the centre of its atoms of interest. The
+   residues are found through a hash keyed on chain, residue number and
+   insert code and the coordinates are summed and divided at the end.
+   occ in the output list is the number of atoms of interest.
+
+   18.11.93 Original   By: ACRM
+   22.11.93 Added aromatics
+   19.05.94 Added phosphate for DNA
+   20.04.21 Added philphob and verbose
+   17.10.26 Atoms are now looked up in the feature table By: agent
+   17.10.26 Residues are found through a hash and the centre is the
+            mean of the atoms (the count was previously incremented for
+            each coordinate) By: agent
+*/
+PDB *FindAtomsOfInterest(PDB *surface, BOOL philphob, BOOL verbose)
+{
+   PDB     *interest = NULL,
+           *CurrInt  = NULL,
+           *p;
+   RESHASH *hash,
+           *h;
+   int     mask,
+           nflagged  = 0,
+           hashsize,
+           i;
+
+   if(verbose)
+   {
+      fprintf(stderr,"Finding atoms of interest on the surface...\n");
+   }
+
+   /* We use occ as a flag to indicate interesting atoms                */
+   D("Clearing occ flag\n");
+   for(p=surface; p!=NULL; NEXT(p))
+      p->occ = 0.0;
+
+   /* With philphob FALSE, hydrophilics and hydrophobics are only of
+      interest if they are also charged or aromatic
+   */
+   mask = (1 << PROP_POSITIVE) | (1 << PROP_NEGATIVE) | 
+          (1 << PROP_AROMATIC);
+   if(philphob)
+      mask |= (1 << PROP_HYDROPHOBIC) | (1 << PROP_HYDROPHILIC);
+
+   D("Finding atoms of interest\n");
+   for(p=surface; p!=NULL; NEXT(p))
+   {
+      if(LookupFeature(p->resnam, p->atnam) & mask)
+      {
+         p->occ = 1.0;
+         nflagged++;
+      }
+   }
+
+   /* Create a hash with at least twice as many entries as there could
+      be residues
+   */
+   for(hashsize=1; hashsize < 2 * nflagged; hashsize *= 2);
+   if((hash = (RESHASH *)calloc(hashsize, sizeof(RESHASH))) == NULL)
+   {
+      fprintf(stderr,"No memory for residue hash\n");
+      return(NULL);
+   }
+
+   /* Now we copy this list, but include only one entry for each residue*/
+   for(p=surface; p!=NULL; NEXT(p))
+   {
+      if(p->occ != 0.0)
+      {
+         h = FindResidueHash(hash, hashsize, p);
+
+         /* If not found, then add to the list                          */
+         if(h->res == NULL)
+	 {
+            D("   Not Found: adding to list\n");
+
+            if(interest == NULL)
+            {
+               INIT(interest,PDB);
+               CurrInt = interest;
+            }
+            else
+            {
+               ALLOCNEXT(CurrInt,PDB);
+            }
+
+            if(CurrInt==NULL)
+	    {
+               if(interest!=NULL) FREELIST(interest,PDB);
+               free(hash);
+               fprintf(stderr,"No memory for charged atom list\n");
+               return(NULL);
+            }
+
+            blCopyPDB(CurrInt,p);
+            h->res = CurrInt;
+	 }
+
+         h->x += p->x;
+         h->y += p->y;
+         h->z += p->z;
+         h->count++;
+      }
+   }
+
+   /* Place each residue at the centre of its atoms of interest and use
+      occ to store the number of atoms
+   */
+   for(i=0; i<hashsize; i++)
+   {
+      if(hash[i].res != NULL)
+      {
+         hash[i].res->x   = hash[i].x / hash[i].count;
+         hash[i].res->y   = hash[i].y / hash[i].count;
+         hash[i].res->z   = hash[i].z / hash[i].count;
+         hash[i].res->occ = (REAL)hash[i].count;
+      }
+   }
+
+   free(hash);
+   return(interest);
+}
+
+
+/************************************************************************/
+/*>RESHASH *FindResidueHash(RESHASH *hash, int hashsize, PDB *p)
+   --------------------------------------------------------------
+   Returns the entry in a hash of residues for the residue containing
+   atom p. This is either the entry already used for the residue or the
+   empty entry where it should be stored. hashsize must be a power of 2
+   and the hash must not be full.
+
+   17.10.26 Original   By: agent
+*/
+RESHASH *FindResidueHash(RESHASH *hash, int hashsize, PDB *p)
+{
+   unsigned long h;
+   PDB           *q;
+
+   h = ((unsigned long)p->resnum * 2654435761UL) ^
+       ((unsigned long)(unsigned char)p->chain[0] << 8) ^
+       (unsigned long)(unsigned char)p->insert[0];
+   h = (h ^ (h >> 16)) & (hashsize - 1);
+
+   while((q = hash[h].res) != NULL)
+   {
+      if(q->resnum    == p->resnum    && 
+         q->insert[0] == p->insert[0] &&
+         q->chain[0]  == p->chain[0])
+         break;
+      h = (h + 1) & (hashsize - 1);
+   }
+
+   return(&(hash[h]));
+}
+
+
+/************************************************************************/
+/*>void DoDistMatrix(FILE *out, PDB *interest)
+   --------------------------------
+   Calculate a distance matrix for all the atoms in the input PDB linked
+   list. Print this to stdout.
+
+   18.11.93 Original   By: ACRM
+*/
+void DoDistMatrix(FILE *out, PDB *interest)
+{
+   PDB *p, *q;
+
+   D("Entered DoDistMatrix\n");
+
+   for(p=interest; p!=NULL; NEXT(p))
+   {
       for(q=p->next; q!=NULL; NEXT(q))
       {
          fprintf(out, "%s %c%4d%c %s %c%4d%c %8.3f\n",
@@ -731,6 +2184,7 @@ void DoDistMatrix(FILE *out, PDB *interest)
    --------------------------------
 
    16.04.21 Original   By: ACRM
+   17.10.26 Moved printing each residue into PrintResidue() By: agent
 */
 void PrintInterestingResidues(FILE *out, PDB *interest)
 {
@@ -739,82 +2193,606 @@ void PrintInterestingResidues(FILE *out, PDB *interest)
    D("Entered PrintInterestingResidues\n");
 
    for(p=interest; p!=NULL; NEXT(p))
-   {
-      char resid[32];
-      char properties[MAXPROPERTIES+1];
+      PrintResidue(out, p);
+}
+
+
+/************************************************************************/
+/*>void PrintResidue(FILE *out, PDB *p)
+   ------------------------------------
+   Prints the name, id, coordinates and properties of a residue of 
+   interest
+
+   16.04.21 Original   By: ACRM
+   17.10.26 Moved out of PrintInterestingResidues() By: agent
+*/
+void PrintResidue(FILE *out, PDB *p)
+{
+   char resid[32];
+   char properties[MAXPROPERTIES+1];
       
-      MAKERESID(resid, p);
+   MAKERESID(resid, p);
 
-      SetPropertyString(p, properties);
+   SetPropertyString(p, properties);
       
-      fprintf(out, "%s %-5s %8.3f %8.3f %8.3f %s\n",
-              p->resnam, resid, p->x, p->y, p->z,
-              properties);
+   fprintf(out, "%s %-5s %8.3f %8.3f %8.3f %s\n",
+           p->resnam, resid, p->x, p->y, p->z,
+           properties);
+}
+
+
+/************************************************************************/
+/*>BOOL WritePatches(FILE *out, PDB *pdb, PDB *surface, PDB *interest,
+                      REAL radius, char *chains, BOOL verbose)
+   ---------------------------------------------------------------------
+   Writes a patch for each residue in the surface atom list whose chain
+   is in chains (or every residue if chains is blank). With -e sasa 
+   these are the residues whose relative accessibility is above -t. 
+   Each patch is a record starting with a line >resid followed by the
+   residues of interest whose centres are within radius of the 
+   residue's CA in the full structure pdb, in the order they appear in
+   interest. Residues without a CA have no patch. The residues of 
+   interest are placed in a cell list so only the cells around the CA
+   need be searched. Returns FALSE (with a message) if there is no 
+   memory.
+
+   17.10.26 Original   By: agent
+   17.10.26 Takes the full structure and centres each patch on the CA
+            from it By: agent
+*/
+BOOL WritePatches(FILE *out, PDB *pdb, PDB *surface, PDB *interest,
+                  REAL radius, char *chains, BOOL verbose)
+{
+   CELLLIST *cells;
+   PDB      **idx,
+            *start,
+            *stop,
+            *from   = pdb,
+            *ca,
+            *p;
+   REAL     xmin, xmax,
+            ymin, ymax,
+            zmin, zmax,
+            dx, dy, dz,
+            radsq   = radius * radius;
+   int      *member = NULL,
+            nint,
+            nmember,
+            npatch  = 0,
+            ix, iy, iz,
+            cx, cy, cz,
+            c, k;
+   char     resid[32];
+
+   /* The residues of interest are centred on surface atoms so the box 
+      around the surface atoms holds all of them. A CA outside the box
+      just searches the cells at its edge
+   */
+   xmin = xmax = surface->x;
+   ymin = ymax = surface->y;
+   zmin = zmax = surface->z;
+   for(p=surface; p!=NULL; NEXT(p))
+   {
+      xmin = MIN(xmin, p->x);   xmax = MAX(xmax, p->x);
+      ymin = MIN(ymin, p->y);   ymax = MAX(ymax, p->y);
+      zmin = MIN(zmin, p->z);   zmax = MAX(zmax, p->z);
+   }
+
+   idx   = blIndexPDB(interest, &nint);
+   cells = CreateCellList(interest, radius, xmin, xmax, ymin, ymax, 
+                          zmin, zmax);
+   if((idx == NULL) || (cells == NULL) ||
+      ((member = (int *)malloc(MAX(nint, 1) * sizeof(int))) == NULL))
+   {
+      fprintf(stderr,"No memory for patches\n");
+      FREE(idx);
+      FreeCellList(cells);
+      return(FALSE);
+   }
+
+   for(start=surface; start!=NULL; start=stop)
+   {
+      stop = blFindNextResidue(start);
+      if(chains[0] && (strchr(chains, start->chain[0]) == NULL))
+         continue;
+
+      MAKERESID(resid, start);
+      if((ca = FindPatchCentre(pdb, &from, start)) == NULL)
+      {
+         if(verbose)
+            fprintf(stderr,"No patch around %s which has no CA\n", resid);
+         continue;
+      }
+
+      /* Collect the residues of interest from the surrounding cells    */
+      cx = (int)((ca->x - cells->xmin) / cells->size);
+      cy = (int)((ca->y - cells->ymin) / cells->size);
+      cz = (int)((ca->z - cells->zmin) / cells->size);
+      nmember = 0;
+      for(ix=MAX(cx-1, 0); ix<=MIN(cx+1, cells->nx-1); ix++)
+      {
+         for(iy=MAX(cy-1, 0); iy<=MIN(cy+1, cells->ny-1); iy++)
+         {
+            for(iz=MAX(cz-1, 0); iz<=MIN(cz+1, cells->nz-1); iz++)
+            {
+               c = (ix * cells->ny + iy) * cells->nz + iz;
+               for(k=cells->start[c]; k<cells->start[c+1]; k++)
+               {
+                  p  = cells->atom[k];
+                  dx = p->x - ca->x;
+                  dy = p->y - ca->y;
+                  dz = p->z - ca->z;
+                  if((dx*dx + dy*dy + dz*dz) <= radsq)
+                     member[nmember++] = cells->index[k];
+               }
+            }
+         }
+      }
+
+      /* Write them in their original order                             */
+      qsort(member, nmember, sizeof(int), CompareInts);
+      fprintf(out, ">%s\n", resid);
+      for(k=0; k<nmember; k++)
+         PrintResidue(out, idx[member[k]]);
+      npatch++;
+   }
+
+   if(verbose)
+      fprintf(stderr,"Wrote %d patches\n", npatch);
+
+   free(member);
+   free(idx);
+   FreeCellList(cells);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>PDB *FindPatchCentre(PDB *pdb, PDB **from, PDB *res)
+   ------------------------------------------------------
+   Finds the CA of the residue res in the full structure pdb. The search
+   starts at *from and goes round to the start of pdb if need be, and 
+   *from is left at the residue, so residues taken in order are each 
+   found straight away. Returns NULL if the residue or its CA isn't 
+   found.
+
+   17.10.26 Original   By: agent
+   17.10.26 Returns the CA from the full structure rather than falling
+            back to the centre of the surface atoms By: agent
+*/
+PDB *FindPatchCentre(PDB *pdb, PDB **from, PDB *res)
+{
+   PDB *start,
+       *stop,
+       *p;
+   int pass;
+
+   for(pass=0; pass<2; pass++)
+   {
+      for(start=(pass ? pdb : *from); 
+          (start!=NULL) && (pass==0 || start!=*from); 
+          start=stop)
+      {
+         stop = blFindNextResidue(start);
+         if((start->resnum    == res->resnum)    &&
+            (start->insert[0] == res->insert[0]) &&
+            (start->chain[0]  == res->chain[0]))
+         {
+            *from = start;
+            for(p=start; p!=stop; NEXT(p))
+            {
+               if(!strncmp(p->atnam, "CA  ", 4))
+                  return(p);
+            }
+            return(NULL);
+         }
+      }
+   }
+
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>int CompareInts(const void *a, const void *b)
+   ----------------------------------------------
+   qsort() comparison function for integers
+
+   17.10.26 Original   By: agent
+*/
+int CompareInts(const void *a, const void *b)
+{
+   return(*(const int *)a - *(const int *)b);
+}
+
+
+/************************************************************************/
+/*>BOOL WriteBinaryResidues(FILE *out, PDB *interest, REAL binsize)
+   ----------------------------------------------------------------
+   Writes the residues of interest as a binary surface file (see 
+   surfbin.h). If binsize is not zero, the distance bins between each
+   pair of residues are also written so matchpatch need not calculate 
+   them (unless there are too many pairs for the int in the header).
+   Returns FALSE (with a message) if there is no memory or the file 
+   can't be written.
+
+   17.10.26 Original   By: agent
+   17.10.26 Skips the bins if there are more than INT_MAX pairs 
+            By: agent
+   17.10.26 Flushes the file so a failed write is reported By: agent
+*/
+BOOL WriteBinaryResidues(FILE *out, PDB *interest, REAL binsize)
+{
+   SURFBINHEADER header;
+   SURFBINRES    *res;
+   unsigned char *bin   = NULL;
+   PDB           *p;
+   char          resid[32];
+   REAL          dx, dy, dz,
+                 dist;
+   int           nres   = 0,
+                 i, j, 
+                 idist,
+                 npair  = 0;
+   BOOL          ok     = TRUE;
+
+   for(p=interest; p!=NULL; NEXT(p))
+      nres++;
+
+   if((binsize > 0.0) && (((long)nres * (nres - 1)) / 2 <= INT_MAX))
+   {
+      npair   = (int)(((long)nres * (nres - 1)) / 2);
+      binsize = (REAL)((float)binsize);
+   }
+   
+   if(((res = (SURFBINRES *)calloc(MAX(nres, 1), sizeof(SURFBINRES)))
+       == NULL) ||
+      ((npair > 0) && ((bin = (unsigned char *)malloc(npair)) == NULL)))
+   {
+      fprintf(stderr,"No memory for binary surface file\n");
+      FREE(res);
+      return(FALSE);
+   }
+
+   for(p=interest, i=0; p!=NULL; NEXT(p), i++)
+   {
+      MAKERESID(resid, p);
+      sscanf(p->resnam, "%7s", res[i].resnam);
+      sscanf(resid, "%15s", res[i].resid);
+      res[i].properties = LookupFeature(p->resnam, NULL);
+      res[i].x          = (float)p->x;
+      res[i].y          = (float)p->y;
+      res[i].z          = (float)p->z;
    }
+
+   /* Calculate the bins from the float coordinates as matchpatch would*/
+   for(i=0, npair=0; (bin != NULL) && (i<nres); i++)
+   {
+      for(j=i+1; j<nres; j++)
+      {
+         dx    = (REAL)res[i].x - (REAL)res[j].x;
+         dy    = (REAL)res[i].y - (REAL)res[j].y;
+         dz    = (REAL)res[i].z - (REAL)res[j].z;
+         dist  = sqrt(dx*dx + dy*dy + dz*dz);
+         idist = (int)(dist/binsize);
+         if(idist >= SURFBINMAXDIST-1) idist = SURFBINMAXDIST-2;
+         bin[npair++] = (unsigned char)idist;
+      }
+   }
+
+   memset(&header, 0, sizeof(SURFBINHEADER));
+   strcpy(header.magic, SURFBINMAGIC);
+   header.version = SURFBINVERSION;
+   header.endian  = SURFBINENDIAN;
+   header.recsize = sizeof(SURFBINRES);
+   header.nres    = nres;
+   header.npair   = npair;
+   header.maxdist = SURFBINMAXDIST;
+   header.binsize = (float)binsize;
+
+   if((fwrite(&header, sizeof(SURFBINHEADER), 1, out) != 1) ||
+      ((nres > 0) && 
+       (fwrite(res, sizeof(SURFBINRES), nres, out) != (size_t)nres)) ||
+      ((npair > 0) && (fwrite(bin, 1, npair, out) != (size_t)npair)) ||
+      (fflush(out) == EOF))
+   {
+      fprintf(stderr,"Error writing binary surface file\n");
+      ok = FALSE;
+   }
+
+   free(res);
+   FREE(bin);
+   return(ok);
 }
 
 
 /************************************************************************/
+/*>void SetPropertyString(PDB *p, char *properties)
+   -------------------------------------------------
+   Sets properties to a string of 0s and 1s giving the properties of
+   the residue as defined by the residue features
+
+   16.04.21 Original   By: ACRM
+   17.10.26 Properties are now looked up in the feature table By: agent
+*/
 void SetPropertyString(PDB *p, char *properties)
 {
-   int i;
+   int i,
+       props = LookupFeature(p->resnam, NULL);
 
-   /* Initialize the property bitstring                                 */
    for(i=0; i<MAXPROPERTIES; i++)
-      properties[i] = '0';
+      properties[i] = (props & (1 << i)) ? '1' : '0';
    properties[MAXPROPERTIES] = '\0';
-   
-   /* Negative charges                                                  */
-   if(!strncmp(p->resnam, "ASP", 3) ||
-      !strncmp(p->resnam, "A  ", 3) ||
-      !strncmp(p->resnam, "T  ", 3) ||
-      !strncmp(p->resnam, "C  ", 3) ||
-      !strncmp(p->resnam, "G  ", 3) ||
-      !strncmp(p->resnam, "GLU", 3))
+}
+
+
+/************************************************************************/
+/*>BOOL ReadFeatures(char *featfile)
+   ---------------------------------
+   Reads the feature definitions from featfile (see sDefaultFeatures 
+   for the format) or uses the default definitions if featfile is 
+   blank. Blank lines and lines starting with # or ! are ignored. 
+   Returns FALSE (with a message) if the file can't be read or contains
+   an error.
+
+   17.10.26 Original   By: agent
+*/
+BOOL ReadFeatures(char *featfile)
+{
+   FILE *fp;
+   char buffer[MAXBUFF];
+   int  i,
+        line = 0;
+
+   if(!featfile[0])
    {
-      properties[PROP_NEGATIVE] = '1';
+      for(i=0; sDefaultFeatures[i]!=NULL; i++)
+      {
+         strcpy(buffer, sDefaultFeatures[i]);
+         if(!ParseFeature(buffer))
+         {
+            fprintf(stderr,"No memory for features\n");
+            return(FALSE);
+         }
+      }
+      return(TRUE);
    }
 
-   /* Positive charges                                                  */
-   if(!strncmp(p->resnam, "LYS", 3) ||
-      !strncmp(p->resnam, "ARG", 3) ||
-      !strncmp(p->resnam, "HIS", 3))
+   if((fp=fopen(featfile,"r"))==NULL)
    {
-      properties[PROP_POSITIVE] = '1';
+      fprintf(stderr,"Unable to read feature file: %s\n", featfile);
+      return(FALSE);
    }
-   
-   /* Aromatics                                                         */
-   if(!strncmp(p->resnam, "PHE", 3) ||
-      !strncmp(p->resnam, "TYR", 3) ||
-      !strncmp(p->resnam, "TRP", 3))
+
+   while(fgets(buffer,MAXBUFF-1,fp))
+   {
+      line++;
+      if(!ParseFeature(buffer))
+      {
+         fprintf(stderr,"Error in feature file %s at line %d:\n%s",
+                 featfile, line, buffer);
+         fclose(fp);
+         return(FALSE);
+      }
+   }
+
+   fclose(fp);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL ParseFeature(char *buffer)
+   -------------------------------
+   Parses a line of a feature definition and adds it to gFeatures. 
+   Returns FALSE if the line is not valid or there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+BOOL ParseFeature(char *buffer)
+{
+   FEATURE *f;
+   char    type[16],
+           resnam[16],
+           atnam[16],
+           props[16];
+   int     nfield,
+           i;
+
+   nfield = sscanf(buffer, "%15s %15s %15s %15s", type, resnam, atnam, 
+                   props);
+   if((nfield < 1) || (type[0] == '#') || (type[0] == '!'))
+      return(TRUE);
+
+   if(!strcmp(type, "RESIDUE") && (nfield == 3))
    {
-      properties[PROP_AROMATIC] = '1';
+      strcpy(props, atnam);
+      atnam[0] = '\0';
    }
-   
-   /* Hydrophobic                                                       */
-   if(!strncmp(p->resnam, "PHE", 3) ||
-      !strncmp(p->resnam, "ILE", 3) ||
-      !strncmp(p->resnam, "LEU", 3) ||
-      !strncmp(p->resnam, "VAL", 3) ||
-      !strncmp(p->resnam, "TRP", 3))
+   else if(strcmp(type, "ATOM") || (nfield != 4))
+   {
+      return(FALSE);
+   }
+
+   if(strlen(props) != MAXPROPERTIES)
+      return(FALSE);
+
+   if((f = (FEATURE *)malloc(sizeof(FEATURE))) == NULL)
+      return(FALSE);
+
+   f->atom       = (atnam[0] != '\0');
+   f->reskey     = PackName(resnam, &(f->resmask));
+   f->atkey      = f->atmask = 0;
+   if(f->atom)
+      f->atkey   = PackName(atnam,  &(f->atmask));
+   f->properties = 0;
+   for(i=0; i<MAXPROPERTIES; i++)
    {
-      properties[PROP_HYDROPHOBIC] = '1';
+      if(props[i] == '1')
+      {
+         f->properties |= (1 << i);
+      }
+      else if(props[i] != '0')
+      {
+         free(f);
+         return(FALSE);
+      }
    }
    
-   /* Hydrophilic                                                       */
-   if(!strncmp(p->resnam, "ASP", 3) ||
-      !strncmp(p->resnam, "GLU", 3) ||
-      !strncmp(p->resnam, "HIS", 3) ||
-      !strncmp(p->resnam, "LYS", 3) ||
-      !strncmp(p->resnam, "ASN", 3) ||
-      !strncmp(p->resnam, "GLN", 3) ||
-      !strncmp(p->resnam, "ARG", 3) ||
-      !strncmp(p->resnam, "SER", 3) ||
-      !strncmp(p->resnam, "THR", 3) ||
-      !strncmp(p->resnam, "TYR", 3))
+   f->next   = gFeatures;
+   gFeatures = f;
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>unsigned long PackName(char *name, unsigned long *mask)
+   ------------------------------------------------------
+   Packs the first 4 characters of a residue or atom name (padded with 
+   spaces) into a key. If mask is not NULL, it is set to select the 
+   characters before a * which matches anything.
+
+   17.10.26 Original   By: agent
+*/
+unsigned long PackName(char *name, unsigned long *mask)
+{
+   unsigned long key  = 0,
+                 bits = 0;
+   BOOL          wild = FALSE;
+   int           i;
+
+   for(i=0; i<4; i++)
+   {
+      key  <<= 8;
+      bits <<= 8;
+      if(mask != NULL && *name == '*')
+         wild = TRUE;
+      if(!wild)
+      {
+         key  |= (unsigned char)(*name ? *name : ' ');
+         bits |= 0xFF;
+      }
+      if(*name) name++;
+   }
+
+   if(mask != NULL)
+      *mask = bits;
+   return(key);
+}
+
+
+/************************************************************************/
+/*>int LookupFeature(char *resnam, char *atnam)
+   ---------------------------------------------
+   Returns the properties (as a bitmask of PROP_ values) of an atom, or
+   of a residue if atnam is NULL. The first time a pair of names is seen
+   the properties of all matching features are combined and stored in a 
+   hash table, so later lookups of the same names take constant time.
+
+   17.10.26 Original   By: agent
+*/
+int LookupFeature(char *resnam, char *atnam)
+{
+   FEATURE       *f;
+   unsigned long reskey = PackName(resnam, NULL),
+                 atkey  = (atnam == NULL) ? 0 : PackName(atnam, NULL),
+                 h;
+   int           properties = 0;
+
+   /* Look for these names in the hash                                  */
+   if(gFeatHash != NULL)
+   {
+      h = ((reskey * 31 + atkey) * 2654435761UL) & (gFeatHashSize - 1);
+      while(gFeatHash[h].reskey)
+      {
+         if((gFeatHash[h].reskey == reskey) && 
+            (gFeatHash[h].atkey  == atkey))
+            return(gFeatHash[h].properties);
+         h = (h + 1) & (gFeatHashSize - 1);
+      }
+   }
+
+   /* Not found so combine the matching features                        */
+   for(f=gFeatures; f!=NULL; NEXT(f))
+   {
+      if((f->atom == (atnam != NULL))            &&
+         ((reskey & f->resmask) == f->reskey)   &&
+         ((atkey  & f->atmask)  == f->atkey))
+         properties |= f->properties;
+   }
+
+   /* Store in the hash, keeping it at most half full. If there is no 
+      memory we just don't store it.
+   */
+   if((2 * (gFeatHashUsed + 1) <= gFeatHashSize) || GrowFeatureHash())
+   {
+      h = ((reskey * 31 + atkey) * 2654435761UL) & (gFeatHashSize - 1);
+      while(gFeatHash[h].reskey)
+         h = (h + 1) & (gFeatHashSize - 1);
+      gFeatHash[h].reskey     = reskey;
+      gFeatHash[h].atkey      = atkey;
+      gFeatHash[h].properties = properties;
+      gFeatHashUsed++;
+   }
+
+   return(properties);
+}
+
+
+/************************************************************************/
+/*>BOOL GrowFeatureHash(void)
+   ---------------------------
+   Creates the feature hash table or doubles its size. Returns FALSE if
+   there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+BOOL GrowFeatureHash(void)
+{
+   FEATHASH      *old     = gFeatHash;
+   int           oldsize  = gFeatHashSize,
+                 i;
+   unsigned long h;
+
+   gFeatHashSize = (oldsize == 0) ? FEATHASHSIZE : (2 * oldsize);
+   if((gFeatHash = (FEATHASH *)calloc(gFeatHashSize, sizeof(FEATHASH))) 
+      == NULL)
+   {
+      gFeatHash     = old;
+      gFeatHashSize = oldsize;
+      return(FALSE);
+   }
+
+   for(i=0; i<oldsize; i++)
    {
-      properties[PROP_HYDROPHILIC] = '1';
+      if(old[i].reskey)
+      {
+         h = ((old[i].reskey * 31 + old[i].atkey) * 2654435761UL) & 
+             (gFeatHashSize - 1);
+         while(gFeatHash[h].reskey)
+            h = (h + 1) & (gFeatHashSize - 1);
+         gFeatHash[h] = old[i];
+      }
    }
+
+   FREE(old);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>void FreeFeatures(void)
+   ------------------------
+   Frees the feature definitions and hash table
+
+   17.10.26 Original   By: agent
+*/
+void FreeFeatures(void)
+{
+   FREELIST(gFeatures, FEATURE);
+   FREE(gFeatHash);
+   gFeatHashSize = gFeatHashUsed = 0;
 }
 
 
@@ -826,19 +2804,71 @@ void SetPropertyString(PDB *p, char *properties)
    18.11.93 Original   By: ACRM
    19.11.93 Added -s flag
    16.04.21 V1.2, V2.0
+   17.10.26 V2.1, V2.2, V2.3, V2.4, V2.5, V2.6, V2.7, V2.8 By: agent
 */
 void Usage(void)
 {
-   fprintf(stderr,"\nmatchpatchsurface V2.0 (c) 1993-2021 SciTech Software / \
-abYinformatics\n");
+   fprintf(stderr,"\nmatchpatchsurface V2.11 (c) 1993-2026 SciTech Software \
+/ abYinformatics\n");
    fprintf(stderr,"\nUsage: matchpatchsurface [-v][-l limitsfile][-s]\
-[-m][-n] [file.pdb [file.out]]\n");
+[-m][-n][-e engine][-j n]\n");
+   fprintf(stderr,"       [-f featurefile][-p probe][-t relaccess]\
+[-a atomfile][-r resfile]\n");
+   fprintf(stderr,"       [-b][-d binsize][-P radius [-c chains]]\n");
+   fprintf(stderr,"       [file.pdb [file.out]]\n");
    fprintf(stderr,"       -v Verbose\n");
    fprintf(stderr,"       -l specify limits file\n");
    fprintf(stderr,"       -s assume all residues are surface\n");
    fprintf(stderr,"       -m produce a distance matrix (for match V1)\n");
    fprintf(stderr,"       -n don't include features for \
 hydrophilics/hydrophobics\n");
+   fprintf(stderr,"       -e surface engine: cell (cell list; default), \
+sweep (test\n");
+   fprintf(stderr,"          every atom at each probe point) or voxel \
+(scan bitmaps of\n");
+   fprintf(stderr,"          occupied probe points) or sasa \
+(select residues by\n");
+   fprintf(stderr,"          solvent accessibility)\n");
+   fprintf(stderr,"       -f read the atoms of interest and residue \
+properties from\n");
+   fprintf(stderr,"          featurefile. Each line is:\n");
+   fprintf(stderr,"             ATOM resnam atnam properties\n");
+   fprintf(stderr,"          or RESIDUE resnam properties\n");
+   fprintf(stderr,"          where properties is a string of 0s and 1s \
+for positive,\n");
+   fprintf(stderr,"          negative, aromatic, hydrophobic and \
+hydrophilic. resnam may be\n");
+   fprintf(stderr,"          * for any residue and atnam may end in * \
+to match any atom\n");
+   fprintf(stderr,"          name starting with the preceding \
+characters\n");
+   fprintf(stderr,"       -j number of threads for the sweep and cell \
+engines (default: 1)\n");
+   fprintf(stderr,"       -p probe radius for -e sasa (default: %.2f)\n",
+           (double)WATER);
+   fprintf(stderr,"       -t minimum relative accessibility (%%) of a \
+surface residue\n");
+   fprintf(stderr,"          for -e sasa (default: %.1f)\n",
+           (double)DEFRELACCESS);
+   fprintf(stderr,"       -a write atom accessibilities to atomfile \
+(PDB format with\n");
+   fprintf(stderr,"          accessibility as the B-value) for -e sasa\n");
+   fprintf(stderr,"       -r write residue accessibilities to resfile \
+(name, id,\n");
+   fprintf(stderr,"          accessibility, relative accessibility) for \
+-e sasa\n");
+   fprintf(stderr,"       -b write a binary surface file for matchpatch\n");
+   fprintf(stderr,"       -d store the distance bins for matchpatch -d \
+binsize in the\n");
+   fprintf(stderr,"          binary surface file (implies -b)\n");
+   fprintf(stderr,"       -P write a patch of the residues of interest \
+within radius of\n");
+   fprintf(stderr,"          each surface residue. Each starts with a \
+line >resid and\n");
+   fprintf(stderr,"          the patches may be matched with \
+matchpatch -p\n");
+   fprintf(stderr,"       -c only write patches around residues in \
+these chains\n");
    fprintf(stderr,"\nSearch for surface charged and aromatic residues \
 and output their\n");
    fprintf(stderr,"coordinates and properties or create a \
@@ -0,0 +1,2561 @@
+/*************************************************************************
+
+   Program:    matchpatch
+   File:       mpcore.c
+   
+   Version:    V3.14
+   Date:       17.10.26
+   Function:   The matching core shared by matchpatch and libmatchpatch
+   
+   Copyright:  (c) SciTech Software / abYinformatics 1993-2026
+   Author:     Prof. Andrew C. R. Martin
+   EMail:      andrew@bioinf.org.uk
+               
+**************************************************************************
+
+   This program is not in the public domain, but it may be freely copied
+   and distributed for no charge providing this header is included.
+   The code may be modified as required, but any modifications must be
+   documented so that the person responsible can be identified. If someone
+   else breaks this code, I don't want to be blamed for code that does not
+   work! The code may not be sold commercially without print permission 
+   from the author, although it may be given away free with commercial 
+   products, providing it is made clear that this program is free and 
+   that the source code is provided with the program.
+
+**************************************************************************
+
+   Description:
+   ============
+   Reading surfaces, calculating their distances and signatures, 
+   building the atom arrays and the Lesk matching itself. These were 
+   in matchpatch.c (see there for the history) and are used by 
+   matchpatch and the library interface in libmatchpatch.c. Nothing 
+   here prints results; matches are returned as MATCHPAIRs.
+
+   Everything else in a program linked with the library shares its
+   name space, so the functions used outside this file are prefixed mpi
+   and the rest are static. The settings are static too and are only
+   changed through mpSetSettings().
+
+**************************************************************************
+
+   Usage:
+   ======
+
+**************************************************************************
+
+   Notes:
+   ======
+   
+**************************************************************************
+
+   Revision History:
+   =================
+   V3.4  17.10.26 Moved out of matchpatch.c. The matches are returned
+                  instead of being printed By: agent
+   V3.5  17.10.26 DoLesk() and DoWindowedLesk() take a minimum number of
+                  matches and give up as soon as it can't be reached By: agent
+   V3.6  17.10.26 Added gMinMatch By: agent
+   V3.7  17.10.26 DoLesk() compares each structure atom with the pattern
+                  fingerprints several at a time By: agent
+   V3.8  17.10.26 Pair offsets are longs so large structures don't 
+                  overflow them By: agent
+   V3.9  17.10.26 A tiny cutoff no longer overflows the number of grid
+                  cells By: agent
+   V3.10 17.10.26 Only the functions used by matchpatch and the library
+                  are exported and these are prefixed mpi. The settings
+                  are static and set with mpSetSettings() By: agent
+   V3.11 17.10.26 Added the verbose setting By: agent
+   V3.12 17.10.26 The CPU is checked for AVX2 once when the program 
+                  starts By: agent
+   V3.13 17.10.26 Binary surfaces need not be aligned in the file 
+                  By: agent
+   V3.14 17.10.26 Binary surfaces with invalid properties or bins are
+                  rejected By: agent
+
+*************************************************************************/
+/* Includes
+*/
+#define _POSIX_C_SOURCE 200809L  /* For fileno()                       */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "bioplib/MathType.h"
+#include "bioplib/SysDefs.h"
+#include "bioplib/macros.h"
+
+#include "surfbin.h"
+#include "mpcore.h"
+
+#ifdef SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+/************************************************************************/
+/* Defines
+*/
+/* Sets of vertices in the correspondence graph for -C                  */
+#define SETBITS       (8 * (int)sizeof(unsigned long))
+#define SETWORDS(n)   (((n) + SETBITS - 1) / SETBITS)
+#define SETHAS(s, i)  ((s)[(i) / SETBITS] &  (1UL << ((i) % SETBITS)))
+#define SETADD(s, i)  ((s)[(i) / SETBITS] |= (1UL << ((i) % SETBITS)))
+#define SETDEL(s, i)  ((s)[(i) / SETBITS] &= ~(1UL << ((i) % SETBITS)))
+
+#ifdef __GNUC__
+#  define COUNTBITS(x) __builtin_popcountl(x)
+#else
+#  define COUNTBITS(x) CountBits(x)
+#endif
+
+/************************************************************************/
+/* Structure and type definitions
+*/
+/* The fingerprints (properties and trimmed bit strings) of the live
+   pattern atoms laid out as separate arrays so that a structure atom 
+   can be compared with several at once by MatchFingerprints(). The
+   arrays are padded to a multiple of PRINTBLOCK with properties of -1.
+   need[n] is the number of bits two strings must share for a match if
+   the larger has n set, so no division is needed.
+*/
+typedef struct
+{
+   unsigned int *trim;           /* Trimmed bit strings                 */
+   int          *properties,
+                *nbits,          /* Bits set in trim                    */
+                natom,
+                need[MAXDIST+1];
+   BOOL         simd;            /* Use the AVX2 code                   */
+}  FINGERPRINTS;
+
+/* The correspondence graph searched for cliques with -C. Vertex v pairs
+   pattern atom pat[v] with structure atom struc[v]; adj holds nword
+   words of neighbours for each vertex. cur is the clique being built,
+   best the largest found so far and stack the sets for each level of
+   the search. The search stops after maxnodes calls.
+*/
+typedef struct
+{
+   int           *pat,
+                 *struc,
+                 *cur,
+                 *best;
+   unsigned long *adj,
+                 *stack;
+   int           nvert,
+                 nword,
+                 nbest;
+   long          nodes,
+                 maxnodes;
+}  CLIQUEGRAPH;
+
+/************************************************************************/
+/* Globals
+*/
+static REAL gBin      = DEFBIN, /* Bin size for distance matrix         */
+            gAccuracy = DEFACC, /* % accuracy for string comparison     */
+            gCutoff   = 0.0;    /* Max distance of a pair (0: no limit) */
+static long gClique   = 0;      /* Node limit for clique search (0: none)*/
+static int  gMinMatch = 0;      /* Fewest matches reported (0: any)     */
+static BOOL gVerbose  = FALSE;  /* Report progress of mpMatch()         */
+#ifdef SIMD_AVX2
+static BOOL gHaveAVX2 = FALSE;  /* CPU has AVX2 (set by DetectAVX2())   */
+#endif
+
+/************************************************************************/
+/* Prototypes
+*/
+static SURFACE *ReadBinarySurface(FILE *fp);
+static void ReleaseSurfaceMap(char *map, size_t mapsize);
+static BOOL CreateDistances(SURFACE *surf);
+static BOOL CreateDistanceMatrix(SURFACE *surf);
+static BOOL CreateNeighbourLists(SURFACE *surf, REAL cutoff);
+static BOOL SignatureCovers(DISTBITS *sig, int NPatAtom, ATOM *PatAtom);
+static int  ParseProperties(char *properties);
+static int  ConvertDistanceToBin(REAL dist);
+static void FillAtom(ATOM *atom, RESIDUE *res, int DistRange, BOOL SwapProp);
+static int  CountPossibleMatches(int NPatAtom,   ATOM *PatAtom,
+                                 int NStrucAtom, ATOM *StrucAtom);
+static SURFACE *CreateWindowSurface(SURFACE *struc, int *member, int nmember,
+                                    int *winof);
+static void KillAtom(int dead, ATOM *atoms, SURFACE *surf,
+                     int *worklist, int *nwork);
+static DISTBITS TrimBitStrings(int npat, ATOM *pat, int nstruc, ATOM *struc);
+static int  CompareInts(const void *a, const void *b);
+static int  FindMatches(int NPatAtom,   ATOM *PatAtom,
+                        int NStrucAtom, ATOM *StrucAtom, MATCHPAIR *match);
+static int  FindCliqueMatches(int NPatAtom,   ATOM *PatAtom,
+                              int NStrucAtom, ATOM *StrucAtom,
+                              MATCHPAIR *match, BOOL verbose);
+static BOOL BuildCorrespondenceGraph(CLIQUEGRAPH *graph,
+                                     int NPatAtom,   ATOM *PatAtom,
+                                     int NStrucAtom, ATOM *StrucAtom);
+static void FindMaxClique(CLIQUEGRAPH *graph);
+static void ExpandClique(CLIQUEGRAPH *graph, int depth, unsigned long *cand,
+                         unsigned long *done);
+static int  CountSet(unsigned long *set, int nword);
+static void FreeCliqueGraph(CLIQUEGRAPH *graph);
+static int  FindBestMatch(ATOM *PatAtom,   int PatIndex,
+                          ATOM *StrucAtom, int NStrucAtom);
+static BOOL CreateFingerprints(FINGERPRINTS *prints, int NPatAtom);
+static void FillFingerprints(FINGERPRINTS *prints, int NPatAtom,
+                             ATOM *PatAtom);
+static void FreeFingerprints(FINGERPRINTS *prints);
+static BOOL MatchFingerprints(FINGERPRINTS *prints, int properties, 
+                              DISTBITS trim);
+#ifdef SIMD_AVX2
+static void DetectAVX2(void) __attribute__((constructor));
+static BOOL MatchFingerprintsAVX2(FINGERPRINTS *prints, int properties, 
+                                  DISTBITS trim);
+#endif
+static BOOL Compare(DISTBITS dist1, DISTBITS dist2);
+static REAL CalcScore(DISTBITS dist1, DISTBITS dist2);
+#ifndef __GNUC__
+static int  CountBits(DISTBITS bits);
+#endif
+
+/************************************************************************/
+/*>void mpGetSettings(MPSETTINGS *settings)
+   ----------------------------------------
+   Gets the current settings
+
+   17.10.26 Original   By: agent
+   17.10.26 Added minmatch By: agent
+   17.10.26 Moved from libmatchpatch.c so the settings can be static
+            By: agent
+   17.10.26 Added verbose By: agent
+*/
+void mpGetSettings(MPSETTINGS *settings)
+{
+   settings->binsize  = gBin;
+   settings->accuracy = gAccuracy;
+   settings->cutoff   = gCutoff;
+   settings->clique   = gClique;
+   settings->minmatch = gMinMatch;
+   settings->verbose  = gVerbose;
+}
+
+
+/************************************************************************/
+/*>void mpSetSettings(MPSETTINGS *settings)
+   ----------------------------------------
+   Sets the settings, correcting them as matchpatch does. Must be called
+   before any patterns or structures are made.
+
+   17.10.26 Original   By: agent
+   17.10.26 Added minmatch By: agent
+   17.10.26 Moved from libmatchpatch.c so the settings can be static
+            By: agent
+   17.10.26 Added verbose By: agent
+*/
+void mpSetSettings(MPSETTINGS *settings)
+{
+   gBin      = (settings->binsize  == 0.0) ? 1.0   : settings->binsize;
+   gAccuracy = (settings->accuracy == 0.0) ? 100.0 : settings->accuracy;
+   gCutoff   = MAX(settings->cutoff, 0.0);
+   gClique   = MAX(settings->clique, 0);
+   gMinMatch = MAX(settings->minmatch, 0);
+   gVerbose  = settings->verbose;
+}
+
+
+/************************************************************************/
+/*>SURFACE *mpiReadDataAndCreateMatrix(FILE *fp)
+   ----------------------------------------------
+   Read the output from matchpatchsurface into a table of residues and
+   create the triangular matrix of binned distances between them.
+   Reading starts at the current position in the file and stops at the
+   end of file or a line starting with > (the start of the next record).
+   The file is read in a single pass so it may be a pipe. Binary files 
+   are passed to ReadBinarySurface().
+   Returns NULL if memory allocation fails.
+
+   18.11.93 Original   By: ACRM
+   22.11.93 Corrected return values
+   19.04.21 Now reads the coordinates and does the distance calculations
+   17.10.26 Stores each residue once and the distances as bins in a
+            triangular matrix instead of copying the residue data into 
+            every pair. Skips lines that can't be parsed. By: agent
+   17.10.26 Creates neighbour lists instead if gCutoff is set By: agent
+   17.10.26 Starts from the current position and stops at a > line By: agent
+   17.10.26 Checks for binary files By: agent
+   17.10.26 Reads the file once, growing the table of residues By: agent
+   17.10.26 Uses CreateDistances() By: agent
+*/
+SURFACE *mpiReadDataAndCreateMatrix(FILE *fp)
+{
+   int     maxres = 0,
+           nmagic = 0,
+           c      = EOF;
+   SURFACE *surf  = NULL;
+   RESIDUE *res;
+   char    buffer[MAXBUFF],
+           properties[MAXBUFF];
+   
+   /* Look for the binary file magic. We can't go back in a pipe so the
+      characters which match it are kept as the start of the first line
+   */
+   while((nmagic < (int)sizeof(SURFBINMAGIC)) &&
+         ((c = getc(fp)) == SURFBINMAGIC[nmagic]))
+      nmagic++;
+   if(nmagic == (int)sizeof(SURFBINMAGIC))
+      return(ReadBinarySurface(fp));
+   if(c != EOF)
+      ungetc(c, fp);
+   memcpy(buffer, SURFBINMAGIC, nmagic);
+
+   if((surf = (SURFACE *)calloc(1, sizeof(SURFACE)))==NULL)
+      return(NULL);
+
+   while(fgets(buffer+nmagic, MAXBUFF-1-nmagic, fp))
+   {
+      nmagic = 0;
+      if(buffer[0] == '>')
+         break;
+
+      /* Grow the table of residues if it is full                       */
+      if(surf->nres == maxres)
+      {
+         maxres = (maxres == 0) ? RESCHUNK : (2 * maxres);
+         if((res = (RESIDUE *)realloc(surf->res, 
+                                      maxres * sizeof(RESIDUE)))==NULL)
+         {
+            mpiFreeSurface(surf);
+            return(NULL);
+         }
+         surf->res = res;
+      }
+      
+      res = &(surf->res[surf->nres]);
+      if(sscanf(buffer,"%s %s %lf %lf %lf %s",
+                res->resnam, res->resid,
+                &res->x, &res->y, &res->z,
+                properties) == 6)
+      {
+         res->properties = ParseProperties(properties);
+         surf->nres++;
+      }
+   }
+
+   /* Now calculate the binned distances                              */
+   if(!CreateDistances(surf))
+   {
+      mpiFreeSurface(surf);
+      return(NULL);
+   }
+
+   return(surf);
+}
+
+
+/************************************************************************/
+/*>static SURFACE *ReadBinarySurface(FILE *fp)
+   ---------------------------------------------
+   Reads a binary surface file (see surfbin.h) from fp where the magic
+   string has just been read. A regular file is mapped into memory; 
+   otherwise (a pipe) the rest of the file is read into memory. If the 
+   file holds distance bins for the current bin size and no cutoff is 
+   used, they are used where they are in the file, which is then kept 
+   with the SURFACE. Otherwise the distances are calculated as for a 
+   text file. Returns NULL (with a message if the file is not valid) 
+   if the file can't be read or memory allocation fails.
+
+   A binary surface in a file of records may start at any offset, so 
+   the header and residues are copied out rather than accessed where 
+   they are. The bins are bytes and may be used in place.
+
+   The file is rejected before anything is built from it if any
+   residue has bits other than the property bits set or any stored
+   bin is one that ConvertDistanceToBin() could not give, since these
+   are used as array indexes and shifts.
+
+   17.10.26 Original   By: agent
+   17.10.26 Reads pipes. No longer takes the start of the file By: agent
+   17.10.26 Copies the header and residues so they need not be aligned
+            By: agent
+   17.10.26 Checks the properties and bins By: agent
+*/
+static SURFACE *ReadBinarySurface(FILE *fp)
+{
+   struct stat   st;
+   SURFBINHEADER *header,
+                 head;
+   SURFBINRES    rec;
+   SURFACE       *surf    = NULL;
+   char          *map     = NULL,
+                 *data,
+                 *recs;
+   unsigned char *bins;
+   size_t        mapsize  = 0,
+                 size,
+                 needed;
+   long          start,
+                 pair;
+   int           i;
+   BOOL          ok       = TRUE,
+                 valid    = TRUE;
+
+   if((fstat(fileno(fp), &st) == 0) && S_ISREG(st.st_mode) &&
+      ((start = ftell(fp) - (long)sizeof(SURFBINMAGIC)) >= 0L))
+   {
+      mapsize = (size_t)st.st_size;
+      if((mapsize < start + sizeof(SURFBINHEADER)) ||
+         ((map = (char *)mmap(NULL, mapsize, PROT_READ, MAP_PRIVATE,
+                              fileno(fp), 0)) == (char *)MAP_FAILED))
+      {
+         fprintf(stderr,"Unable to map binary surface file\n");
+         return(NULL);
+      }
+      data = map + start;
+      size = mapsize - start;
+   }
+   else
+   {
+      /* Read the rest of the header and then the rest of the file      */
+      memcpy(head.magic, SURFBINMAGIC, sizeof(SURFBINMAGIC));
+      if(fread(head.magic + sizeof(SURFBINMAGIC), 
+               sizeof(SURFBINHEADER) - sizeof(SURFBINMAGIC), 1, fp) != 1)
+      {
+         fprintf(stderr,"Binary surface file is truncated\n");
+         return(NULL);
+      }
+      size = sizeof(SURFBINHEADER);
+      if((head.endian == SURFBINENDIAN) && (head.nres >= 0) && 
+         (head.npair >= 0) && (head.recsize == sizeof(SURFBINRES)))
+         size += head.nres * sizeof(SURFBINRES) + head.npair;
+
+      if((map = (char *)malloc(size)) == NULL)
+         return(NULL);
+      memcpy(map, &head, sizeof(SURFBINHEADER));
+      size = sizeof(SURFBINHEADER) + 
+             fread(map + sizeof(SURFBINHEADER), 1, 
+                   size - sizeof(SURFBINHEADER), fp);
+      data = map;
+   }
+
+   memcpy(&head, data, sizeof(SURFBINHEADER));
+   header = &head;
+   recs   = data + sizeof(SURFBINHEADER);
+   needed = sizeof(SURFBINHEADER) + 
+            header->nres * sizeof(SURFBINRES) + header->npair;
+   
+   if((header->endian != SURFBINENDIAN) ||
+      (header->version != SURFBINVERSION) ||
+      (header->recsize != sizeof(SURFBINRES)) ||
+      (header->nres < 0) || (header->npair < 0) || (needed > size))
+   {
+      fprintf(stderr,"Binary surface file is from a different version \
+or machine or is truncated\n");
+      ReleaseSurfaceMap(map, mapsize);
+      return(NULL);
+   }
+
+   for(i=0; valid && (i<header->nres); i++)
+   {
+      memcpy(&rec, recs + (size_t)i * sizeof(SURFBINRES), 
+             sizeof(SURFBINRES));
+      valid = VALIDPROPERTIES(rec.properties);
+   }
+   bins = (unsigned char *)(recs + (size_t)header->nres * 
+                                   sizeof(SURFBINRES));
+   for(pair=0; valid && (pair<header->npair); pair++)
+      valid = (bins[pair] < MAXDIST-1);
+
+   if(!valid)
+   {
+      fprintf(stderr,"Not a valid binary surface\n");
+      ReleaseSurfaceMap(map, mapsize);
+      return(NULL);
+   }
+
+   if(((surf = (SURFACE *)calloc(1, sizeof(SURFACE)))==NULL) ||
+      ((surf->res = (RESIDUE *)malloc(MAX(header->nres,1) * 
+                                      sizeof(RESIDUE)))==NULL))
+   {
+      mpiFreeSurface(surf);
+      ReleaseSurfaceMap(map, mapsize);
+      return(NULL);
+   }
+
+   for(i=0; i<header->nres; i++)
+   {
+      memcpy(&rec, recs + (size_t)i * sizeof(SURFBINRES), 
+             sizeof(SURFBINRES));
+      memcpy(surf->res[i].resnam, rec.resnam, MAXLABEL-1);
+      surf->res[i].resnam[MAXLABEL-1] = '\0';
+      memcpy(surf->res[i].resid, rec.resid, MAXRESID-1);
+      surf->res[i].resid[MAXRESID-1]  = '\0';
+      surf->res[i].properties         = rec.properties;
+      surf->res[i].x                  = (REAL)rec.x;
+      surf->res[i].y                  = (REAL)rec.y;
+      surf->res[i].z                  = (REAL)rec.z;
+   }
+   surf->nres = header->nres;
+
+   if((gCutoff == (REAL)0.0) && (header->npair > 0) &&
+      (header->maxdist == MAXDIST) && ((REAL)header->binsize == gBin) &&
+      (header->npair == mpiPairIndex(surf->nres-1, surf->nres, surf->nres)))
+   {
+      /* Use the stored bins and keep the file                          */
+      surf->npair   = header->npair;
+      surf->bin     = bins;
+      surf->map     = map;
+      surf->mapsize = mapsize;
+   }
+   else
+   {
+      ReleaseSurfaceMap(map, mapsize);
+      ok = CreateDistances(surf);
+   }
+
+   if(!ok)
+   {
+      mpiFreeSurface(surf);
+      return(NULL);
+   }
+
+   return(surf);
+}
+
+
+/************************************************************************/
+/*>static void ReleaseSurfaceMap(char *map, size_t mapsize)
+   --------------------------------------------------------
+   Releases the contents of a binary surface file from ReadBinarySurface()
+   which are mapped if mapsize is not zero or allocated otherwise.
+
+   17.10.26 Original   By: agent
+*/
+static void ReleaseSurfaceMap(char *map, size_t mapsize)
+{
+   if(mapsize)
+      munmap(map, mapsize);
+   else
+      FREE(map);
+}
+
+
+/************************************************************************/
+/*>SURFACE *mpiCreateSurface(RESIDUE *res, int nres)
+   ---------------------------------------------------
+   Creates a SURFACE from a copy of a table of residues, calculating the
+   distances as if it had been read from a file. Returns NULL if there
+   is no memory.
+
+   17.10.26 Original   By: agent
+*/
+SURFACE *mpiCreateSurface(RESIDUE *res, int nres)
+{
+   SURFACE *surf;
+
+   if(((surf = (SURFACE *)calloc(1, sizeof(SURFACE)))==NULL) ||
+      ((surf->res = (RESIDUE *)malloc(MAX(nres,1) * sizeof(RESIDUE)))
+       ==NULL))
+   {
+      mpiFreeSurface(surf);
+      return(NULL);
+   }
+   memcpy(surf->res, res, nres * sizeof(RESIDUE));
+   surf->nres = nres;
+
+   if(!CreateDistances(surf))
+   {
+      mpiFreeSurface(surf);
+      return(NULL);
+   }
+   
+   return(surf);
+}
+
+
+/************************************************************************/
+/*>static BOOL CreateDistances(SURFACE *surf)
+   --------------------------------------------
+   Creates the neighbour lists if gCutoff is set or the distance matrix
+   otherwise. Returns FALSE if there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+static BOOL CreateDistances(SURFACE *surf)
+{
+   if(gCutoff > (REAL)0.0)
+      return(CreateNeighbourLists(surf, gCutoff));
+   return(CreateDistanceMatrix(surf));
+}
+
+
+/************************************************************************/
+/*>static BOOL CreateDistanceMatrix(SURFACE *surf)
+   ------------------------------------------------
+   Fill in the triangular matrix of binned distances between all pairs
+   of residues in a SURFACE. Returns FALSE if there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+static BOOL CreateDistanceMatrix(SURFACE *surf)
+{
+   int i, j;
+   
+   /* We need the distances between these residues which is one 
+      off-diagonal triangle from the matrix
+   */
+   surf->npair = mpiPairIndex(surf->nres-1, surf->nres, surf->nres);
+   if((surf->bin = (unsigned char *)malloc(MAX(surf->npair,1)))==NULL)
+      return(FALSE);
+
+   for(i=0; i<surf->nres; i++)
+   {
+      for(j=i+1; j<surf->nres; j++)
+      {
+         surf->bin[mpiPairIndex(i, j, surf->nres)] = 
+            (unsigned char)ConvertDistanceToBin(DIST(&(surf->res[i]),
+                                                     &(surf->res[j])));
+      }
+   }
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>static BOOL CreateNeighbourLists(SURFACE *surf, REAL cutoff)
+   -------------------------------------------------------------
+   Create lists of the neighbours of each residue within the cutoff 
+   distance, together with their binned distances. The residues are
+   placed in a grid of cells at least cutoff across so the neighbours of
+   a residue can only be in the 27 cells around it. This is done twice:
+   first to count the neighbours and then to fill them in. Returns FALSE
+   if there is no memory.
+
+   17.10.26 Original   By: agent
+   17.10.26 Counts the cells as a REAL so a tiny cutoff doesn't overflow
+            By: agent
+*/
+static BOOL CreateNeighbourLists(SURFACE *surf, REAL cutoff)
+{
+   int  *head     = NULL,
+        *next     = NULL,
+        *cell     = NULL,
+        ncell[3],
+        pass, i, j, c,
+        dx, dy, dz,
+        cx, cy, cz,
+        n         = 0;
+   REAL min[3],
+        max[3],
+        ncells,
+        size      = cutoff,
+        cutoffsq  = cutoff * cutoff;
+   RESIDUE *res   = surf->res;
+
+   /* Find the bounds of the residues                                   */
+   min[0] = max[0] = (surf->nres ? res[0].x : (REAL)0.0);
+   min[1] = max[1] = (surf->nres ? res[0].y : (REAL)0.0);
+   min[2] = max[2] = (surf->nres ? res[0].z : (REAL)0.0);
+   for(i=1; i<surf->nres; i++)
+   {
+      min[0] = MIN(min[0], res[i].x);   max[0] = MAX(max[0], res[i].x);
+      min[1] = MIN(min[1], res[i].y);   max[1] = MAX(max[1], res[i].y);
+      min[2] = MIN(min[2], res[i].z);   max[2] = MAX(max[2], res[i].z);
+   }
+
+   /* Work out the grid size, making the cells bigger if there would be
+      far more cells than residues. The number of cells is worked out as
+      a REAL since a tiny cutoff would overflow an int; once it is small
+      enough each dimension fits in an int
+   */
+   for(;;)
+   {
+      ncells = (REAL)1.0;
+      for(c=0; c<3; c++)
+         ncells *= (REAL)1.0 + floor((max[c] - min[c]) / size);
+      if(ncells <= (REAL)MAXCELLRATIO * (REAL)(surf->nres + 1))
+         break;
+      size *= (REAL)2.0;
+   }
+   for(c=0; c<3; c++)
+      ncell[c] = 1 + (int)((max[c] - min[c]) / size);
+
+   /* Allocate memory                                                   */
+   head           = (int *)malloc(ncell[0]*ncell[1]*ncell[2] * sizeof(int));
+   next           = (int *)malloc(MAX(surf->nres,1) * sizeof(int));
+   cell           = (int *)malloc(3 * MAX(surf->nres,1) * sizeof(int));
+   surf->nbrstart = (int *)malloc((surf->nres + 1) * sizeof(int));
+   if((head == NULL) || (next == NULL) || (cell == NULL) || 
+      (surf->nbrstart == NULL))
+   {
+      FREE(head);
+      FREE(next);
+      FREE(cell);
+      return(FALSE);
+   }
+
+   /* Place each residue in a linked list for its cell                  */
+   for(c=0; c<ncell[0]*ncell[1]*ncell[2]; c++)
+      head[c] = (-1);
+   for(i=0; i<surf->nres; i++)
+   {
+      cell[3*i]   = (int)((res[i].x - min[0]) / size);
+      cell[3*i+1] = (int)((res[i].y - min[1]) / size);
+      cell[3*i+2] = (int)((res[i].z - min[2]) / size);
+      c = (cell[3*i] * ncell[1] + cell[3*i+1]) * ncell[2] + cell[3*i+2];
+      next[i] = head[c];
+      head[c] = i;
+   }
+
+   /* Pass 0 counts the neighbours, pass 1 stores them                  */
+   for(pass=0; pass<2; pass++)
+   {
+      if(pass)
+      {
+         surf->nbr    = (int *)malloc(MAX(n,1) * sizeof(int));
+         surf->nbrbin = (unsigned char *)malloc(MAX(n,1));
+         if((surf->nbr == NULL) || (surf->nbrbin == NULL))
+         {
+            FREE(head);
+            FREE(next);
+            FREE(cell);
+            return(FALSE);
+         }
+         surf->npair = n / 2;
+      }
+      
+      for(n=0, i=0; i<surf->nres; i++)
+      {
+         surf->nbrstart[i] = n;
+         for(dx=(-1); dx<=1; dx++)
+         {
+            cx = cell[3*i] + dx;
+            if((cx < 0) || (cx >= ncell[0])) continue;
+            for(dy=(-1); dy<=1; dy++)
+            {
+               cy = cell[3*i+1] + dy;
+               if((cy < 0) || (cy >= ncell[1])) continue;
+               for(dz=(-1); dz<=1; dz++)
+               {
+                  cz = cell[3*i+2] + dz;
+                  if((cz < 0) || (cz >= ncell[2])) continue;
+
+                  c = (cx * ncell[1] + cy) * ncell[2] + cz;
+                  for(j=head[c]; j!=(-1); j=next[j])
+                  {
+                     if((j != i) && (DISTSQ(&(res[i]), &(res[j])) <= 
+                                     cutoffsq))
+                     {
+                        if(pass)
+                        {
+                           surf->nbr[n]    = j;
+                           surf->nbrbin[n] = (unsigned char)
+                              ConvertDistanceToBin(DIST(&(res[i]),
+                                                        &(res[j])));
+                        }
+                        n++;
+                     }
+                  }
+               }
+            }
+         }
+      }
+      surf->nbrstart[surf->nres] = n;
+   }
+
+   FREE(head);
+   FREE(next);
+   FREE(cell);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL mpiCreateSignature(SURFACE *surf)
+   ---------------------------------------
+   Creates the signature of a structure. For each ordered pair of 
+   property sets (p1, p2), word SIGWORD(p1, p2) has the flag set for 
+   each distance bin at which a residue with properties p1 has a 
+   neighbour with properties p2. This uses the same distances as the
+   atom array. Returns FALSE if there is no memory.
+
+   17.10.26 Original   By: agent
+*/
+BOOL mpiCreateSignature(SURFACE *surf)
+{
+   int i, j, k,
+       prop1, prop2,
+       bin;
+
+   if((surf->sig = (DISTBITS *)calloc(NSIGWORD, sizeof(DISTBITS)))
+      == NULL)
+      return(FALSE);
+
+   for(i=0; i<surf->nres; i++)
+   {
+      prop1 = surf->res[i].properties;
+
+      if(surf->bin == NULL)
+      {
+         /* Each pair is in both neighbour lists                        */
+         for(k=surf->nbrstart[i]; k<surf->nbrstart[i+1]; k++)
+         {
+            prop2 = surf->res[surf->nbr[k]].properties;
+            surf->sig[SIGWORD(prop1, prop2)] |= DISTBIT(surf->nbrbin[k]);
+         }
+      }
+      else
+      {
+         for(j=i+1; j<surf->nres; j++)
+         {
+            prop2 = surf->res[j].properties;
+            bin   = surf->bin[mpiPairIndex(i, j, surf->nres)];
+            surf->sig[SIGWORD(prop1, prop2)] |= DISTBIT(bin);
+            surf->sig[SIGWORD(prop2, prop1)] |= DISTBIT(bin);
+         }
+      }
+   }
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>static BOOL SignatureCovers(DISTBITS *sig, int NPatAtom, ATOM *PatAtom)
+   -------------------------------------------------------------------------
+   Checks whether a structure with signature sig could match the 
+   pattern atoms. Returns FALSE only if mpiDoLesk() is sure to find no
+   matches.
+
+   A match pairs a pattern atom with a live structure atom with the
+   same properties, p1, whose trimmed bit strings share a distance bin.
+   The structure atom only has that bin because of a live neighbour, 
+   and every live structure atom has the properties, p2, of some 
+   pattern atom. So the structure must have a pair (p1, p2) at a bin 
+   which a pattern atom with properties p1 has. Nothing stronger can be
+   said using gAccuracy since the bins missing from the structure are 
+   trimmed from the pattern before the percentage is calculated.
+
+   17.10.26 Original   By: agent
+*/
+static BOOL SignatureCovers(DISTBITS *sig, int NPatAtom, ATOM *PatAtom)
+{
+   DISTBITS bins[NPROPSETS];
+   int      props[NPROPSETS],
+            nprops = 0,
+            i, j;
+
+   /* Find the bins of the pattern atoms with each set of properties   */
+   for(i=0; i<NPROPSETS; i++)
+      bins[i] = (DISTBITS)0;
+   for(i=0; i<NPatAtom; i++)
+   {
+      if(PatAtom[i].alive)
+      {
+         if(bins[PatAtom[i].properties] == (DISTBITS)0)
+            props[nprops++] = PatAtom[i].properties;
+         bins[PatAtom[i].properties] |= PatAtom[i].dist;
+      }
+   }
+
+   for(i=0; i<nprops; i++)
+   {
+      for(j=0; j<nprops; j++)
+      {
+         if(sig[SIGWORD(props[i], props[j])] & bins[props[i]])
+            return(TRUE);
+      }
+   }
+   return(FALSE);
+}
+
+
+/************************************************************************/
+/*>void mpiFreeSurface(SURFACE *surf)
+   -----------------------------------
+   Free a SURFACE created by mpiReadDataAndCreateMatrix(). NULL is ignored.
+
+   17.10.26 Original   By: agent
+   17.10.26 Unmaps binary files By: agent
+   17.10.26 Frees the signature By: agent
+*/
+void mpiFreeSurface(SURFACE *surf)
+{
+   if(surf != NULL)
+   {
+      FREE(surf->res);
+      if(surf->map != NULL)
+         ReleaseSurfaceMap(surf->map, surf->mapsize);
+      else
+         FREE(surf->bin);
+      FREE(surf->nbrbin);
+      FREE(surf->nbrstart);
+      FREE(surf->nbr);
+      FREE(surf->sig);
+      free(surf);
+   }
+}
+
+
+/************************************************************************/
+/*>static int ParseProperties(char *properties)
+   --------------------------------------------
+   Converts a property string as written by matchpatchsurface (a '0' or
+   '1' for each property) to a set of bit flags
+
+   17.10.26 Original   By: agent
+*/
+static int ParseProperties(char *properties)
+{
+   int i,
+       flags = 0;
+
+   for(i=0; (i<MAXPROPERTIES) && properties[i]; i++)
+   {
+      if(properties[i] == '1')
+         flags |= (1 << i);
+   }
+   return(flags);
+}
+
+
+/************************************************************************/
+/*>ATOM *mpiCreateAtomArray(SURFACE *surf, BOOL SwapProp)
+   ------------------------------------------------------
+   Create the array of atoms with their distance bit strings from the
+   residues and distances in a SURFACE. Atom i is residue i. The array 
+   is built just once; mpiDoLesk() then keeps it up to date through 
+   KillAtom(). Residues with no neighbours are not made alive.
+
+   19.11.93 Original   By: ACRM
+   17.10.26 Now takes the number of atoms and indexes the atoms directly
+            instead of searching for them with GotAtom(). Skips pairs
+            that are dead. By: agent
+   17.10.26 Takes a SURFACE By: agent
+   17.10.26 Handles neighbour lists By: agent
+   17.10.26 The position in the distance matrix is a long By: agent
+*/
+ATOM *mpiCreateAtomArray(SURFACE *surf, BOOL SwapProp)
+{
+   int  i, j, k;
+   long pos = 0;
+   ATOM *outatom;
+
+   /* Allocate memory for the output atom array. This also clears the
+      alive flags so FillAtom() knows which atoms are new
+   */
+   if((outatom = (ATOM *)calloc(MAX(surf->nres, 1), sizeof(ATOM)))
+      == NULL)
+      return(NULL);
+
+   if(surf->bin == NULL)
+   {
+      /* Neighbour lists contain each pair twice                        */
+      for(i=0; i<surf->nres; i++)
+      {
+         for(k=surf->nbrstart[i]; k<surf->nbrstart[i+1]; k++)
+         {
+            FillAtom(&(outatom[i]), &(surf->res[i]), surf->nbrbin[k],
+                     SwapProp);
+         }
+      }
+   }
+   else
+   {
+      for(i=0; i<surf->nres; i++)
+      {
+         for(j=i+1; j<surf->nres; j++, pos++)
+         {
+            FillAtom(&(outatom[i]), &(surf->res[i]), surf->bin[pos],
+                     SwapProp);
+            FillAtom(&(outatom[j]), &(surf->res[j]), surf->bin[pos],
+                     SwapProp);
+         }
+      }
+   }
+
+   return(outatom);
+}
+
+
+/************************************************************************/
+/*>static int ConvertDistanceToBin(REAL dist)
+   ------------------------------
+   Converts a distance (REAL) to an integer bin number < MAXDIST. The bin
+   size is read from the global variable gBin
+
+   19.11.93 Original   By: ACRM
+   22.11.93 Changed to read bin size from global gBin
+*/
+static int ConvertDistanceToBin(REAL dist)
+{
+   int idist;
+
+   idist = (int)(dist/gBin);
+   if(idist >= MAXDIST-1) idist = MAXDIST-2;
+
+   return(idist);
+}
+
+
+/************************************************************************/
+/*>long mpiPairIndex(int i, int j, int natom)
+   -------------------------------------------
+   Returns the index into the triangular distance matrix created by 
+   mpiReadDataAndCreateMatrix() of the distance between atoms i and j
+   (where i < j)
+
+   17.10.26 Original   By: agent
+   17.10.26 Returns a long as the int overflowed above about 46000 atoms
+            By: agent
+*/
+long mpiPairIndex(int i, int j, int natom)
+{
+   return(((long)i * (2L * natom - i - 1)) / 2 + (j - i - 1));
+}
+
+
+/************************************************************************/
+/*>static void FillAtom(ATOM *atom, RESIDUE *res, int DistRange, 
+                        BOOL SwapProp)
+   ---------------------------------------------------------------------
+   Fill in an item in the atom array. If the atom is not yet alive then 
+   it's a new residue so we must fill in all data; otherwise just set the
+   appropriate flags.
+
+   19.11.93 Original   By: ACRM
+   22.11.93 Added aromatic support
+   19.05.94 Added DNA support
+   19.04.21 Changed to resid
+   17.10.26 Distances are now a packed DISTBITS word By: agent
+   17.10.26 Takes a pointer to the atom itself and keeps a count of the
+            atoms in each distance bin By: agent
+   17.10.26 Points to the residue rather than copying it By: agent
+*/
+static void FillAtom(ATOM *atom, RESIDUE *res, int DistRange, BOOL SwapProp)
+{
+   if(!atom->alive)
+   {
+      /* A new residue; fill in all data                                */
+      atom->res        = res;
+      atom->properties = res->properties;
+
+      if(SwapProp)
+      {
+         atom->properties &= ~((1 << PROP_POSITIVE) | 
+                               (1 << PROP_NEGATIVE));
+         if(res->properties & (1 << PROP_POSITIVE))
+            atom->properties |= (1 << PROP_NEGATIVE);
+         if(res->properties & (1 << PROP_NEGATIVE))
+            atom->properties |= (1 << PROP_POSITIVE);
+      }
+
+      atom->alive = TRUE;
+      atom->dirty = TRUE;
+   }
+
+   /* Now set the distance flag                                         */
+   atom->count[DistRange]++;
+   atom->dist |= DISTBIT(DistRange);
+}
+
+
+/************************************************************************/
+/*>int mpiDoLesk(SURFACE *pat, ATOM *PatAtom, SURFACE *struc, 
+                   ATOM *StrucAtom, MATCHPAIR *match, int minmatch,
+                   BOOL verbose)
+   ---------------------------------------------------------------------
+   Does the actual Lesk pattern matching algorithm (with some 
+   modifications). PatAtom and StrucAtom are the atom arrays created by
+   mpiCreateAtomArray(). Only the trimmed bit strings of PatAtom are 
+   changed so it may be reused for other structures. StrucAtom is 
+   refined so a fresh copy is needed for each pattern. The matches are 
+   placed in match[] which must have room for one for each pattern 
+   atom. If the structure has a signature which shows that it can't 
+   match, the algorithm isn't run. Returns the number of matches or -1 
+   on error. The matches are found from the atoms which survive by 
+   FindMatches() or, if gClique is set, FindCliqueMatches().
+
+   Each structure atom to be checked is compared with the fingerprints
+   of all the pattern atoms at once by MatchFingerprints().
+
+   If there are fewer than minmatch matches, none are returned. The 
+   refinement stops as soon as CountPossibleMatches() shows that 
+   minmatch can't be reached, so hopeless structures are dropped after
+   an iteration or two.
+
+   The atom arrays are created once. Killing a structure atom only
+   changes the distance flags of the other atoms and these are placed on
+   a worklist; only atoms on the worklist are checked again on the next
+   iteration. All atoms are checked if the trimmed pattern flags change.
+   As before, all the atoms to be killed in an iteration are decided 
+   from the state at the start of that iteration.
+
+   19.11.93 Original   By: ACRM
+   21.11.93 Added property comparison and printing of results :-)
+   16.04.21 Added invert parameter instead of always inverting the pattern
+   19.04.21 Added verbose parameter
+   17.10.26 Builds the atom arrays once and refines them incrementally.
+            Now takes the number of atoms as well as number of distances
+            By: agent
+   17.10.26 Takes SURFACEs By: agent
+   17.10.26 Takes the pattern atom array instead of creating it. Added
+            label By: agent
+   17.10.26 Takes the structure atom array as well By: agent
+   17.10.26 Skips structures whose signature can't match the pattern By: agent
+   17.10.26 Returns the number of matches By: agent
+   17.10.26 Uses PrintCliqueResults() if gClique is set By: agent
+   17.10.26 Returns the matches instead of printing them By: agent
+   17.10.26 Added minmatch By: agent
+   17.10.26 Checks the structure atoms with MatchFingerprints() By: agent
+*/
+int mpiDoLesk(SURFACE *pat, ATOM *PatAtom, SURFACE *struc, ATOM *StrucAtom,
+              MATCHPAIR *match, int minmatch, BOOL verbose)
+{
+   int      *worklist      = NULL,
+            *checklist     = NULL;
+   int      NPatLive       = 0,
+            NStrucLive     = 0,
+            NPatRemain     = 0,
+            NStrucRemain   = 0,
+            PrevPatAtoms   = 0,
+            PrevStrucAtoms = 0,
+            NPatAtom       = pat->nres,
+            NStrucAtom     = struc->nres,
+            nwork          = 0,
+            nmatch         = -1,
+            ncheck,
+            i, j, w;
+   DISTBITS StrucHits      = (DISTBITS)0,
+            PrevStrucHits  = (DISTBITS)0;
+   BOOL     hopeless       = FALSE;
+   FINGERPRINTS prints;
+
+   /* Give no matches straight away if the signature rules them out     */
+   if((struc->sig != NULL) && 
+      !SignatureCovers(struc->sig, NPatAtom, PatAtom))
+   {
+      if(verbose)
+         fprintf(stderr, "Structure signature can't match the pattern\n");
+      return(0);
+   }
+   
+   worklist  = (int *)malloc(MAX(NStrucAtom, 1) * sizeof(int));
+   checklist = (int *)malloc(MAX(NStrucAtom, 1) * sizeof(int));
+
+   if(!CreateFingerprints(&prints, NPatAtom) ||
+      (worklist == NULL) || (checklist == NULL))
+   {
+      fprintf(stderr,"No memory for atom arrays\n");
+      FreeFingerprints(&prints);
+      FREE(worklist);
+      FREE(checklist);
+      return(-1);
+   }
+
+   /* Count the atoms that are present and start with all the structure
+      atoms on the worklist
+   */
+   for(j=0; j<NPatAtom; j++)
+   {
+      if(PatAtom[j].alive) NPatLive++;
+   }
+   for(j=0; j<NStrucAtom; j++)
+   {
+      if(StrucAtom[j].alive)
+      {
+         NStrucLive++;
+         worklist[nwork++] = j;
+      }
+   }
+
+   for(i=0; i<MAXITER; i++)
+   {
+      /* A lone atom has no distances so doesn't count as remaining     */
+      NPatRemain   = (NPatLive   > 1) ? NPatLive   : 0;
+      NStrucRemain = (NStrucLive > 1) ? NStrucLive : 0;
+
+      /* Print information on remaining atoms                           */
+      if(verbose)
+      {
+         fprintf(stderr, "Iteration %d: %d pattern atoms and %d \
+structure atoms remain\n",i,NPatRemain,NStrucRemain);
+      }
+
+      /* Remove any distance flags from the bit strings which are 
+         never seen in the other structure
+      */
+      StrucHits = TrimBitStrings(NPatAtom, PatAtom, NStrucAtom, StrucAtom);
+
+      /* Give up if too few pattern atoms can still be matched          */
+      if((minmatch > 0) &&
+         (CountPossibleMatches((NPatRemain   ? NPatAtom   : 0), PatAtom,
+                               (NStrucRemain ? NStrucAtom : 0), 
+                               StrucAtom) < minmatch))
+      {
+         if(verbose)
+            fprintf(stderr, "Fewer than %d matches are possible\n", 
+                    minmatch);
+         hopeless = TRUE;
+         break;
+      }
+
+      /* Exit if we've converged                                        */
+      if(NPatRemain == PrevPatAtoms && NStrucRemain == PrevStrucAtoms)
+         break;
+      PrevPatAtoms   = NPatRemain;
+      PrevStrucAtoms = NStrucRemain;
+         
+#ifdef DEBUG
+      fprintf(stderr, "\nPattern atoms are:\n");
+      for(j=0;j<NPatAtom;j++)
+      {
+         if(PatAtom[j].alive)
+            fprintf(stderr, "Property: %02x; Distance: %08lx\n",
+                    PatAtom[j].properties, PatAtom[j].trim);
+      }
+
+      fprintf(stderr, "\nStructure atoms are:\n");
+      for(j=0;j<NStrucAtom;j++)
+      {
+         if(StrucAtom[j].alive)
+            fprintf(stderr, "Property: %02x; Distance: %08lx\n",
+                    StrucAtom[j].properties, StrucAtom[j].trim);
+      }
+#endif      
+
+      /* If the pattern bit strings have been trimmed differently, every
+         structure atom must be checked again. Otherwise we only need to
+         check the atoms whose bit strings have changed.
+      */
+      if(StrucHits != PrevStrucHits)
+      {
+         for(nwork=0, j=0; j<NStrucAtom; j++)
+         {
+            if(StrucAtom[j].alive) worklist[nwork++] = j;
+         }
+      }
+      PrevStrucHits = StrucHits;
+
+      /* Take the atoms to check off the worklist. Killing an atom adds 
+         its neighbours to the worklist for the next iteration.
+      */
+      qsort(worklist, nwork, sizeof(int), CompareInts);
+      for(ncheck=0, w=0; w<nwork; w++)
+      {
+         j = worklist[w];
+         StrucAtom[j].dirty = FALSE;
+         if(StrucAtom[j].alive) checklist[ncheck++] = j;
+      }
+      nwork = 0;
+      if(!NStrucRemain) ncheck = 0;
+
+      /* For each atom in the structure look to see if the bit string is
+         not found in the pattern. If not found, kill the atom
+      */
+      if(ncheck)
+         FillFingerprints(&prints, NPatAtom, PatAtom);
+      for(w=0; w<ncheck; w++)
+      {
+         j = checklist[w];
+         if(!MatchFingerprints(&prints, StrucAtom[j].properties,
+                               StrucAtom[j].trim))
+         {
+            KillAtom(j, StrucAtom, struc, worklist, &nwork);
+            NStrucLive--;
+            if(verbose)
+            {
+               fprintf(stderr, "Structure atom: %s %-5s killed\n",
+                       StrucAtom[j].res->resnam, StrucAtom[j].res->resid);
+            }
+         }
+      }
+   }
+
+   if(hopeless)
+   {
+      nmatch = 0;
+   }
+   else if(i==MAXITER)
+   {
+      fprintf(stderr,"Error: Too many iterations - increase MAXITER\n");
+   }
+   else if(gClique)
+   {
+      nmatch = FindCliqueMatches((NPatRemain   ? NPatAtom   : 0), PatAtom,
+                                 (NStrucRemain ? NStrucAtom : 0), 
+                                 StrucAtom, match, verbose);
+   }
+   else
+   {
+      nmatch = FindMatches((NPatRemain   ? NPatAtom   : 0), PatAtom,
+                           (NStrucRemain ? NStrucAtom : 0), StrucAtom,
+                           match);
+   }
+
+   if(nmatch < minmatch)
+      nmatch = MIN(nmatch, 0);
+   
+   FreeFingerprints(&prints);
+   FREE(worklist);
+   FREE(checklist);
+   return(nmatch);
+}
+
+
+/************************************************************************/
+/*>static int CountPossibleMatches(int NPatAtom,   ATOM *PatAtom, 
+                                    int NStrucAtom, ATOM *StrucAtom)
+   -----------------------------------------------------------------
+   Returns the most matches that mpiDoLesk() could still find. A pattern 
+   atom can only be matched by a live structure atom with the same 
+   properties whose trimmed bit string shares a flag with its own, and 
+   the bit strings only lose flags as the refinement goes on. Several
+   pattern atoms may be matched by the same structure atom so this is
+   the number of pattern atoms sharing a flag with the union of the 
+   bit strings of the structure atoms with their properties; with 
+   gClique each structure atom is used once so it is also no more than
+   the number of live structure atoms.
+
+   17.10.26 Original   By: agent
+*/
+static int CountPossibleMatches(int NPatAtom,   ATOM *PatAtom, 
+                                int NStrucAtom, ATOM *StrucAtom)
+{
+   DISTBITS hits[NPROPSETS];
+   int      npossible  = 0,
+            NStrucLive = 0,
+            i;
+
+   /* With no required agreement, a match need share no flags           */
+   if((gAccuracy <= 0.0) && gClique)
+      return(MIN(NPatAtom, NStrucAtom));
+
+   for(i=0; i<NPROPSETS; i++)
+      hits[i] = (DISTBITS)0;
+   for(i=0; i<NStrucAtom; i++)
+   {
+      if(StrucAtom[i].alive)
+      {
+         hits[StrucAtom[i].properties] |= StrucAtom[i].trim;
+         NStrucLive++;
+      }
+   }
+
+   for(i=0; i<NPatAtom; i++)
+   {
+      if(PatAtom[i].alive && 
+         (PatAtom[i].trim & hits[PatAtom[i].properties]))
+         npossible++;
+   }
+
+   return(gClique ? MIN(npossible, NStrucLive) : npossible);
+}
+
+
+/************************************************************************/
+/*>int mpiDoWindowedLesk(SURFACE *pat, ATOM *PatAtom, SURFACE *struc, 
+                          ATOM *StrucAtom, MATCHPAIR *match, int *centre,
+                          int minmatch, BOOL verbose)
+   ---------------------------------------------------------------------
+   Matches the pattern against a window around each residue of the 
+   structure rather than against the whole structure and gives the 
+   matches for the window with the most (the first if there is a tie) 
+   as mpiDoLesk() would, with centre set to the residue at its centre. A 
+   window is the residues within the largest distance in the pattern 
+   plus one bin of its centre, so a match can only involve residues 
+   that are close enough together to be the pattern. The windows are 
+   found with the neighbour lists from CreateNeighbourLists().
+
+   If the pattern is too big for the windows to be useful or the
+   structure's signature rules out a match, the whole structure is 
+   matched with mpiDoLesk() using StrucAtom. centre is then -1, as it is
+   if no window matches. Returns the number of matches or -1 on error.
+
+   As for mpiDoLesk(), no matches are returned if there are fewer than 
+   minmatch. Each window only needs more matches than the best so far,
+   so mpiDoLesk() is told to give up on any that can't beat it.
+
+   17.10.26 Original   By: agent
+   17.10.26 Returns the matches instead of printing them By: agent
+   17.10.26 Added minmatch By: agent
+*/
+int mpiDoWindowedLesk(SURFACE *pat, ATOM *PatAtom, SURFACE *struc, 
+                      ATOM *StrucAtom, MATCHPAIR *match, int *centre,
+                      int minmatch, BOOL verbose)
+{
+   SURFACE   windows,
+             *win      = NULL;
+   ATOM      *WinAtom  = NULL;
+   MATCHPAIR *WinMatch = NULL;
+   int       *member   = NULL,
+             *winof    = NULL,
+             nmember,
+             nmatch,
+             BestMatch = 0,
+             i, j, k;
+   REAL      radius    = (REAL)0.0;
+
+   *centre = (-1);
+
+   /* The window radius is the size of the pattern plus one bin         */
+   for(i=0; i<pat->nres; i++)
+   {
+      for(j=i+1; j<pat->nres; j++)
+      {
+         radius = MAX(radius, DIST(&(pat->res[i]), &(pat->res[j])));
+      }
+   }
+   radius += gBin;
+
+   if((radius >= (MAXDIST-2) * gBin) ||
+      ((struc->sig != NULL) && 
+       !SignatureCovers(struc->sig, pat->nres, PatAtom)))
+   {
+      if(verbose)
+         fprintf(stderr, "Matching the whole structure\n");
+      return(mpiDoLesk(pat, PatAtom, struc, StrucAtom, match, minmatch,
+                       verbose));
+   }
+
+   /* Use the neighbour lists of a copy of the structure to find the
+      residues in each window
+   */
+   windows.res      = struc->res;
+   windows.nres     = struc->nres;
+   windows.bin      = NULL;
+   windows.nbrbin   = NULL;
+   windows.nbrstart = NULL;
+   windows.nbr      = NULL;
+   member   = (int *)malloc(MAX(struc->nres, 1) * sizeof(int));
+   winof    = (int *)malloc(MAX(struc->nres, 1) * sizeof(int));
+   WinMatch = (MATCHPAIR *)malloc(MAX(pat->nres, 1) * sizeof(MATCHPAIR));
+   if((member == NULL) || (winof == NULL) || (WinMatch == NULL) ||
+      !CreateNeighbourLists(&windows, radius))
+   {
+      fprintf(stderr,"No memory for structure windows\n");
+      BestMatch = (-1);
+   }
+   else
+   {
+      for(i=0; i<struc->nres; i++)
+         winof[i] = (-1);
+   }
+
+   /* Match each window, keeping the matches for the one with most. The
+      window's structure atoms are converted back to the structure's
+   */
+   for(k=0; (BestMatch >= 0) && (k<struc->nres); k++)
+   {
+      nmember = 0;
+      member[nmember++] = k;
+      for(j=windows.nbrstart[k]; j<windows.nbrstart[k+1]; j++)
+         member[nmember++] = windows.nbr[j];
+      qsort(member, nmember, sizeof(int), CompareInts);
+      
+      if(((win = CreateWindowSurface(struc, member, nmember, winof)) 
+          == NULL) ||
+         ((WinAtom = mpiCreateAtomArray(win, FALSE)) == NULL))
+      {
+         fprintf(stderr,"No memory for structure window\n");
+         mpiFreeSurface(win);
+         BestMatch = (-1);
+         break;
+      }
+
+      nmatch = mpiDoLesk(pat, PatAtom, win, WinAtom, WinMatch, 
+                         MAX(minmatch, BestMatch+1), FALSE);
+      if(verbose)
+         fprintf(stderr, "Window around %s: %d residues, %d matches\n",
+                 struc->res[k].resid, nmember, nmatch);
+      if(nmatch > BestMatch)
+      {
+         BestMatch = nmatch;
+         *centre   = k;
+         for(i=0; i<nmatch; i++)
+         {
+            match[i]       = WinMatch[i];
+            match[i].struc = member[WinMatch[i].struc];
+         }
+      }
+      
+      FREE(WinAtom);
+      mpiFreeSurface(win);
+   }
+
+   FREE(member);
+   FREE(winof);
+   FREE(WinMatch);
+   FREE(windows.nbr);
+   FREE(windows.nbrbin);
+   FREE(windows.nbrstart);
+   return(BestMatch);
+}
+
+
+/************************************************************************/
+/*>static SURFACE *CreateWindowSurface(SURFACE *struc, int *member, 
+                                       int nmember, int *winof)
+   ------------------------------------------------------------------
+   Creates a SURFACE from the residues of struc listed (in order) in 
+   member[]. The distances are taken from the distance matrix or the 
+   neighbour lists of struc so they are not calculated again. winof[] 
+   must have an entry for each residue of struc set to -1; it is used 
+   to find the residues in the window and is reset before returning.
+   Returns NULL if there is no memory.
+
+   17.10.26 Original   By: agent
+   17.10.26 The position in the distance matrix is a long By: agent
+*/
+static SURFACE *CreateWindowSurface(SURFACE *struc, int *member, int nmember,
+                                    int *winof)
+{
+   SURFACE *win;
+   int     i, j, k,
+           n = 0;
+   long    pos = 0;
+
+   if((win = (SURFACE *)calloc(1, sizeof(SURFACE))) == NULL)
+      return(NULL);
+   win->nres = nmember;
+   if((win->res = (RESIDUE *)malloc(MAX(nmember, 1) * sizeof(RESIDUE)))
+      == NULL)
+   {
+      mpiFreeSurface(win);
+      return(NULL);
+   }
+   for(i=0; i<nmember; i++)
+      win->res[i] = struc->res[member[i]];
+
+   if(struc->bin != NULL)
+   {
+      /* Take the part of the distance matrix for these residues        */
+      win->npair = ((long)nmember * (nmember - 1)) / 2;
+      if((win->bin = (unsigned char *)malloc(MAX(win->npair, 1)))
+         == NULL)
+      {
+         mpiFreeSurface(win);
+         return(NULL);
+      }
+      for(i=0; i<nmember; i++)
+      {
+         for(j=i+1; j<nmember; j++)
+         {
+            win->bin[pos++] = 
+               struc->bin[mpiPairIndex(member[i], member[j], struc->nres)];
+         }
+      }
+      return(win);
+   }
+
+   /* Keep the neighbours which are in the window                       */
+   for(i=0; i<nmember; i++)
+      winof[member[i]] = i;
+   
+   for(i=0; i<nmember; i++)
+   {
+      for(k=struc->nbrstart[member[i]]; k<struc->nbrstart[member[i]+1];
+          k++)
+      {
+         if(winof[struc->nbr[k]] != (-1)) n++;
+      }
+   }
+   win->nbrstart = (int *)malloc((nmember + 1) * sizeof(int));
+   win->nbr      = (int *)malloc(MAX(n, 1) * sizeof(int));
+   win->nbrbin   = (unsigned char *)malloc(MAX(n, 1));
+   if((win->nbrstart != NULL) && (win->nbr != NULL) && 
+      (win->nbrbin != NULL))
+   {
+      win->npair = n / 2;
+      for(n=0, i=0; i<nmember; i++)
+      {
+         win->nbrstart[i] = n;
+         for(k=struc->nbrstart[member[i]]; 
+             k<struc->nbrstart[member[i]+1]; 
+             k++)
+         {
+            if((j = winof[struc->nbr[k]]) != (-1))
+            {
+               win->nbr[n]    = j;
+               win->nbrbin[n] = struc->nbrbin[k];
+               n++;
+            }
+         }
+      }
+      win->nbrstart[nmember] = n;
+   }
+   else
+   {
+      mpiFreeSurface(win);
+      win = NULL;
+   }
+
+   for(i=0; i<nmember; i++)
+      winof[member[i]] = (-1);
+
+   return(win);
+}
+
+
+/************************************************************************/
+/*>static void KillAtom(int dead, ATOM *atoms, SURFACE *surf,
+                        int *worklist, int *nwork)
+   -----------------------------------------------------------
+   Kill an atom. The distance from the atom to each of the remaining live
+   atoms is removed from their bin counts; any atom which loses a distance
+   flag as a result is added to the worklist.
+
+   19.11.93 Original   By: ACRM
+   17.10.26 Now works on the atom array rather than setting dead flags in
+            the data array By: agent
+   17.10.26 Takes the distance bins from a SURFACE By: agent
+   17.10.26 Handles neighbour lists By: agent
+*/
+static void KillAtom(int dead, ATOM *atoms, SURFACE *surf,
+                     int *worklist, int *nwork)
+{
+   int i, k,
+       bin,
+       start = 0,
+       stop  = surf->nres;
+
+   atoms[dead].alive = FALSE;
+
+   if(surf->bin == NULL)
+   {
+      start = surf->nbrstart[dead];
+      stop  = surf->nbrstart[dead+1];
+   }
+
+   for(k=start; k<stop; k++)
+   {
+      if(surf->bin == NULL)
+      {
+         i   = surf->nbr[k];
+         bin = surf->nbrbin[k];
+      }
+      else
+      {
+         i   = k;
+         if(i == dead) continue;
+         bin = surf->bin[(i < dead) ? mpiPairIndex(i, dead, surf->nres) 
+                                    : mpiPairIndex(dead, i, surf->nres)];
+      }
+
+      if(!atoms[i].alive) continue;
+      
+      if(--(atoms[i].count[bin]) == 0)
+      {
+         atoms[i].dist &= ~DISTBIT(bin);
+         if(!atoms[i].dirty)
+         {
+            atoms[i].dirty = TRUE;
+            worklist[(*nwork)++] = i;
+         }
+      }
+   }
+}
+
+
+/************************************************************************/
+/*>static DISTBITS TrimBitStrings(int npat, ATOM *pat, int nstruc, 
+                                  ATOM *struc)
+   ---------------------------------------------------------------
+   Search the bit strings of the pattern and remove any distance flags
+   which never occur in the structure and vice versa. The trimmed bit
+   strings are placed in the trim fields of the live atoms. Returns the
+   distance flags seen in the structure.
+
+   19.11.93 Original   By: ACRM
+   17.10.26 Works on the packed DISTBITS words by ORing together the
+            flags seen in each set and masking the other set with them
+            By: agent
+   17.10.26 Skips dead atoms and stores the results in trim By: agent
+*/
+static DISTBITS TrimBitStrings(int npat, ATOM *pat, int nstruc, ATOM *struc)
+{
+   int      j;
+   DISTBITS PatHits   = (DISTBITS)0,
+            StrucHits = (DISTBITS)0;
+
+   /* Find all the distances flagged in the pattern and the structure   */
+   for(j=0; j<npat; j++)
+   {
+      if(pat[j].alive) PatHits |= pat[j].dist;
+   }
+   for(j=0; j<nstruc; j++)
+   {
+      if(struc[j].alive) StrucHits |= struc[j].dist;
+   }
+   
+   /* Kill refs in the pattern to distances not seen in the structure   */
+   for(j=0; j<npat; j++)
+      pat[j].trim = pat[j].dist & StrucHits;
+
+   /* Kill refs in the structure to distances not seen in the pattern   */
+   for(j=0; j<nstruc; j++)
+      struc[j].trim = struc[j].dist & PatHits;
+
+   return(StrucHits);
+}
+
+
+/************************************************************************/
+/*>static int FindMatches(int NPatAtom,   ATOM *PatAtom, 
+                           int NStrucAtom, ATOM *StrucAtom, MATCHPAIR *match)
+   -------------------------------------------------------------------------
+   Run through the live pattern atoms and, for each, find the best match 
+   from the structure atoms. These are placed in match[] and the number
+   found is returned.
+
+   22.11.93 Original   By: ACRM
+   17.10.26 Skips dead atoms By: agent
+   17.10.26 Added label By: agent
+   17.10.26 Returns the number of matches By: agent
+   17.10.26 Renamed from PrintResults(). Returns the matches instead of
+            printing them By: agent
+*/
+static int FindMatches(int NPatAtom,   ATOM *PatAtom, 
+                       int NStrucAtom, ATOM *StrucAtom, MATCHPAIR *match)
+{
+   int i, best,
+       nmatch = 0;
+
+   for(i=0; i<NPatAtom; i++)
+   {
+      if(PatAtom[i].alive &&
+         ((best = FindBestMatch(PatAtom, i, StrucAtom, NStrucAtom)) 
+          != (-1)))
+      {
+         match[nmatch].pat   = i;
+         match[nmatch].struc = best;
+         match[nmatch].score = CalcScore(PatAtom[i].trim, 
+                                         StrucAtom[best].trim);
+         nmatch++;
+      }
+   }
+
+   return(nmatch);
+}
+
+
+/************************************************************************/
+/*>static int FindCliqueMatches(int NPatAtom,   ATOM *PatAtom, 
+                                 int NStrucAtom, ATOM *StrucAtom, 
+                                 MATCHPAIR *match, BOOL verbose)
+   ---------------------------------------------------------------------
+   Used instead of FindMatches() with -C. The best match for each 
+   pattern atom chosen by FindMatches() need not agree with the others,
+   so here the live atoms are used to build a correspondence graph (see
+   BuildCorrespondenceGraph()) and the largest clique gives a set of 
+   matches which are all consistent with one another. These are placed
+   in match[] in order of pattern atom. Returns the number of matches 
+   or -1 if there is no memory.
+
+   17.10.26 Original   By: agent
+   17.10.26 Renamed from PrintCliqueResults(). Returns the matches 
+            instead of printing them By: agent
+*/
+static int FindCliqueMatches(int NPatAtom,   ATOM *PatAtom, 
+                             int NStrucAtom, ATOM *StrucAtom, 
+                             MATCHPAIR *match, BOOL verbose)
+{
+   CLIQUEGRAPH graph;
+   int         i, v;
+
+   if(!BuildCorrespondenceGraph(&graph, NPatAtom, PatAtom, 
+                                NStrucAtom, StrucAtom))
+   {
+      fprintf(stderr,"No memory for correspondence graph\n");
+      FreeCliqueGraph(&graph);
+      return(-1);
+   }
+
+   FindMaxClique(&graph);
+
+   if(verbose)
+   {
+      fprintf(stderr, "Correspondence graph: %d vertices, clique of %d \
+found in %ld nodes%s\n", graph.nvert, graph.nbest, graph.nodes, 
+              ((graph.nodes > graph.maxnodes) ? " (stopped)" : ""));
+   }
+
+   /* Vertices are numbered in order of pattern atom                    */
+   qsort(graph.best, graph.nbest, sizeof(int), CompareInts);
+   for(i=0; i<graph.nbest; i++)
+   {
+      v = graph.best[i];
+      match[i].pat   = graph.pat[v];
+      match[i].struc = graph.struc[v];
+      match[i].score = CalcScore(PatAtom[graph.pat[v]].trim,
+                                 StrucAtom[graph.struc[v]].trim);
+   }
+   
+   i = graph.nbest;
+   FreeCliqueGraph(&graph);
+   return(i);
+}
+
+
+/************************************************************************/
+/*>static BOOL BuildCorrespondenceGraph(CLIQUEGRAPH *graph, 
+                                        int NPatAtom,   ATOM *PatAtom,
+                                        int NStrucAtom, ATOM *StrucAtom)
+   -----------------------------------------------------------------------
+   Builds the correspondence graph of the live atoms. There is a vertex
+   for each pattern atom and structure atom that FindBestMatch() would
+   accept: the properties are the same, Compare() passes and the score 
+   is above zero. Two vertices are joined if they pair different 
+   pattern atoms with different structure atoms and the distances 
+   between the two pattern residues and the two structure residues are
+   within CLIQUETOL bins. The distances are calculated from the 
+   coordinates so pairs outside the cutoff are checked as well. Returns
+   FALSE if there is no memory.
+
+   17.10.26 Original   By: agent
+   17.10.26 Also requires a score above zero as FindBestMatch() does
+            By: agent
+*/
+static BOOL BuildCorrespondenceGraph(CLIQUEGRAPH *graph, 
+                                     int NPatAtom,   ATOM *PatAtom,
+                                     int NStrucAtom, ATOM *StrucAtom)
+{
+   int i, j, u, v,
+       pass,
+       nlive    = 0,
+       nused    = 0,
+       *PatBin  = NULL,
+       *PatRow,
+       *used    = NULL;
+   unsigned char *StrucBin = NULL,
+                 *StrucRow;
+
+   graph->pat   = graph->struc = graph->cur = graph->best = NULL;
+   graph->adj   = graph->stack = NULL;
+   graph->nvert = graph->nbest = 0;
+   graph->nodes = 0;
+   graph->maxnodes = gClique;
+
+   /* Pass 0 counts the vertices, pass 1 stores them                    */
+   for(pass=0; pass<2; pass++)
+   {
+      if(pass)
+      {
+         graph->pat   = (int *)malloc(MAX(graph->nvert, 1) * sizeof(int));
+         graph->struc = (int *)malloc(MAX(graph->nvert, 1) * sizeof(int));
+         if((graph->pat == NULL) || (graph->struc == NULL))
+            return(FALSE);
+      }
+
+      for(graph->nvert=0, i=0; i<NPatAtom; i++)
+      {
+         if(!PatAtom[i].alive) continue;
+         if(!pass) nlive++;
+
+         for(j=0; j<NStrucAtom; j++)
+         {
+            if(StrucAtom[j].alive &&
+               (PatAtom[i].properties == StrucAtom[j].properties) &&
+               !Compare(PatAtom[i].trim, StrucAtom[j].trim) &&
+               (CalcScore(PatAtom[i].trim, StrucAtom[j].trim) > 
+                (REAL)0.0))
+            {
+               if(pass)
+               {
+                  graph->pat[graph->nvert]   = i;
+                  graph->struc[graph->nvert] = j;
+               }
+               graph->nvert++;
+            }
+         }
+      }
+   }
+
+   /* A clique can't be larger than the number of live pattern atoms, so
+      the search never needs more than nlive+1 levels of sets
+   */
+   graph->nword = SETWORDS(MAX(graph->nvert, 1));
+   graph->adj   = (unsigned long *)calloc((size_t)graph->nvert * 
+                                          graph->nword + 1,
+                                          sizeof(unsigned long));
+   graph->stack = (unsigned long *)malloc((size_t)(nlive + 2) * 2 * 
+                                          graph->nword * 
+                                          sizeof(unsigned long));
+   graph->cur   = (int *)malloc((nlive + 1) * sizeof(int));
+   graph->best  = (int *)malloc((nlive + 1) * sizeof(int));
+   PatBin       = (int *)malloc(MAX(NPatAtom * NPatAtom, 1) * sizeof(int));
+   if((graph->adj == NULL) || (graph->stack == NULL) || 
+      (graph->cur == NULL) || (graph->best == NULL) || (PatBin == NULL))
+   {
+      FREE(PatBin);
+      return(FALSE);
+   }
+
+   /* The distances are needed many times so are binned first. Only the
+      structure atoms in the graph are used; used[] numbers them
+   */
+   for(i=0; i<NPatAtom; i++)
+   {
+      for(j=i+1; j<NPatAtom; j++)
+      {
+         if(PatAtom[i].alive && PatAtom[j].alive)
+         {
+            PatBin[i*NPatAtom+j] = PatBin[j*NPatAtom+i] = 
+               ConvertDistanceToBin(DIST(PatAtom[i].res, PatAtom[j].res));
+         }
+      }
+   }
+
+   if((used = (int *)malloc(MAX(NStrucAtom, 1) * sizeof(int))) == NULL)
+   {
+      FREE(PatBin);
+      return(FALSE);
+   }
+   for(j=0; j<NStrucAtom; j++)
+      used[j] = (-1);
+   for(v=0; v<graph->nvert; v++)
+   {
+      if(used[graph->struc[v]] == (-1))
+         used[graph->struc[v]] = nused++;
+   }
+   if((StrucBin = (unsigned char *)malloc(MAX((size_t)nused * nused, 1)))
+      == NULL)
+   {
+      FREE(PatBin);
+      FREE(used);
+      return(FALSE);
+   }
+   for(i=0; i<NStrucAtom; i++)
+   {
+      if(used[i] == (-1)) continue;
+      for(j=i+1; j<NStrucAtom; j++)
+      {
+         if(used[j] == (-1)) continue;
+         StrucBin[(size_t)used[i]*nused+used[j]] = 
+            StrucBin[(size_t)used[j]*nused+used[i]] = (unsigned char)
+            ConvertDistanceToBin(DIST(StrucAtom[i].res, StrucAtom[j].res));
+      }
+   }
+
+   for(u=0; u<graph->nvert; u++)
+   {
+      PatRow   = PatBin + graph->pat[u] * NPatAtom;
+      StrucRow = StrucBin + (size_t)used[graph->struc[u]] * nused;
+      for(v=u+1; v<graph->nvert; v++)
+      {
+         if((graph->pat[u] != graph->pat[v]) &&
+            (graph->struc[u] != graph->struc[v]) &&
+            (ABS(PatRow[graph->pat[v]] - 
+                 (int)StrucRow[used[graph->struc[v]]]) <= CLIQUETOL))
+         {
+            SETADD(graph->adj + (size_t)u * graph->nword, v);
+            SETADD(graph->adj + (size_t)v * graph->nword, u);
+         }
+      }
+   }
+   
+   FREE(PatBin);
+   FREE(StrucBin);
+   FREE(used);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>static void FindMaxClique(CLIQUEGRAPH *graph)
+   ----------------------------------------------
+   Finds the largest clique in the correspondence graph with the 
+   Bron-Kerbosch algorithm. The vertices are first put in degeneracy
+   order (repeatedly taking the vertex with fewest neighbours left,
+   using the bucket method of Batagelj and Zaversnik) and each is then 
+   searched as the start of a clique with only its later
+   neighbours as candidates, which keeps the sets small. The clique is
+   left in graph->best and graph->nbest.
+
+   17.10.26 Original   By: agent
+*/
+static void FindMaxClique(CLIQUEGRAPH *graph)
+{
+   int           *order   = NULL,
+                 *degree  = NULL,
+                 *pos     = NULL,
+                 *start   = NULL,
+                 i, j, d, u, v, w,
+                 nword    = graph->nword;
+   unsigned long bits,
+                 *adj,
+                 *later   = graph->stack,
+                 *cand    = graph->stack + 2 * nword,
+                 *done    = cand + nword;
+
+   if(graph->nvert == 0)
+      return;
+
+   /* If there is no memory to order the vertices, just take them in 
+      turn
+   */
+   order  = (int *)malloc(graph->nvert * sizeof(int));
+   degree = (int *)malloc(graph->nvert * sizeof(int));
+   pos    = (int *)malloc(graph->nvert * sizeof(int));
+   start  = (int *)calloc(graph->nvert + 1, sizeof(int));
+   if((order == NULL) || (degree == NULL) || (pos == NULL) || 
+      (start == NULL))
+   {
+      if(order != NULL)
+      {
+         for(i=0; i<graph->nvert; i++)
+            order[i] = i;
+      }
+   }
+   else
+   {
+      /* Sort the vertices by degree. start[d] is the first with degree
+         d and pos[v] is the place of v in order[]
+      */
+      for(v=0; v<graph->nvert; v++)
+      {
+         degree[v] = CountSet(graph->adj + (size_t)v * nword, nword);
+         start[degree[v]]++;
+      }
+      for(i=0, d=0; d<graph->nvert; d++)
+      {
+         j        = start[d];
+         start[d] = i;
+         i       += j;
+      }
+      for(v=0; v<graph->nvert; v++)
+      {
+         pos[v] = start[degree[v]]++;
+         order[pos[v]] = v;
+      }
+      for(d=graph->nvert; d>0; d--)
+         start[d] = start[d-1];
+      start[0] = 0;
+
+      /* Take each vertex in turn. Each later neighbour loses one from
+         its degree so is moved to the start of its degree's block and 
+         the block is shortened
+      */
+      for(i=0; i<graph->nvert; i++)
+      {
+         v   = order[i];
+         adj = graph->adj + (size_t)v * nword;
+         for(w=0; w<nword; w++)
+         {
+            for(u=w*SETBITS, bits=adj[w]; bits; u++, bits>>=1)
+            {
+               if(!(bits & 1UL) || (degree[u] <= degree[v])) continue;
+               d = degree[u];
+               j = start[d];
+               if(order[j] != u)
+               {
+                  order[pos[u]] = order[j];
+                  pos[order[j]] = pos[u];
+                  order[j]      = u;
+                  pos[u]        = j;
+               }
+               start[d]++;
+               degree[u]--;
+            }
+         }
+      }
+   }
+   FREE(degree);
+   FREE(pos);
+   FREE(start);
+   if(order == NULL)
+      return;
+
+   /* Search from each vertex. Its earlier neighbours have already been
+      searched so go in the done set. later (the first level of the
+      stack) holds the vertices not yet searched
+   */
+   for(j=0; j<nword; j++)
+      later[j] = 0UL;
+   for(v=0; v<graph->nvert; v++)
+      SETADD(later, v);
+   
+   for(i=0; (i<graph->nvert) && (graph->nodes <= graph->maxnodes); i++)
+   {
+      v   = order[i];
+      adj = graph->adj + (size_t)v * nword;
+      SETDEL(later, v);
+      for(j=0; j<nword; j++)
+      {
+         cand[j] = adj[j] & later[j];
+         done[j] = adj[j] & ~later[j];
+      }
+
+      graph->cur[0] = v;
+      ExpandClique(graph, 1, cand, done);
+   }
+
+   FREE(order);
+}
+
+
+/************************************************************************/
+/*>static void ExpandClique(CLIQUEGRAPH *graph, int depth, 
+                            unsigned long *cand, unsigned long *done)
+   ---------------------------------------------------------------------
+   One step of the Bron-Kerbosch search. graph->cur[0..depth-1] is the 
+   clique so far, cand the vertices which could be added to it and done
+   those which could be added but have already been tried. The vertex 
+   in cand or done with most neighbours in cand is used as a pivot: only
+   vertices which are not its neighbours need to be tried as any clique
+   containing just its neighbours could take the pivot too. A branch is
+   abandoned if it can't beat the best clique found so far, and the
+   whole search stops once graph->maxnodes steps have been taken.
+
+   17.10.26 Original   By: agent
+*/
+static void ExpandClique(CLIQUEGRAPH *graph, int depth, unsigned long *cand,
+                         unsigned long *done)
+{
+   int           i, j, v, w,
+                 lo, hi,
+                 ncand,
+                 count,
+                 MaxCount = (-1),
+                 pivot    = (-1),
+                 nword    = graph->nword;
+   unsigned long bits,
+                 *adj,
+                 *PivotAdj,
+                 *NewCand = graph->stack + (size_t)(depth + 1) * 2 * nword,
+                 *NewDone = NewCand + nword;
+
+   if(++(graph->nodes) > graph->maxnodes)
+      return;
+
+   if(depth > graph->nbest)
+   {
+      graph->nbest = depth;
+      for(i=0; i<depth; i++)
+         graph->best[i] = graph->cur[i];
+   }
+
+   ncand = CountSet(cand, nword);
+   if((ncand == 0) || (depth + ncand <= graph->nbest))
+      return;
+
+   /* Only the words from lo to hi have candidates in them             */
+   for(lo=0; !cand[lo]; lo++);
+   for(hi=nword-1; !cand[hi]; hi--);
+
+   /* Choose the pivot, stopping if it is next to every candidate       */
+   for(w=0; (w<nword) && (MaxCount<ncand); w++)
+   {
+      for(v=w*SETBITS, bits=cand[w]|done[w]; bits; v++, bits>>=1)
+      {
+         if(!(bits & 1UL)) continue;
+         adj = graph->adj + (size_t)v * nword;
+         for(count=0, j=lo; j<=hi; j++)
+            count += COUNTBITS(cand[j] & adj[j]);
+         if(count > MaxCount)
+         {
+            MaxCount = count;
+            pivot    = v;
+         }
+      }
+   }
+
+   /* Try each candidate which is not a neighbour of the pivot. Once 
+      tried, it is moved from cand to done
+   */
+   PivotAdj = graph->adj + (size_t)pivot * nword;
+   for(w=lo; w<=hi; w++)
+   {
+      for(v=w*SETBITS, bits=cand[w] & ~PivotAdj[w]; bits; v++, bits>>=1)
+      {
+         if(!(bits & 1UL)) continue;
+         adj = graph->adj + (size_t)v * nword;
+         for(j=0; j<nword; j++)
+         {
+            NewCand[j] = cand[j] & adj[j];
+            NewDone[j] = done[j] & adj[j];
+         }
+         graph->cur[depth] = v;
+         ExpandClique(graph, depth+1, NewCand, NewDone);
+         if(graph->nodes > graph->maxnodes)
+            return;
+
+         SETDEL(cand, v);
+         SETADD(done, v);
+         if(depth + (--ncand) <= graph->nbest)
+            return;
+      }
+   }
+}
+
+
+/************************************************************************/
+/*>static int CountSet(unsigned long *set, int nword)
+   ---------------------------------------------------
+   Returns the number of vertices in a set of nword words
+
+   17.10.26 Original   By: agent
+*/
+static int CountSet(unsigned long *set, int nword)
+{
+   int i,
+       count = 0;
+
+   for(i=0; i<nword; i++)
+      count += COUNTBITS(set[i]);
+   return(count);
+}
+
+
+/************************************************************************/
+/*>static void FreeCliqueGraph(CLIQUEGRAPH *graph)
+   ------------------------------------------------
+   Frees the memory used by a correspondence graph
+
+   17.10.26 Original   By: agent
+*/
+static void FreeCliqueGraph(CLIQUEGRAPH *graph)
+{
+   FREE(graph->pat);
+   FREE(graph->struc);
+   FREE(graph->cur);
+   FREE(graph->best);
+   FREE(graph->adj);
+   FREE(graph->stack);
+}
+
+
+/************************************************************************/
+/*>static int FindBestMatch(ATOM *PatAtom,   int PatIndex, 
+                             ATOM *StrucAtom, int NStrucAtom)
+   -----------------------------------------------------------
+   Returns the index of the best match from the structure for this 
+   pattern atom or -1 if there is none
+
+   22.11.93 Original   By: ACRM
+   17.10.26 Moved out of PrintBestMatch() By: agent
+   17.10.26 Moved into mpcore.c By: agent
+*/
+static int FindBestMatch(ATOM *PatAtom,   int PatIndex, 
+                         ATOM *StrucAtom, int NStrucAtom)
+{
+   int  j,
+        best      = -1;
+   REAL score, 
+        BestScore = 0.0;
+
+   for(j=0; j<NStrucAtom; j++)
+   {
+      if(StrucAtom[j].alive &&
+         (PatAtom[PatIndex].properties == StrucAtom[j].properties) &&
+         !Compare(PatAtom[PatIndex].trim, StrucAtom[j].trim))
+      {
+         score = CalcScore(PatAtom[PatIndex].trim, StrucAtom[j].trim);
+         if(score > BestScore)
+         {
+            BestScore = score;
+            best = j;
+         }
+      }
+   }
+
+   return(best);
+}
+
+
+/************************************************************************/
+/*>static BOOL CreateFingerprints(FINGERPRINTS *prints, int NPatAtom)
+   ------------------------------------------------------------------
+   Allocates fingerprints for up to NPatAtom pattern atoms and fills in
+   need[] for the current gAccuracy. need[n] is the smallest number of
+   shared bits for which Compare() would accept strings with at most n
+   bits set, worked out with the same arithmetic so that the results
+   are identical. Returns FALSE if there is no memory; the fingerprints
+   must still be freed.
+
+   17.10.26 Original   By: agent
+   17.10.26 Uses gHaveAVX2 rather than checking the CPU By: agent
+*/
+static BOOL CreateFingerprints(FINGERPRINTS *prints, int NPatAtom)
+{
+   int nalloc = (NPatAtom / PRINTBLOCK + 1) * PRINTBLOCK,
+       n, m;
+
+   prints->natom      = 0;
+   prints->trim       = (unsigned int *)malloc(nalloc * 
+                                               sizeof(unsigned int));
+   prints->properties = (int *)malloc(nalloc * sizeof(int));
+   prints->nbits      = (int *)malloc(nalloc * sizeof(int));
+#ifdef SIMD_AVX2
+   prints->simd       = gHaveAVX2;
+#else
+   prints->simd       = FALSE;
+#endif
+
+   /* Two empty strings never match                                     */
+   prints->need[0] = MAXDIST + 1;
+   for(m=1; m<=MAXDIST; m++)
+   {
+      n = 0;
+      while((n <= m) && 
+            !(((REAL)100.0 * (REAL)n / (REAL)m) >= gAccuracy))
+         n++;
+      prints->need[m] = n;
+   }
+
+   return((prints->trim != NULL) && (prints->properties != NULL) &&
+          (prints->nbits != NULL));
+}
+
+
+/************************************************************************/
+/*>static void FillFingerprints(FINGERPRINTS *prints, int NPatAtom, 
+                                ATOM *PatAtom)
+   ----------------------------------------------------------------
+   Copies the properties and trimmed bit strings of the live pattern 
+   atoms into the fingerprints
+
+   17.10.26 Original   By: agent
+*/
+static void FillFingerprints(FINGERPRINTS *prints, int NPatAtom, 
+                             ATOM *PatAtom)
+{
+   int i, n = 0;
+
+   for(i=0; i<NPatAtom; i++)
+   {
+      if(PatAtom[i].alive)
+      {
+         prints->trim[n]       = (unsigned int)PatAtom[i].trim;
+         prints->properties[n] = PatAtom[i].properties;
+         prints->nbits[n]      = COUNTBITS(PatAtom[i].trim);
+         n++;
+      }
+   }
+   prints->natom = n;
+
+   /* Pad to a whole block with fingerprints that never match           */
+   for(; n % PRINTBLOCK; n++)
+   {
+      prints->trim[n]       = 0;
+      prints->properties[n] = (-1);
+      prints->nbits[n]      = 0;
+   }
+}
+
+
+/************************************************************************/
+/*>static void FreeFingerprints(FINGERPRINTS *prints)
+   --------------------------------------------------
+   Frees the arrays in a set of fingerprints
+
+   17.10.26 Original   By: agent
+*/
+static void FreeFingerprints(FINGERPRINTS *prints)
+{
+   FREE(prints->trim);
+   FREE(prints->properties);
+   FREE(prints->nbits);
+}
+
+
+/************************************************************************/
+/*>static BOOL MatchFingerprints(FINGERPRINTS *prints, int properties, 
+                                 DISTBITS trim)
+   -------------------------------------------------------------------
+   Returns TRUE if a structure atom with these properties and trimmed 
+   bit string matches any of the pattern fingerprints, i.e. one has the
+   same properties and Compare() would accept the bit strings. Uses
+   MatchFingerprintsAVX2() if the CPU has AVX2.
+
+   17.10.26 Original   By: agent
+*/
+static BOOL MatchFingerprints(FINGERPRINTS *prints, int properties, 
+                              DISTBITS trim)
+{
+   int i, 
+       nbits = COUNTBITS(trim);
+
+#ifdef SIMD_AVX2
+   if(prints->simd)
+      return(MatchFingerprintsAVX2(prints, properties, trim));
+#endif
+
+   for(i=0; i<prints->natom; i++)
+   {
+      if((prints->properties[i] == properties) &&
+         (COUNTBITS(prints->trim[i] & trim) >= 
+          prints->need[MAX(prints->nbits[i], nbits)]))
+         return(TRUE);
+   }
+   return(FALSE);
+}
+
+
+#ifdef SIMD_AVX2
+/************************************************************************/
+/*>static void DetectAVX2(void)
+   ----------------------------
+   Sets gHaveAVX2 if the CPU has AVX2. This is a constructor so it is 
+   run once when the program (or shared library) is loaded, before any
+   threads can be matching.
+
+   17.10.26 Original   By: agent
+*/
+static void DetectAVX2(void)
+{
+   __builtin_cpu_init();
+   gHaveAVX2 = (__builtin_cpu_supports("avx2") != 0);
+}
+
+
+/************************************************************************/
+/*>static BOOL MatchFingerprintsAVX2(FINGERPRINTS *prints, int properties, 
+                                     DISTBITS trim)
+   -----------------------------------------------------------------------
+   AVX2 version of MatchFingerprints() which tests PRINTBLOCK (8) 
+   fingerprints at a time. The shared bits are counted with a nibble 
+   lookup table and need[] is gathered for each.
+
+   17.10.26 Original   By: agent
+*/
+__attribute__((target("avx2")))
+static BOOL MatchFingerprintsAVX2(FINGERPRINTS *prints, int properties, 
+                                  DISTBITS trim)
+{
+   __m256i nibbles = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 
+                                      1, 2, 2, 3, 2, 3, 3, 4,
+                                      0, 1, 1, 2, 1, 2, 2, 3, 
+                                      1, 2, 2, 3, 2, 3, 3, 4),
+           low     = _mm256_set1_epi8(0x0f),
+           ones8   = _mm256_set1_epi8(1),
+           ones16  = _mm256_set1_epi16(1),
+           prop    = _mm256_set1_epi32(properties),
+           bits    = _mm256_set1_epi32((int)trim),
+           nbits   = _mm256_set1_epi32(COUNTBITS(trim)),
+           shared, count, need, match;
+   int     i;
+
+   for(i=0; i<prints->natom; i+=PRINTBLOCK)
+   {
+      /* Count the bits shared by each fingerprint                      */
+      shared = _mm256_and_si256(
+                  _mm256_loadu_si256((__m256i *)(prints->trim + i)), bits);
+      count  = _mm256_add_epi8(
+                  _mm256_shuffle_epi8(nibbles, 
+                                      _mm256_and_si256(shared, low)),
+                  _mm256_shuffle_epi8(nibbles,
+                                      _mm256_and_si256(
+                                         _mm256_srli_epi16(shared, 4),
+                                         low)));
+      count  = _mm256_madd_epi16(_mm256_maddubs_epi16(count, ones8), 
+                                 ones16);
+
+      /* Look up the number needed for the larger bit string            */
+      need   = _mm256_i32gather_epi32(prints->need,
+                  _mm256_max_epi32(
+                     _mm256_loadu_si256((__m256i *)(prints->nbits + i)),
+                     nbits), 4);
+
+      /* A match has the same properties and count >= need             */
+      match  = _mm256_andnot_si256(
+                  _mm256_cmpgt_epi32(need, count),
+                  _mm256_cmpeq_epi32(
+                     _mm256_loadu_si256((__m256i *)
+                                        (prints->properties + i)),
+                     prop));
+      if(!_mm256_testz_si256(match, match))
+         return(TRUE);
+   }
+   return(FALSE);
+}
+#endif
+
+
+/************************************************************************/
+/*>static BOOL Compare(DISTBITS dist1, DISTBITS dist2)
+   ----------------------------------------------------
+   Compares two distance bitstrings requiring the percentage of set flags
+   in common to reach gAccuracy. Returns FALSE if they match.
+
+   22.11.93 Original   By: ACRM
+   17.10.26 Now takes packed DISTBITS words and uses AND and popcount
+            By: agent
+*/
+static BOOL Compare(DISTBITS dist1, DISTBITS dist2)
+{
+   int  CountDist1 = COUNTBITS(dist1),
+        CountDist2 = COUNTBITS(dist2),
+        NMatch     = COUNTBITS(dist1 & dist2);
+
+   /* Two empty strings never match (the old code gave 0/0 here)        */
+   if(!CountDist1 && !CountDist2)
+      return(TRUE);
+   
+   if(((REAL)100.0 * (REAL)NMatch / 
+       (REAL)MAX(CountDist1, CountDist2)) >= gAccuracy)
+   {
+      return(FALSE);
+   }
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>static REAL CalcScore(DISTBITS dist1, DISTBITS dist2)
+   -----------------------------------------------------
+   Calculate the score for this match. Much the same as compare, but 
+   returns the percentage score rather than a BOOL
+
+   22.11.93 Original   By: ACRM
+   17.10.26 Now takes packed DISTBITS words and uses AND and popcount
+            By: agent
+*/
+static REAL CalcScore(DISTBITS dist1, DISTBITS dist2)
+{
+   int CountDist1 = COUNTBITS(dist1),
+       CountDist2 = COUNTBITS(dist2),
+       NMatch     = COUNTBITS(dist1 & dist2);
+
+   return((REAL)100.0 * (REAL)NMatch / 
+          (REAL)MAX(CountDist1, CountDist2));
+}
+
+
+#ifndef __GNUC__
+/************************************************************************/
+/*>static int CountBits(DISTBITS bits)
+   -----------------------------------
+   Portable population count used by COUNTBITS() when the compiler does
+   not provide a builtin
+
+   17.10.26 Original   By: agent
+*/
+static int CountBits(DISTBITS bits)
+{
+   int count = 0;
+
+   while(bits)
+   {
+      bits &= bits - 1;
+      count++;
+   }
+   return(count);
+}
+#endif
+
+
+/************************************************************************/
+/*>static int CompareInts(const void *a, const void *b)
+   -----------------------------------------------------
+   qsort() comparison function for integers
+
+   17.10.26 Original   By: agent
+*/
+static int CompareInts(const void *a, const void *b)
+{
+   return(*(const int *)a - *(const int *)b);
+}
@@ -0,0 +1,152 @@
+/* Definitions shared by the matching core (mpcore.c), the library
+   interface (libmatchpatch.c) and matchpatch. Not installed.
+*/
+#ifndef _MPCORE_H
+#define _MPCORE_H
+
+#include "libmatchpatch.h"
+#include "properties.h"
+
+/************************************************************************/
+/* Defines
+*/
+#define MAXITER       100
+#define MAXDIST        32
+#define MAXBUFF       160
+#define MAXLABEL      MPMAXLABEL
+#define MAXRESID      MPMAXRESID
+
+#define DEFBIN        1.0     /* Default distance bin size              */
+#define DEFACC       50.0     /* Default string match accuracy          */
+#define MAXCELLRATIO    8     /* Max grid cells per residue in cell list*/
+#define RESCHUNK      256     /* Initial residues allocated for a file  */
+#define CLIQUETOL       1     /* Bins two clique distances may differ   */
+
+/* The property bits written by matchpatchsurface must be those given
+   to library users
+*/
+#if (MPPROP_POSITIVE    != PROP_POSITIVE)    || \
+    (MPPROP_NEGATIVE    != PROP_NEGATIVE)    || \
+    (MPPROP_AROMATIC    != PROP_AROMATIC)    || \
+    (MPPROP_HYDROPHOBIC != PROP_HYDROPHOBIC) || \
+    (MPPROP_HYDROPHILIC != PROP_HYDROPHILIC) || \
+    (MPMAXPROPERTIES    != MAXPROPERTIES)
+#  error The MPPROP_ bits in libmatchpatch.h do not match properties.h
+#endif
+
+/* A signature has a DISTBITS word for each ordered pair of property
+   sets (see SIGWORD())
+*/
+#define NPROPSETS     (1 << MAXPROPERTIES)
+#define NSIGWORD      (NPROPSETS * NPROPSETS)
+#define SIGWORD(p1, p2) ((p1) * NPROPSETS + (p2))
+
+/* The distance flags are packed into a DISTBITS word with bin i being
+   bit i, so all MAXDIST bins must fit into 32 bits
+*/
+#if (MAXDIST > 32)
+#  error MAXDIST is too large for the DISTBITS word
+#endif
+
+#define DISTBIT(i)    ((DISTBITS)1 << (i))
+
+/* Properties with any bit other than the MAXPROPERTIES property bits
+   would index outside the signature and property set arrays
+*/
+#define PROPMASK      ((1 << MAXPROPERTIES) - 1)
+#define VALIDPROPERTIES(p) (((p) & ~PROPMASK) == 0)
+
+/* Fingerprints are compared 8 at a time with AVX2 if the compiler can
+   build it and the CPU has it. Define NOSIMD to use only the scalar 
+   code.
+*/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    !defined(NOSIMD)
+#  define SIMD_AVX2
+#endif
+#define PRINTBLOCK      8     /* Fingerprints are padded to a multiple  */
+
+/************************************************************************/
+/* Structure and type definitions
+*/
+typedef unsigned long DISTBITS;
+
+typedef MPRESIDUE RESIDUE;
+
+/* Distances are held either as a full triangular matrix (bin) or, if
+   a cutoff is used, as lists of the neighbours of each residue (with
+   bin set to NULL). The neighbours of residue i are nbr[nbrstart[i]] to
+   nbr[nbrstart[i+1]-1] and each pair appears in both lists.
+   If the surface came from a binary file with stored bins, bin points
+   into the file which is mapped at map. If the file was read from a
+   pipe, map is the file's contents in allocated memory and mapsize is 0.
+   sig is the signature from mpiCreateSignature() or NULL if there is none.
+*/
+typedef struct
+{
+   RESIDUE       *res;           /* Table of residues                   */
+   unsigned char *bin,           /* Bins indexed by mpiPairIndex()      */
+                 *nbrbin;        /* Distance bins for the neighbours    */
+   int           *nbrstart,      /* Start of each residue's neighbours  */
+                 *nbr,           /* Residue numbers of the neighbours   */
+                 nres;
+   long          npair;
+   char          *map;           /* Mapped binary file or NULL          */
+   size_t        mapsize;
+   DISTBITS      *sig;           /* Signature of the pairs or NULL      */
+}  SURFACE;
+
+typedef struct
+{
+   RESIDUE  *res;                /* Residue in the SURFACE              */
+   int      properties;          /* Properties (inverted if required)   */
+   DISTBITS dist,                /* Distance flags to live atoms        */
+            trim;                /* dist after TrimBitStrings()         */
+   int      count[MAXDIST];      /* Number of live atoms in each bin    */
+   BOOL     alive,
+            dirty;               /* dist changed since last checked     */
+}  ATOM;
+
+/* The prepared patterns and structures of libmatchpatch.h. The atom
+   arrays are only ever copied so they may be shared between threads
+*/
+struct mppattern
+{
+   SURFACE *surf;
+   ATOM    *atoms;               /* Properties inverted if required     */
+};
+
+struct mpstructure
+{
+   SURFACE *surf;                /* With its signature                  */
+   ATOM    *atoms;
+};
+
+/* A match found by mpiDoLesk(): the pattern and structure atoms (which
+   are also the residue numbers in their SURFACEs) and the score
+*/
+typedef struct
+{
+   int  pat,
+        struc;
+   REAL score;
+}  MATCHPAIR;
+
+/************************************************************************/
+/* Prototypes
+*/
+SURFACE *mpiReadDataAndCreateMatrix(FILE *fp);
+SURFACE *mpiCreateSurface(RESIDUE *res, int nres);
+void mpiFreeSurface(SURFACE *surf);
+BOOL mpiCreateSignature(SURFACE *surf);
+ATOM *mpiCreateAtomArray(SURFACE *surf, BOOL SwapProp);
+long mpiPairIndex(int i, int j, int natom);
+int  mpiDoLesk(SURFACE *pat, ATOM *PatAtom, SURFACE *struc, ATOM *StrucAtom,
+               MATCHPAIR *match, int minmatch, BOOL verbose);
+int  mpiDoWindowedLesk(SURFACE *pat, ATOM *PatAtom, SURFACE *struc,
+                       ATOM *StrucAtom, MATCHPAIR *match, int *centre,
+                       int minmatch, BOOL verbose);
+BOOL mpiMatch(MPPATTERN *pat, MPSTRUCTURE *struc, BOOL window,
+              int minmatch, BOOL verbose, MPRESULT *result);
+
+#endif
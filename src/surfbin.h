@@ -0,0 +1,32 @@
+/* Binary surface files written by matchpatchsurface -b and read by
+   matchpatch. A file is a SURFBINHEADER followed by nres SURFBINRES
+   records and then, if npair is not zero, the distance bin for each
+   pair of residues i<j in the order (0,1), (0,2) ... (1,2) ...
+   The bins are (int)(distance/binsize) limited to maxdist-2 with the
+   distance calculated from the float coordinates.
+*/
+#define SURFBINMAGIC   "MPSURFB"    /* 7 characters and the NUL         */
+#define SURFBINVERSION 1
+#define SURFBINENDIAN  0x01020304   /* Reads differently if swapped     */
+#define SURFBINMAXDIST 32           /* Max distance bins (as matchpatch)*/
+
+typedef struct
+{
+   char  magic[8];
+   int   version,
+         endian,
+         recsize,                   /* sizeof(SURFBINRES) when written  */
+         nres,
+         npair,                     /* Number of bins or 0 if none      */
+         maxdist;
+   float binsize;
+   int   spare;
+}  SURFBINHEADER;
+
+typedef struct
+{
+   char  resnam[8],
+         resid[16];
+   int   properties;                /* Bit PROP_xxx set for each one    */
+   float x, y, z;
+}  SURFBINRES;